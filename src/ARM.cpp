@@ -654,7 +654,11 @@ void ARMv5::ExecuteJIT()
         ARMJIT::JitBlockEntry block = ARMJIT::LookUpBlock(0, FastBlockLookup,
             instrAddr - FastBlockLookupStart, instrAddr);
         if (block)
+#ifdef JIT_VERIFY_ENABLED
+            ARMJIT::VerifyBlock(this, block);
+#else
             ARM_Dispatch(this, block);
+#endif
         else
             ARMJIT::CompileBlock(this);
 
@@ -805,7 +809,11 @@ void ARMv4::ExecuteJIT()
         ARMJIT::JitBlockEntry block = ARMJIT::LookUpBlock(1, FastBlockLookup,
             instrAddr - FastBlockLookupStart, instrAddr);
         if (block)
+#ifdef JIT_VERIFY_ENABLED
+            ARMJIT::VerifyBlock(this, block);
+#else
             ARM_Dispatch(this, block);
+#endif
         else
             ARMJIT::CompileBlock(this);
 
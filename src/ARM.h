@@ -38,6 +38,15 @@ enum
 const u32 ITCMPhysicalSize = 0x8000;
 const u32 DTCMPhysicalSize = 0x4000;
 
+#ifdef JIT_VERIFY_ENABLED
+namespace ARMJIT
+{
+// called for every data write of the interpreter and the JIT slow paths
+// (addr already aligned), see ARMJIT_Verify.cpp
+void VerifyLogWrite(u32 num, u32 addr, u32 size, u32 val);
+}
+#endif
+
 class ARM
 {
 public:
@@ -364,6 +373,9 @@ public:
 
     void DataWrite8(u32 addr, u8 val)
     {
+#ifdef JIT_VERIFY_ENABLED
+        ARMJIT::VerifyLogWrite(1, addr, 8, val);
+#endif
         BusWrite8(addr, val);
         DataRegion = addr;
         DataCycles = NDS::ARM7MemTimings[addr >> 15][0];
@@ -373,6 +385,9 @@ public:
     {
         addr &= ~1;
 
+#ifdef JIT_VERIFY_ENABLED
+        ARMJIT::VerifyLogWrite(1, addr, 16, val);
+#endif
         BusWrite16(addr, val);
         DataRegion = addr;
         DataCycles = NDS::ARM7MemTimings[addr >> 15][0];
@@ -382,6 +397,9 @@ public:
     {
         addr &= ~3;
 
+#ifdef JIT_VERIFY_ENABLED
+        ARMJIT::VerifyLogWrite(1, addr, 32, val);
+#endif
         BusWrite32(addr, val);
         DataRegion = addr;
         DataCycles = NDS::ARM7MemTimings[addr >> 15][2];
@@ -391,6 +409,9 @@ public:
     {
         addr &= ~3;
 
+#ifdef JIT_VERIFY_ENABLED
+        ARMJIT::VerifyLogWrite(1, addr, 32, val);
+#endif
         BusWrite32(addr, val);
         DataCycles += NDS::ARM7MemTimings[addr >> 15][3];
     }
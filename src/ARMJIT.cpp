@@ -21,6 +21,7 @@
 #include <string.h>
 #include <assert.h>
 #include <unordered_map>
+#include <chrono>
 
 #define XXH_STATIC_LINKING_ONLY
 #include "xxhash/xxhash.h"
@@ -68,6 +69,27 @@ std::unordered_map<u32, JitBlock*> RestoreCandidates;
 
 TinyVector<u32> InvalidLiterals;
 
+Stats JITStats;
+
+struct FastmemSite
+{
+    u16 Faults;
+    u8 Mode;
+};
+
+std::unordered_map<u32, FastmemSite> FastmemSites;
+
+// the fault handler only records the sites which faulted, they're
+// recompiled from outside of it the next time a block is looked up
+struct FaultedFastmemSite
+{
+    u32 Site;
+    bool OtherRegion;
+};
+
+FaultedFastmemSite FaultedFastmemSites[64];
+u32 NumFaultedFastmemSites;
+
 AddressRange CodeIndexITCM[ITCMPhysicalSize / 512];
 AddressRange CodeIndexMainRAM[NDS::MainRAMMaxSize / 512];
 AddressRange CodeIndexSWRAM[NDS::SharedWRAMSize / 512];
@@ -179,6 +201,10 @@ T SlowRead9(u32 addr, ARMv5* cpu)
     u32 offset = addr & 0x3;
     addr &= ~(sizeof(T) - 1);
 
+#ifdef JIT_VERIFY_ENABLED
+    VerifyLogRead(0, addr);
+#endif
+
     T val;
     if (addr < cpu->ITCMSize)
         val = *(T*)&cpu->ITCM[addr & 0x7FFF];
@@ -202,6 +228,10 @@ void SlowWrite9(u32 addr, ARMv5* cpu, u32 val)
 {
     addr &= ~(sizeof(T) - 1);
 
+#ifdef JIT_VERIFY_ENABLED
+    VerifyLogWrite(0, addr, sizeof(T) * 8, val);
+#endif
+
     if (addr < cpu->ITCMSize)
     {
         CheckAndInvalidate<0, ARMJIT_Memory::memregion_ITCM>(addr);
@@ -231,6 +261,10 @@ T SlowRead7(u32 addr)
     u32 offset = addr & 0x3;
     addr &= ~(sizeof(T) - 1);
 
+#ifdef JIT_VERIFY_ENABLED
+    VerifyLogRead(1, addr);
+#endif
+
     T val;
     if (std::is_same<T, u32>::value)
         val = (ConsoleType == 0 ? NDS::ARM7Read32 : DSi::ARM7Read32)(addr);
@@ -250,6 +284,10 @@ void SlowWrite7(u32 addr, u32 val)
 {
     addr &= ~(sizeof(T) - 1);
 
+#ifdef JIT_VERIFY_ENABLED
+    VerifyLogWrite(1, addr, sizeof(T) * 8, val);
+#endif
+
     if (std::is_same<T, u32>::value)
         (ConsoleType == 0 ? NDS::ARM7Write32 : DSi::ARM7Write32)(addr, val);
     else if (std::is_same<T, u16>::value)
@@ -337,6 +375,10 @@ void Reset()
     ResetBlockCache();
 
     ARMJIT_Memory::Reset();
+
+    FastmemSites.clear();
+    NumFaultedFastmemSites = 0;
+    ResetStats();
 }
 
 void FloodFillSetFlags(FetchedInstr instrs[], int start, u8 flags)
@@ -445,12 +487,58 @@ bool DecodeBranch(bool thumb, const FetchedInstr& instr, u32& cond, bool hasLink
     return false;
 }
 
+bool IsPollableAddress(u32 addr)
+{
+    // reading memory never has side effects
+    if ((addr >> 24) != 0x04)
+        return true;
+
+    // only IO registers which can be read without side effects and which
+    // only change through events, IRQs or the other CPU, so skipping
+    // ahead to the next sync point doesn't change what the loop sees
+    if ((addr & ~0x3) >= 0x040000B0 && (addr & ~0x3) < 0x040000E0) // DMA
+        return true;
+
+    switch (addr & ~0x3)
+    {
+    case 0x04000004: // DISPSTAT/VCOUNT
+    case 0x04000130: // KEYINPUT/KEYCNT
+    case 0x04000134: // RCNT/EXTKEYIN
+    case 0x04000180: // IPCSYNC
+    case 0x04000184: // IPCFIFOCNT
+    case 0x040001A0: // AUXSPICNT
+    case 0x040001A4: // ROMCTRL
+    case 0x040001C0: // SPICNT
+    case 0x04000208: // IME
+    case 0x04000210: // IE
+    case 0x04000214: // IF
+    case 0x04000600: // GXSTAT
+        return true;
+    }
+    return false;
+}
+
+bool IsLoopExit(bool thumb, const FetchedInstr& instr, u32 loopStart, u32 loopEnd)
+{
+    bool link;
+    u32 cond, target, linkAddr;
+    if (!DecodeBranch(thumb, instr, cond, false, 0, link, linkAddr, target))
+        return false;
+
+    return cond < 0xE && !link && (target < loopStart || target > loopEnd);
+}
+
 bool IsIdleLoop(bool thumb, FetchedInstr* instrs, int instrsCount)
 {
     // see https://github.com/dolphin-emu/dolphin/blob/master/Source/Core/Core/PowerPC/PPCAnalyst.cpp#L678
     // it basically checks if one iteration of a loop depends on another
     // the rules are quite simple
 
+    // this also catches loops polling IO registers (e.g. waiting for VCOUNT
+    // or for the other CPU via IPCSYNC), as long as the only things
+    // they read are RAM and side effect free registers
+    // conditional branches leaving the loop are fine too
+
     JIT_DEBUGPRINT("checking potential idle loop\n");
     u16 regsWrittenTo = 0;
     u16 regsDisallowedToWrite = 0;
@@ -459,9 +547,12 @@ bool IsIdleLoop(bool thumb, FetchedInstr* instrs, int instrsCount)
         JIT_DEBUGPRINT("instr %d %08x regs(%x %x) %x %x\n", i, instrs[i].Instr, instrs[i].Info.DstRegs, instrs[i].Info.SrcRegs, regsWrittenTo, regsDisallowedToWrite);
         if (instrs[i].Info.SpecialKind == ARMInstrInfo::special_WriteMem)
             return false;
+        if (instrs[i].Info.SpecialKind == ARMInstrInfo::special_LoadMem && !IsPollableAddress(instrs[i].DataRegion))
+            return false;
         if (!thumb && instrs[i].Info.Kind >= ARMInstrInfo::ak_MSR_IMM && instrs[i].Info.Kind <= ARMInstrInfo::ak_MRC)
             return false;
-        if (i < instrsCount - 1 && instrs[i].Info.Branches())
+        if (i < instrsCount - 1 && instrs[i].Info.Branches()
+            && !IsLoopExit(thumb, instrs[i], instrs[0].Addr, instrs[instrsCount - 1].Addr))
             return false;
 
         u16 srcRegs = instrs[i].Info.SrcRegs & ~(1 << 15);
@@ -804,7 +895,7 @@ void CompileBlock(ARM* cpu)
                 {
                     for (int j = 0; j < i; j++)
                     {
-                        if (instrs[i].Addr == target)
+                        if (instrs[j].Addr == target)
                         {
                             isBackJump = true;
                             break;
@@ -812,7 +903,9 @@ void CompileBlock(ARM* cpu)
                     }
                 }
 
-                if (cond < 0xE && target < instrs[i].Addr && target >= lastSegmentStart)
+                // polling loops are often a conditional branch out of the loop
+                // and an unconditional one back to its start
+                if ((cond < 0xE || !link) && target < instrs[i].Addr && target >= lastSegmentStart)
                 {
                     // we might have an idle loop
                     u32 backwardsOffset = (instrs[i].Addr - target) / (thumb ? 2 : 4);
@@ -918,6 +1011,11 @@ void CompileBlock(ARM* cpu)
         block->StartAddrLocal = localAddr;
 
         FloodFillSetFlags(instrs, i - 1, 0xF);
+
+        auto compileStart = std::chrono::steady_clock::now();
+        u32 codeUsedBefore = JITCompiler->GetCodeBufferUsed(cpu->Num);
+        u64 resetsBefore = JITStats.CacheResets[cpu->Num];
+
         #if defined(__APPLE__) && defined(__aarch64__)
             pthread_jit_write_protect_np(false);
         #endif
@@ -926,12 +1024,23 @@ void CompileBlock(ARM* cpu)
             pthread_jit_write_protect_np(true);
         #endif
 
+        // if the compiler had to flush the cache first the block starts from an empty buffer
+        u32 codeUsedAfter = JITCompiler->GetCodeBufferUsed(cpu->Num);
+        JITStats.CodeBytesEmitted[cpu->Num] += JITStats.CacheResets[cpu->Num] != resetsBefore
+            ? codeUsedAfter
+            : codeUsedAfter - codeUsedBefore;
+        JITStats.BlocksCompiled[cpu->Num]++;
+        JITStats.CompileTimeNs[cpu->Num] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - compileStart).count();
+
         JIT_DEBUGPRINT("block start %p\n", block->EntryPoint);
     }
     else
     {
         JIT_DEBUGPRINT("restored! %p\n", prevBlock);
         block = prevBlock;
+
+        JITStats.BlocksRestored[cpu->Num]++;
     }
 
     assert((localAddr & 1) == 0);
@@ -961,7 +1070,7 @@ void CompileBlock(ARM* cpu)
     *entry |= JITCompiler->SubEntryOffset(block->EntryPoint);
 }
 
-void InvalidateByAddr(u32 localAddr)
+void InvalidateByAddr(u32 localAddr, bool mayRestore)
 {
     JIT_DEBUGPRINT("invalidating by addr %x\n", localAddr);
 
@@ -995,6 +1104,8 @@ void InvalidateByAddr(u32 localAddr)
         }
         range->Blocks.Remove(i);
 
+        JITStats.Invalidations[localAddr >> 27]++;
+
         if (range->Blocks.Length == 0
             && !PageContainsCode(&region[(localAddr & 0x7FFF000) / 512]))
         {
@@ -1044,7 +1155,7 @@ void InvalidateByAddr(u32 localAddr)
         else
             JitBlocks7.erase(block->StartAddr);
 
-        if (!literalInvalidation)
+        if (!literalInvalidation && mayRestore)
         {
             RetireJitBlock(block);
         }
@@ -1055,6 +1166,59 @@ void InvalidateByAddr(u32 localAddr)
     }
 }
 
+int GetFastmemSiteMode(u32 num, u32 instrAddr)
+{
+#ifdef JIT_VERIFY_ENABLED
+    // every access has to go through the slow path so that it can be logged
+    return fastmemSite_Slow;
+#endif
+
+    auto it = FastmemSites.find(instrAddr | num);
+    if (it != FastmemSites.end())
+        return it->second.Mode;
+    return fastmemSite_Fast;
+}
+
+void FastmemSiteFaulted(u32 site, bool otherRegion)
+{
+    // called from the signal handler, so nothing may be allocated or freed here.
+    // The site is already patched to the slow path, if too many sites fault at once
+    // the remaining ones just fault again after their block was recompiled
+    if (NumFaultedFastmemSites < sizeof(FaultedFastmemSites) / sizeof(FaultedFastmemSites[0]))
+        FaultedFastmemSites[NumFaultedFastmemSites++] = {site, otherRegion};
+}
+
+void UpdateFaultedFastmemSites()
+{
+    for (u32 i = 0; i < NumFaultedFastmemSites; i++)
+    {
+        u32 site = FaultedFastmemSites[i].Site;
+
+        FastmemSite& info = FastmemSites[site];
+        info.Faults++;
+        if (info.Mode == fastmemSite_Fast && FaultedFastmemSites[i].OtherRegion)
+            info.Mode = fastmemSite_Checked;
+        else
+            info.Mode = fastmemSite_Slow;
+
+        JIT_DEBUGPRINT("fastmem site %x faulted %d times, mode %d\n", site, info.Faults, info.Mode);
+
+        // make sure the next time the block is entered
+        // it gets recompiled instead of restored.
+        u32 localAddr = LocaliseCodeAddress(site & 1, site & ~1);
+        if (localAddr)
+        {
+            u64 invalidationsBefore = JITStats.Invalidations[localAddr >> 27];
+            InvalidateByAddr(localAddr, false);
+
+            // these aren't caused by code being written to
+            JITStats.FastmemRecompiles += JITStats.Invalidations[localAddr >> 27] - invalidationsBefore;
+            JITStats.Invalidations[localAddr >> 27] = invalidationsBefore;
+        }
+    }
+    NumFaultedFastmemSites = 0;
+}
+
 void CheckAndInvalidateITCM()
 {
     for (u32 i = 0; i < ITCMPhysicalSize; i+=16)
@@ -1076,6 +1240,9 @@ void CheckAndInvalidate(u32 addr)
 
 JitBlockEntry LookUpBlock(u32 num, u64* entries, u32 offset, u32 addr)
 {
+    if (NumFaultedFastmemSites)
+        UpdateFaultedFastmemSites();
+
     u64* entry = &entries[offset / 2];
     if (*entry >> 32 == (addr | num))
         return JITCompiler->AddEntryOffset((u32)*entry);
@@ -1121,10 +1288,38 @@ template void CheckAndInvalidate<1, ARMJIT_Memory::memregion_NewSharedWRAM_B>(u3
 template void CheckAndInvalidate<0, ARMJIT_Memory::memregion_NewSharedWRAM_C>(u32);
 template void CheckAndInvalidate<1, ARMJIT_Memory::memregion_NewSharedWRAM_C>(u32);
 
+void GetStats(Stats& stats)
+{
+    stats = JITStats;
+    for (int i = 0; i < 2; i++)
+    {
+        stats.CodeBufferUsed[i] = JITCompiler->GetCodeBufferUsed(i);
+        stats.CodeBufferSize[i] = JITCompiler->GetCodeBufferSize(i);
+    }
+
+    stats.FastmemSitesChecked = 0;
+    stats.FastmemSitesSlow = 0;
+    for (auto it : FastmemSites)
+    {
+        if (it.second.Mode == fastmemSite_Checked)
+            stats.FastmemSitesChecked++;
+        else if (it.second.Mode == fastmemSite_Slow)
+            stats.FastmemSitesSlow++;
+    }
+}
+
+void ResetStats()
+{
+    memset(&JITStats, 0, sizeof(JITStats));
+}
+
 void ResetBlockCache()
 {
     printf("Resetting JIT block cache...\n");
 
+    JITStats.CacheResets[0]++;
+    JITStats.CacheResets[1]++;
+
     // could be replace through a function which only resets
     // the permissions but we're too lazy
     ARMJIT_Memory::Reset();
@@ -1168,4 +1363,71 @@ void ResetBlockCache()
     JITCompiler->Reset();
 }
 
+void ResetBlockCache(u32 num)
+{
+    printf("Resetting JIT block cache of ARM%d...\n", num ? 7 : 9);
+
+    JITStats.CacheResets[num]++;
+
+    for (auto it = RestoreCandidates.begin(); it != RestoreCandidates.end();)
+    {
+        if (it->second->Num == num)
+        {
+            delete it->second;
+            it = RestoreCandidates.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    auto& blocks = num == 0 ? JitBlocks9 : JitBlocks7;
+    for (auto it : blocks)
+    {
+        JitBlock* block = it.second;
+        for (int j = 0; j < block->NumAddresses; j++)
+        {
+            u32 addr = block->AddressRanges()[j];
+            AddressRange* region = CodeMemRegions[addr >> 27];
+            AddressRange* range = &region[(addr & 0x7FFFFFF) / 512];
+
+            bool removed = range->Blocks.RemoveByValue(block);
+            assert(removed);
+            (void)removed;
+
+            // the blocks of the other cpu stay, so the code mask has to be rebuilt from them
+            range->Code = 0;
+            for (int k = 0; k < range->Blocks.Length; k++)
+            {
+                JitBlock* otherBlock = range->Blocks[k];
+                for (int l = 0; l < otherBlock->NumAddresses; l++)
+                {
+                    if (otherBlock->AddressRanges()[l] == addr)
+                    {
+                        range->Code |= otherBlock->AddressMasks()[l];
+                        break;
+                    }
+                }
+            }
+
+            if (range->Blocks.Length == 0
+                && !PageContainsCode(&region[(addr & 0x7FFF000) / 512]))
+            {
+                ARMJIT_Memory::SetCodeProtection(addr >> 27, addr & 0x7FFFFFF, false);
+            }
+        }
+
+        // the entry might belong to a block of the other cpu in shared memory
+        u64* entry = &FastBlockLookupRegions[block->StartAddrLocal >> 27][(block->StartAddrLocal & 0x7FFFFFF) / 2];
+        if (((*entry >> 32) & 1) == num)
+            *entry = (u64)UINT32_MAX << 32;
+
+        delete block;
+    }
+    blocks.clear();
+
+    JITCompiler->ResetCPU(num);
+}
+
 }
@@ -23,12 +23,47 @@
 
 #include "ARM.h"
 #include "ARM_InstrInfo.h"
+#include "ARMJIT_Memory.h"
 
 namespace ARMJIT
 {
 
 typedef void (*JitBlockEntry)();
 
+// counters are accumulated since the last Reset()/ResetStats()
+// everything indexed by [2] is per CPU (0 = ARM9, 1 = ARM7)
+struct Stats
+{
+    u64 BlocksCompiled[2];
+    // blocks brought back from RestoreCandidates without recompiling
+    u64 BlocksRestored[2];
+    u64 CodeBytesEmitted[2];
+    u64 CompileTimeNs[2];
+
+    // blocks thrown away because their code was written to,
+    // indexed by the ARMJIT_Memory::memregion_* they were invalidated from
+    u64 Invalidations[ARMJIT_Memory::memregions_Count];
+    // code cache flushes per cpu (buffer full, savestate load, ...)
+    u64 CacheResets[2];
+
+    // fastmem faults caught by the fault handler
+    u64 FastmemFaults;
+    // faults which were resolved by mapping in the memory
+    u64 FastmemRemaps;
+    // faults which rewrote the load/store to use the slow path
+    u64 FastmemPatches;
+    // blocks thrown away to recompile such a load/store
+    u64 FastmemRecompiles;
+    // loads/stores which are currently compiled with an inline region check
+    // or which always take the slow path because they faulted before
+    u32 FastmemSitesChecked;
+    u32 FastmemSitesSlow;
+
+    // current fill level of each cpu's code buffer in bytes
+    u32 CodeBufferUsed[2];
+    u32 CodeBufferSize[2];
+};
+
 void Init();
 void DeInit();
 
@@ -36,7 +71,7 @@ void Reset();
 
 void CheckAndInvalidateITCM();
 
-void InvalidateByAddr(u32 pseudoPhysical);
+void InvalidateByAddr(u32 pseudoPhysical, bool mayRestore = true);
 
 template <u32 num, int region>
 void CheckAndInvalidate(u32 addr);
@@ -44,10 +79,21 @@ void CheckAndInvalidate(u32 addr);
 void CompileBlock(ARM* cpu);
 
 void ResetBlockCache();
+// only throws away the code of one cpu
+void ResetBlockCache(u32 num);
 
 JitBlockEntry LookUpBlock(u32 num, u64* entries, u32 offset, u32 addr);
 bool SetupExecutableRegion(u32 num, u32 blockAddr, u64*& entry, u32& start, u32& size);
 
+void GetStats(Stats& stats);
+void ResetStats();
+
+#ifdef JIT_VERIFY_ENABLED
+// runs the block, then rolls back and runs the same instructions through the interpreter.
+// Aborts with a report at the first difference in registers, cycles or memory writes
+void VerifyBlock(ARM* cpu, JitBlockEntry entry);
+#endif
+
 }
 
 extern "C" void ARM_Dispatch(ARM* cpu, ARMJIT::JitBlockEntry entry);
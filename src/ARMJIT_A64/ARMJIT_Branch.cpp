@@ -378,6 +378,8 @@ void Compiler::T_Comp_B()
 {
     s32 offset = (s32)((CurInstr.Instr & 0x7FF) << 21) >> 20;
     Comp_JumpTo(R15 + offset + 1);
+
+    Comp_BranchSpecialBehaviour(true);
 }
 
 void Compiler::T_Comp_BranchXchangeReg()
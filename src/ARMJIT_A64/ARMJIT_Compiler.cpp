@@ -469,6 +469,17 @@ Compiler::Compiler()
     JitMemMainSize -= JitMemSecondarySize;
 
     SetCodeBase((u8*)GetRWPtr(), (u8*)GetRXPtr());
+
+    // the ARM9 gets three quarters of both regions, since it usually runs a lot more code
+    MainStart[0] = 0;
+    MainSize[0] = ((JitMemMainSize / 4) * 3) & ~3;
+    MainStart[1] = MainStart[0] + MainSize[0];
+    MainSize[1] = JitMemMainSize - MainSize[0];
+
+    SecondaryStart[0] = JitMemMainSize;
+    SecondarySize[0] = (JitMemSecondarySize / 4) * 3;
+    SecondaryStart[1] = SecondaryStart[0] + SecondarySize[0];
+    SecondarySize[1] = JitMemSecondarySize - SecondarySize[0];
 }
 
 Compiler::~Compiler()
@@ -692,21 +703,25 @@ void Compiler::Comp_BranchSpecialBehaviour(bool taken)
 
 JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, bool hasMemInstr)
 {
-    if (JitMemMainSize - GetCodeOffset() < 1024 * 16)
+    Num = cpu->Num;
+
+    if ((MainStart[Num] + MainSize[Num]) - MainOffset[Num] < 1024 * 16)
     {
         printf("JIT near memory full, resetting...\n");
-        ResetBlockCache();
+        ResetBlockCache(Num);
     }
-    if ((JitMemMainSize +  JitMemSecondarySize) - OtherCodeRegion < 1024 * 8)
+    if ((SecondaryStart[Num] + SecondarySize[Num]) - SecondaryOffset[Num] < 1024 * 8)
     {
         printf("JIT far memory full, resetting...\n");
-        ResetBlockCache();
+        ResetBlockCache(Num);
     }
 
+    SetCodePtr(MainOffset[Num]);
+    OtherCodeRegion = SecondaryOffset[Num];
+
     JitBlockEntry res = (JitBlockEntry)GetRXPtr();
 
     Thumb = thumb;
-    Num = cpu->Num;
     CurCPU = cpu;
     ConstantCycles = 0;
     RegCache = RegisterCache<Compiler, ARM64Reg>(this, instrs, instrsCount, true);
@@ -841,6 +856,9 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
 
     FlushIcache();
 
+    MainOffset[Num] = GetCodeOffset();
+    SecondaryOffset[Num] = OtherCodeRegion;
+
     return res;
 }
 
@@ -855,6 +873,42 @@ void Compiler::Reset()
 
     for (int i = 0; i < (JitMemMainSize + JitMemSecondarySize) / 4; i++)
         *(((u32*)GetRWPtr()) + i) = brk_0;
+
+    for (int i = 0; i < 2; i++)
+    {
+        MainOffset[i] = MainStart[i];
+        SecondaryOffset[i] = SecondaryStart[i];
+    }
+}
+
+void Compiler::ResetCPU(u32 num)
+{
+    for (auto it = LoadStorePatches.begin(); it != LoadStorePatches.end();)
+    {
+        if ((it->first >= MainStart[num] && it->first < MainStart[num] + MainSize[num])
+            || (it->first >= SecondaryStart[num] && it->first < SecondaryStart[num] + SecondarySize[num]))
+            it = LoadStorePatches.erase(it);
+        else
+            it++;
+    }
+
+    const u32 brk_0 = 0xD4200000;
+
+    SetCodePtr(MainStart[num]);
+    for (u32 i = 0; i < MainSize[num] / 4; i++)
+        *(((u32*)GetRWPtr()) + i) = brk_0;
+    FlushIcacheSection((u8*)GetRXPtr(), (u8*)GetRXPtr() + MainSize[num]);
+
+    SetCodePtr(SecondaryStart[num]);
+    for (u32 i = 0; i < SecondarySize[num] / 4; i++)
+        *(((u32*)GetRWPtr()) + i) = brk_0;
+    FlushIcacheSection((u8*)GetRXPtr(), (u8*)GetRXPtr() + SecondarySize[num]);
+
+    MainOffset[num] = MainStart[num];
+    SecondaryOffset[num] = SecondaryStart[num];
+
+    SetCodePtr(MainOffset[num]);
+    OtherCodeRegion = SecondaryOffset[num];
 }
 
 void Compiler::Comp_AddCycles_C(bool forceNonConstant)
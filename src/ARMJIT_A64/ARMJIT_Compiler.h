@@ -90,6 +90,8 @@ struct LoadStorePatch
     void* PatchFunc;
     s32 PatchOffset;
     u32 PatchSize;
+    // instruction address | cpu num
+    u32 Site;
 };
 
 class Compiler : public Arm64Gen::ARM64XEmitter
@@ -119,6 +121,7 @@ public:
     }
 
     void Reset();
+    void ResetCPU(u32 num);
 
     void Comp_AddCycles_C(bool forceNonConstant = false);
     void Comp_AddCycles_CI(u32 numI);
@@ -233,8 +236,18 @@ public:
         return (u8*)entry - GetRXBase();
     }
 
+    u32 GetCodeBufferUsed(u32 num)
+    {
+        return (MainOffset[num] - MainStart[num]) + (SecondaryOffset[num] - SecondaryStart[num]);
+    }
+
+    u32 GetCodeBufferSize(u32 num)
+    {
+        return MainSize[num] + SecondarySize[num];
+    }
+
     bool IsJITFault(u8* pc);
-    u8* RewriteMemAccess(u8* pc);
+    u8* RewriteMemAccess(u8* pc, u32& site);
 
     void SwapCodeRegion()
     {
@@ -260,6 +273,16 @@ public:
     u32 JitMemSecondarySize;
     u32 JitMemMainSize;
 
+    // each cpu has its own main and secondary code region,
+    // so that one of them running full doesn't throw away the code of the other
+    ptrdiff_t MainStart[2];
+    ptrdiff_t SecondaryStart[2];
+    u32 MainSize[2];
+    u32 SecondarySize[2];
+
+    ptrdiff_t MainOffset[2];
+    ptrdiff_t SecondaryOffset[2];
+
     std::unordered_map<ptrdiff_t, LoadStorePatch> LoadStorePatches; 
 
     RegisterCache<Compiler, Arm64Gen::ARM64Reg> RegCache;
@@ -32,7 +32,7 @@ bool Compiler::IsJITFault(u8* pc)
     return (u64)pc >= (u64)GetRXBase() && (u64)pc - (u64)GetRXBase() < (JitMemMainSize + JitMemSecondarySize);
 }
 
-u8* Compiler::RewriteMemAccess(u8* pc)
+u8* Compiler::RewriteMemAccess(u8* pc, u32& site)
 {
     ptrdiff_t pcOffset = pc - GetRXBase();
 
@@ -43,6 +43,8 @@ u8* Compiler::RewriteMemAccess(u8* pc)
         LoadStorePatch patch = it->second;
         LoadStorePatches.erase(it);
 
+        site = patch.Site;
+
         ptrdiff_t curCodeOffset = GetCodeOffset();
 
         SetCodePtrUnsafe(pcOffset + patch.PatchOffset);
@@ -189,10 +191,27 @@ void Compiler::Comp_MemAccess(int rd, int rn, Op2 offset, int size, int flags)
         ? ARMJIT_Memory::ClassifyAddress9(addrIsStatic ? staticAddress : CurInstr.DataRegion)
         : ARMJIT_Memory::ClassifyAddress7(addrIsStatic ? staticAddress : CurInstr.DataRegion);
 
-    if (Config::JIT_FastMemory && ((!Thumb && CurInstr.Cond() != 0xE) || ARMJIT_Memory::IsFastmemCompatible(expectedTarget)))
+    int siteMode = GetFastmemSiteMode(Num, CurInstr.Addr);
+    if (siteMode == fastmemSite_Checked && !ARMJIT_Memory::IsFastmemCompatible(expectedTarget))
+        siteMode = fastmemSite_Slow;
+
+    if (Config::JIT_FastMemory && siteMode != fastmemSite_Slow
+        && ((!Thumb && CurInstr.Cond() != 0xE) || ARMJIT_Memory::IsFastmemCompatible(expectedTarget)))
     {
+        FixupBranch otherRegion;
+        if (siteMode == fastmemSite_Checked)
+        {
+            LSR(W1, W0, 24);
+            CMP(W1, (addrIsStatic ? staticAddress : CurInstr.DataRegion) >> 24);
+            FixupBranch sameRegion = B(CC_EQ);
+            // the far code might be out of reach for a conditional branch
+            otherRegion = B();
+            SetJumpTarget(sameRegion);
+        }
+
         ptrdiff_t memopStart = GetCodeOffset();
         LoadStorePatch patch;
+        patch.Site = CurInstr.Addr | Num;
 
         assert((rdMapped >= W8 && rdMapped <= W15) || (rdMapped >= W19 && rdMapped <= W25) || rdMapped == W4);
         patch.PatchFunc = flags & memop_Store
@@ -221,6 +240,20 @@ void Compiler::Comp_MemAccess(int rd, int rn, Op2 offset, int size, int flags)
         patch.PatchOffset = memopStart - loadStorePosition;
         patch.PatchSize = GetCodeOffset() - memopStart;
         LoadStorePatches[loadStorePosition] = patch;
+
+        if (siteMode == fastmemSite_Checked)
+        {
+            // the slow path is exactly what the access would be patched to
+            SwapCodeRegion();
+            u8* slowPathStart = (u8*)GetRXPtr();
+            SetJumpTarget(otherRegion);
+            BL(patch.PatchFunc);
+            FixupBranch ret = B();
+            u8* slowPathEnd = (u8*)GetRXPtr();
+            SwapCodeRegion();
+            SetJumpTarget(ret);
+            FlushIcacheSection(slowPathStart, slowPathEnd);
+        }
     }
     else
     {
@@ -498,7 +531,8 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
         : ARMJIT_Memory::ClassifyAddress7(CurInstr.DataRegion);
 
     bool compileFastPath = Config::JIT_FastMemory
-        && store && !usermode && (CurInstr.Cond() < 0xE || ARMJIT_Memory::IsFastmemCompatible(expectedTarget));
+        && store && !usermode && (CurInstr.Cond() < 0xE || ARMJIT_Memory::IsFastmemCompatible(expectedTarget))
+        && GetFastmemSiteMode(Num, CurInstr.Addr) == fastmemSite_Fast;
 
     {
         s32 offset = decrement
@@ -586,6 +620,7 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
 
         LoadStorePatch patch;
         patch.PatchSize = GetCodeOffset() - fastPathStart;
+        patch.Site = CurInstr.Addr | Num;
         SwapCodeRegion();
         patchFunc = (u8*)GetRXPtr();
         patch.PatchFunc = patchFunc;
@@ -216,6 +216,32 @@ extern InterpreterFunc InterpretTHUMB[];
 
 extern TinyVector<u32> InvalidLiterals;
 
+extern Stats JITStats;
+
+/*
+    Fastmem sites (single loads/stores, LDM/STM) are keyed by the address
+    of their instruction with the CPU number in bit 0.
+
+    A site starts out as a plain fastmem access. When it faults and
+    has to be patched to the slow path, the block containing it is
+    thrown away and it gets recompiled depending on where the access went:
+    - into a region which can't be fastmem'd (IO and such): the access
+    sometimes goes to RAM and sometimes not, so we check the region inline
+    and only take the slow path when it differs from the region seen
+    during compilation
+    - anywhere else (e.g. writes into pages containing code) or if it already
+    was compiled with a check: we'd just fault again, so it always takes the slow path.
+*/
+enum
+{
+    fastmemSite_Fast = 0,
+    fastmemSite_Checked,
+    fastmemSite_Slow,
+};
+
+int GetFastmemSiteMode(u32 num, u32 instrAddr);
+void FastmemSiteFaulted(u32 site, bool otherRegion);
+
 extern AddressRange* const CodeMemRegions[ARMJIT_Memory::memregions_Count];
 
 inline bool PageContainsCode(AddressRange* range)
@@ -241,6 +267,10 @@ template <typename T, int ConsoleType> void SlowWrite7(u32 addr, u32 val);
 template <bool Write, int ConsoleType> void SlowBlockTransfer9(u32 addr, u64* data, u32 num, ARMv5* cpu);
 template <bool Write, int ConsoleType> void SlowBlockTransfer7(u32 addr, u64* data, u32 num);
 
+#ifdef JIT_VERIFY_ENABLED
+void VerifyLogRead(u32 num, u32 addr);
+#endif
+
 }
 
 #endif
\ No newline at end of file
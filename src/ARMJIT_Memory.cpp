@@ -678,13 +678,29 @@ bool FaultHandler(FaultDescription& faultDesc)
     {
         bool rewriteToSlowPath = true;
 
+        ARMJIT::JITStats.FastmemFaults++;
+
         u8* memStatus = NDS::CurCPU == 0 ? MappingStatus9 : MappingStatus7;
 
         if (memStatus[faultDesc.EmulatedFaultAddr >> 12] == memstate_Unmapped)
             rewriteToSlowPath = !MapAtAddress(faultDesc.EmulatedFaultAddr);
 
         if (rewriteToSlowPath)
-            faultDesc.FaultPC = ARMJIT::JITCompiler->RewriteMemAccess(faultDesc.FaultPC);
+        {
+            ARMJIT::JITStats.FastmemPatches++;
+
+            u32 site;
+            faultDesc.FaultPC = ARMJIT::JITCompiler->RewriteMemAccess(faultDesc.FaultPC, site);
+
+            int region = NDS::CurCPU == 0
+                ? ClassifyAddress9(faultDesc.EmulatedFaultAddr)
+                : ClassifyAddress7(faultDesc.EmulatedFaultAddr);
+            ARMJIT::FastmemSiteFaulted(site, !IsFastmemCompatible(region));
+        }
+        else
+        {
+            ARMJIT::JITStats.FastmemRemaps++;
+        }
 
         return true;
     }
@@ -1201,6 +1217,11 @@ T VRAMRead(u32 addr)
 
 void* GetFuncForAddr(ARM* cpu, u32 addr, bool store, int size)
 {
+#ifdef JIT_VERIFY_ENABLED
+    // direct calls would bypass the access logging of the slow paths
+    return NULL;
+#endif
+
     if (cpu->Num == 0)
     {
         switch (addr & 0xFF000000)
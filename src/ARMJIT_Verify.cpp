@@ -0,0 +1,519 @@
+/*
+    Copyright 2016-2021 Arisotura, RSDuck
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include "ARMJIT.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <unordered_set>
+
+#include "Config.h"
+
+#include "ARMJIT_Internal.h"
+#include "ARMJIT_Memory.h"
+#include "ARMInterpreter.h"
+#include "DSi.h"
+#include "GPU.h"
+
+/*
+    Lockstep verification of the JIT against the interpreter (ENABLE_JIT_VERIFY).
+
+    Every block is first run through the JIT as usual. Afterwards its memory
+    writes are undone, the CPU state is rolled back and the same instructions
+    are run through the interpreter. Both have to end up with the same registers
+    and the same sequence of memory writes, otherwise we print what we've got and abort.
+
+    The cycle counts are only compared with a warning. The JIT calculates the data
+    access timings from the memory regions seen while compiling the block, so they're
+    expected to be off whenever the block accesses a different region at runtime.
+
+    Of course this only works if the block didn't touch anything with side effects
+    (IO, ...). Those blocks are only counted and not checked.
+
+    To see all memory accesses of the JIT code fastmem and the direct calls into
+    the IO handlers are disabled in this build, everything goes through the
+    slow paths, where VerifyLogRead/VerifyLogWrite are called.
+
+    melonDS doesn't have an ARM disassembler, so the report lists the instructions
+    as raw opcodes, to be fed into an external disassembler.
+*/
+
+namespace ARMJIT
+{
+
+enum
+{
+    verifyPhase_Off = 0,
+    verifyPhase_JIT,
+    verifyPhase_Interpreter,
+};
+
+struct VerifyWrite
+{
+    u32 Addr;
+    u32 Val;
+    u32 OldVal;
+    u32 Size;
+};
+
+struct VerifyCPUState
+{
+    u32 R[16];
+    u32 CPSR;
+    u32 R_FIQ[8];
+    u32 R_SVC[3];
+    u32 R_ABT[3];
+    u32 R_IRQ[3];
+    u32 R_UND[3];
+    s32 Cycles;
+};
+
+struct VerifyInstr
+{
+    u32 Addr;
+    u32 Instr;
+    bool Thumb;
+};
+
+int VerifyPhase = verifyPhase_Off;
+bool VerifyReplayable;
+
+std::vector<VerifyWrite> JITWrites;
+std::vector<VerifyWrite> InterpreterWrites;
+std::vector<VerifyInstr> InterpretedInstrs;
+
+u64 VerifiedBlocks[2];
+u64 SkippedBlocks[2];
+u64 CycleMismatches[2];
+
+// blocks which were already reported to have a different cycle count
+std::unordered_set<u32> CycleMismatchBlocks;
+
+bool IsSideEffectFree(u32 num, u32 addr)
+{
+    int region = num == 0
+        ? ARMJIT_Memory::ClassifyAddress9(addr)
+        : ARMJIT_Memory::ClassifyAddress7(addr);
+
+    switch (region)
+    {
+    case ARMJIT_Memory::memregion_ITCM:
+    case ARMJIT_Memory::memregion_DTCM:
+    case ARMJIT_Memory::memregion_BIOS9:
+    case ARMJIT_Memory::memregion_MainRAM:
+    case ARMJIT_Memory::memregion_SharedWRAM:
+    case ARMJIT_Memory::memregion_VRAM:
+    case ARMJIT_Memory::memregion_BIOS7:
+    case ARMJIT_Memory::memregion_WRAM7:
+    case ARMJIT_Memory::memregion_VWRAM:
+    case ARMJIT_Memory::memregion_BIOS9DSi:
+    case ARMJIT_Memory::memregion_BIOS7DSi:
+    case ARMJIT_Memory::memregion_NewSharedWRAM_A:
+    case ARMJIT_Memory::memregion_NewSharedWRAM_B:
+    case ARMJIT_Memory::memregion_NewSharedWRAM_C:
+        return true;
+    default:
+        return false;
+    }
+}
+
+template <typename T>
+T ReadMem(u32 num, u32 addr)
+{
+    if (num == 0)
+        return NDS::ConsoleType == 0 ? SlowRead9<T, 0>(addr, NDS::ARM9) : SlowRead9<T, 1>(addr, NDS::ARM9);
+    else
+        return NDS::ConsoleType == 0 ? SlowRead7<T, 0>(addr) : SlowRead7<T, 1>(addr);
+}
+
+// writes straight into the memory behind the side effect free regions,
+// so that undoing the writes of the JIT doesn't invalidate any blocks
+template <typename T>
+void WriteMem(u32 num, u32 addr, u32 val)
+{
+    int region = num == 0
+        ? ARMJIT_Memory::ClassifyAddress9(addr)
+        : ARMJIT_Memory::ClassifyAddress7(addr);
+
+    u8* ptr = NULL;
+    switch (region)
+    {
+    case ARMJIT_Memory::memregion_ITCM:
+        ptr = &NDS::ARM9->ITCM[addr & (ITCMPhysicalSize - 1)];
+        break;
+    case ARMJIT_Memory::memregion_DTCM:
+        ptr = &NDS::ARM9->DTCM[(addr - NDS::ARM9->DTCMBase) & (DTCMPhysicalSize - 1)];
+        break;
+    case ARMJIT_Memory::memregion_MainRAM:
+        ptr = &NDS::MainRAM[addr & NDS::MainRAMMask];
+        break;
+    case ARMJIT_Memory::memregion_SharedWRAM:
+        {
+            NDS::MemRegion& swram = num == 0 ? NDS::SWRAM_ARM9 : NDS::SWRAM_ARM7;
+            if (swram.Mem)
+                ptr = &swram.Mem[addr & swram.Mask];
+        }
+        break;
+    case ARMJIT_Memory::memregion_WRAM7:
+        ptr = &NDS::ARM7WRAM[addr & (NDS::ARM7WRAMSize - 1)];
+        break;
+    case ARMJIT_Memory::memregion_NewSharedWRAM_A:
+        ptr = DSi::NWRAMMap_A[num][(addr >> 16) & DSi::NWRAMMask[num][0]];
+        if (ptr) ptr += addr & 0xFFFF;
+        break;
+    case ARMJIT_Memory::memregion_NewSharedWRAM_B:
+        ptr = DSi::NWRAMMap_B[num][(addr >> 15) & DSi::NWRAMMask[num][1]];
+        if (ptr) ptr += addr & 0x7FFF;
+        break;
+    case ARMJIT_Memory::memregion_NewSharedWRAM_C:
+        ptr = DSi::NWRAMMap_C[num][(addr >> 15) & DSi::NWRAMMask[num][2]];
+        if (ptr) ptr += addr & 0x7FFF;
+        break;
+    case ARMJIT_Memory::memregion_VRAM:
+        switch (addr & 0x00E00000)
+        {
+        case 0x00000000: GPU::WriteVRAM_ABG<T>(addr, val); break;
+        case 0x00200000: GPU::WriteVRAM_BBG<T>(addr, val); break;
+        case 0x00400000: GPU::WriteVRAM_AOBJ<T>(addr, val); break;
+        case 0x00600000: GPU::WriteVRAM_BOBJ<T>(addr, val); break;
+        default: GPU::WriteVRAM_LCDC<T>(addr, val); break;
+        }
+        return;
+    case ARMJIT_Memory::memregion_VWRAM:
+        GPU::WriteVRAM_ARM7<T>(addr, val);
+        return;
+    default:
+        // the BIOS can't be written to
+        return;
+    }
+
+    if (ptr)
+        *(T*)ptr = val;
+}
+
+// reads made from here aren't logged
+u32 ReadMem(u32 num, u32 addr, u32 size)
+{
+    int phase = VerifyPhase;
+    VerifyPhase = verifyPhase_Off;
+
+    u32 val;
+    switch (size)
+    {
+    case 32: val = ReadMem<u32>(num, addr); break;
+    case 16: val = ReadMem<u16>(num, addr); break;
+    default: val = ReadMem<u8>(num, addr); break;
+    }
+
+    VerifyPhase = phase;
+    return val;
+}
+
+void WriteMem(u32 num, u32 addr, u32 size, u32 val)
+{
+    switch (size)
+    {
+    case 32: WriteMem<u32>(num, addr, val); break;
+    case 16: WriteMem<u16>(num, addr, val); break;
+    default: WriteMem<u8>(num, addr, val); break;
+    }
+}
+
+void VerifyLogRead(u32 num, u32 addr)
+{
+    if (VerifyPhase == verifyPhase_JIT && !IsSideEffectFree(num, addr))
+        VerifyReplayable = false;
+}
+
+void VerifyLogWrite(u32 num, u32 addr, u32 size, u32 val)
+{
+    if (VerifyPhase == verifyPhase_Off)
+        return;
+
+    if (size < 32)
+        val &= (1 << size) - 1;
+
+    VerifyWrite write = {addr, val, 0, size};
+    if (VerifyPhase == verifyPhase_JIT)
+    {
+        if (IsSideEffectFree(num, addr))
+            write.OldVal = ReadMem(num, addr, size);
+        else
+            VerifyReplayable = false;
+        JITWrites.push_back(write);
+    }
+    else
+    {
+        InterpreterWrites.push_back(write);
+    }
+}
+
+void SaveCPUState(ARM* cpu, VerifyCPUState& state)
+{
+    memcpy(state.R, cpu->R, sizeof(state.R));
+    state.CPSR = cpu->CPSR;
+    memcpy(state.R_FIQ, cpu->R_FIQ, sizeof(state.R_FIQ));
+    memcpy(state.R_SVC, cpu->R_SVC, sizeof(state.R_SVC));
+    memcpy(state.R_ABT, cpu->R_ABT, sizeof(state.R_ABT));
+    memcpy(state.R_IRQ, cpu->R_IRQ, sizeof(state.R_IRQ));
+    memcpy(state.R_UND, cpu->R_UND, sizeof(state.R_UND));
+    state.Cycles = cpu->Cycles;
+}
+
+void LoadCPUState(ARM* cpu, VerifyCPUState& state)
+{
+    memcpy(cpu->R, state.R, sizeof(state.R));
+    cpu->CPSR = state.CPSR;
+    memcpy(cpu->R_FIQ, state.R_FIQ, sizeof(state.R_FIQ));
+    memcpy(cpu->R_SVC, state.R_SVC, sizeof(state.R_SVC));
+    memcpy(cpu->R_ABT, state.R_ABT, sizeof(state.R_ABT));
+    memcpy(cpu->R_IRQ, state.R_IRQ, sizeof(state.R_IRQ));
+    memcpy(cpu->R_UND, state.R_UND, sizeof(state.R_UND));
+    cpu->Cycles = state.Cycles;
+}
+
+// the program visible state and banked registers are compared separately,
+// cycles aren't part of the state which has to match
+bool RegistersMatch(VerifyCPUState& a, VerifyCPUState& b)
+{
+    return memcmp(a.R, b.R, sizeof(a.R)) == 0 && a.CPSR == b.CPSR;
+}
+
+bool StatesMatch(VerifyCPUState& a, VerifyCPUState& b)
+{
+    return RegistersMatch(a, b)
+        && memcmp(a.R_FIQ, b.R_FIQ, sizeof(a.R_FIQ)) == 0
+        && memcmp(a.R_SVC, b.R_SVC, sizeof(a.R_SVC)) == 0
+        && memcmp(a.R_ABT, b.R_ABT, sizeof(a.R_ABT)) == 0
+        && memcmp(a.R_IRQ, b.R_IRQ, sizeof(a.R_IRQ)) == 0
+        && memcmp(a.R_UND, b.R_UND, sizeof(a.R_UND)) == 0;
+}
+
+bool WritesMatch()
+{
+    if (JITWrites.size() != InterpreterWrites.size())
+        return false;
+
+    for (size_t i = 0; i < JITWrites.size(); i++)
+    {
+        if (JITWrites[i].Addr != InterpreterWrites[i].Addr
+            || JITWrites[i].Size != InterpreterWrites[i].Size
+            || JITWrites[i].Val != InterpreterWrites[i].Val)
+            return false;
+    }
+    return true;
+}
+
+// same as the loop bodies of ARMv5::Execute and ARMv4::Execute
+template <int Num>
+void InterpretInstr(ARM* cpu)
+{
+    if (cpu->CPSR & 0x20)
+    {
+        cpu->R[15] += 2;
+        cpu->CurInstr = cpu->NextInstr[0];
+        cpu->NextInstr[0] = cpu->NextInstr[1];
+        if (Num == 0)
+        {
+            if (cpu->R[15] & 0x2) { cpu->NextInstr[1] >>= 16; cpu->CodeCycles = 0; }
+            else                  cpu->NextInstr[1] = ((ARMv5*)cpu)->CodeRead32(cpu->R[15], false);
+        }
+        else
+        {
+            cpu->NextInstr[1] = ((ARMv4*)cpu)->CodeRead16(cpu->R[15]);
+        }
+
+        ARMInterpreter::THUMBInstrTable[(cpu->CurInstr >> 6) & 0x3FF](cpu);
+    }
+    else
+    {
+        cpu->R[15] += 4;
+        cpu->CurInstr = cpu->NextInstr[0];
+        cpu->NextInstr[0] = cpu->NextInstr[1];
+        if (Num == 0)
+            cpu->NextInstr[1] = ((ARMv5*)cpu)->CodeRead32(cpu->R[15], false);
+        else
+            cpu->NextInstr[1] = ((ARMv4*)cpu)->CodeRead32(cpu->R[15]);
+
+        if (cpu->CheckCondition(cpu->CurInstr >> 28))
+        {
+            u32 icode = ((cpu->CurInstr >> 4) & 0xF) | ((cpu->CurInstr >> 16) & 0xFF0);
+            ARMInterpreter::ARMInstrTable[icode](cpu);
+        }
+        else if (Num == 0 && (cpu->CurInstr & 0xFE000000) == 0xFA000000)
+        {
+            ARMInterpreter::A_BLX_IMM(cpu);
+        }
+        else
+        {
+            cpu->AddCycles_C();
+        }
+    }
+}
+
+void PrintReg(const char* name, u32 jit, u32 interpreter)
+{
+    printf("  %-8s %08X %08X%s\n", name, jit, interpreter, jit != interpreter ? "  <--" : "");
+}
+
+void PrintBankedRegs(const char* name, u32* jit, u32* interpreter, int count)
+{
+    char regName[16];
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(regName, sizeof(regName), "%s%d", name, i);
+        PrintReg(regName, jit[i], interpreter[i]);
+    }
+}
+
+void PrintWrites(const char* name, std::vector<VerifyWrite>& writes)
+{
+    printf("%s memory writes (%d):\n", name, (int)writes.size());
+    for (size_t i = 0; i < writes.size(); i++)
+        printf("  [%08X] = %0*X (%d bit)\n", writes[i].Addr, writes[i].Size / 4, writes[i].Val, writes[i].Size);
+}
+
+void ReportDivergence(ARM* cpu, u32 blockAddr, VerifyCPUState& initial, VerifyCPUState& jit, VerifyCPUState& interpreter)
+{
+    printf("JIT verification failed on ARM%d at block %08X (%s)\n",
+        cpu->Num ? 7 : 9, blockAddr, (initial.CPSR & 0x20) ? "THUMB" : "ARM");
+    printf("blocks verified so far: %llu/%llu, skipped because of side effects: %llu/%llu, with different cycles: %llu/%llu\n",
+        (unsigned long long)VerifiedBlocks[0], (unsigned long long)VerifiedBlocks[1],
+        (unsigned long long)SkippedBlocks[0], (unsigned long long)SkippedBlocks[1],
+        (unsigned long long)CycleMismatches[0], (unsigned long long)CycleMismatches[1]);
+
+    printf("instructions run by the interpreter (address: opcode):\n");
+    for (size_t i = 0; i < InterpretedInstrs.size(); i++)
+    {
+        if (InterpretedInstrs[i].Thumb)
+            printf("  %08X:     %04X\n", InterpretedInstrs[i].Addr, InterpretedInstrs[i].Instr);
+        else
+            printf("  %08X: %08X\n", InterpretedInstrs[i].Addr, InterpretedInstrs[i].Instr);
+    }
+
+    printf("           jit      interpreter (initial CPSR %08X, cycles %d)\n", initial.CPSR, initial.Cycles);
+    char regName[8];
+    for (int i = 0; i < 16; i++)
+    {
+        snprintf(regName, sizeof(regName), "R%d", i);
+        PrintReg(regName, jit.R[i], interpreter.R[i]);
+    }
+    PrintReg("CPSR", jit.CPSR, interpreter.CPSR);
+    PrintBankedRegs("R_FIQ", jit.R_FIQ, interpreter.R_FIQ, 8);
+    PrintBankedRegs("R_SVC", jit.R_SVC, interpreter.R_SVC, 3);
+    PrintBankedRegs("R_ABT", jit.R_ABT, interpreter.R_ABT, 3);
+    PrintBankedRegs("R_IRQ", jit.R_IRQ, interpreter.R_IRQ, 3);
+    PrintBankedRegs("R_UND", jit.R_UND, interpreter.R_UND, 3);
+    PrintReg("Cycles", jit.Cycles, interpreter.Cycles);
+
+    PrintWrites("jit", JITWrites);
+    PrintWrites("interpreter", InterpreterWrites);
+
+    fflush(stdout);
+    abort();
+}
+
+void VerifyBlock(ARM* cpu, JitBlockEntry entry)
+{
+    VerifyCPUState initial, jit, interpreter;
+    SaveCPUState(cpu, initial);
+    u32 stopExecution = cpu->StopExecution;
+
+    bool thumb = initial.CPSR & 0x20;
+    u32 blockAddr = initial.R[15] - (thumb ? 2 : 4);
+
+    JITWrites.clear();
+    VerifyReplayable = true;
+
+    VerifyPhase = verifyPhase_JIT;
+    ARM_Dispatch(cpu, entry);
+    VerifyPhase = verifyPhase_Off;
+
+    if (!VerifyReplayable)
+    {
+        SkippedBlocks[cpu->Num]++;
+        return;
+    }
+
+    SaveCPUState(cpu, jit);
+    // IdleLoop is only set by JIT code
+    u32 jitStopExecution = cpu->StopExecution;
+
+    for (int i = (int)JITWrites.size() - 1; i >= 0; i--)
+        WriteMem(cpu->Num, JITWrites[i].Addr, JITWrites[i].Size, JITWrites[i].OldVal);
+
+    LoadCPUState(cpu, initial);
+    cpu->StopExecution = stopExecution;
+    // the JIT doesn't keep the pipeline and the code timings up to date
+    cpu->JumpTo(blockAddr | (thumb ? 1 : 0));
+    cpu->Cycles = initial.Cycles;
+
+    InterpreterWrites.clear();
+    InterpretedInstrs.clear();
+
+    VerifyPhase = verifyPhase_Interpreter;
+
+    // we don't know how many instructions the JIT ran (it might have left
+    // the block early), so we run until the interpreter arrives at the same place.
+    // Branches back into the block itself can make it pass the final pc early,
+    // so the registers have to match as well
+    bool arrived = false;
+    int maxInstrs = Config::JIT_MaxBlockSize * 2;
+    for (int i = 0; i < maxInstrs; i++)
+    {
+        bool instrThumb = cpu->CPSR & 0x20;
+        u32 instrAddr = cpu->R[15] - (instrThumb ? 2 : 4);
+
+        if (cpu->Num == 0)
+            InterpretInstr<0>(cpu);
+        else
+            InterpretInstr<1>(cpu);
+
+        InterpretedInstrs.push_back({instrAddr, instrThumb ? (cpu->CurInstr & 0xFFFF) : cpu->CurInstr, instrThumb});
+
+        SaveCPUState(cpu, interpreter);
+        if (RegistersMatch(interpreter, jit))
+        {
+            arrived = true;
+            break;
+        }
+    }
+
+    VerifyPhase = verifyPhase_Off;
+
+    if (!arrived || !StatesMatch(interpreter, jit) || !WritesMatch())
+        ReportDivergence(cpu, blockAddr, initial, jit, interpreter);
+
+    if (interpreter.Cycles != jit.Cycles)
+    {
+        CycleMismatches[cpu->Num]++;
+        if (CycleMismatchBlocks.insert(blockAddr | cpu->Num).second)
+        {
+            printf("JIT verification: ARM%d block %08X took %d cycles, the interpreter %d\n",
+                cpu->Num ? 7 : 9, blockAddr, jit.Cycles - initial.Cycles, interpreter.Cycles - initial.Cycles);
+        }
+    }
+
+    cpu->StopExecution = jitStopExecution;
+
+    VerifiedBlocks[cpu->Num]++;
+}
+
+}
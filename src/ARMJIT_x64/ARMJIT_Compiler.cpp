@@ -449,11 +449,22 @@ Compiler::Compiler()
     CodeMemSize -= GetWritableCodePtr() - ResetStart;
     ResetStart = GetWritableCodePtr();
 
-    NearStart = ResetStart;
-    FarStart = ResetStart + 1024*1024*24;
+    // the ARM9 gets three quarters of the space, since it usually runs a lot more code.
+    // Each region is again split 3:1 into near and far code
+    u32 regionSize[2];
+    regionSize[0] = (CodeMemSize / 4) * 3;
+    regionSize[1] = CodeMemSize - regionSize[0];
+
+    u8* regionStart = ResetStart;
+    for (int i = 0; i < 2; i++)
+    {
+        NearStart[i] = regionStart;
+        NearSize[i] = (regionSize[i] / 4) * 3;
+        FarStart[i] = NearStart[i] + NearSize[i];
+        FarSize[i] = regionSize[i] - NearSize[i];
 
-    NearSize = FarStart - ResetStart;
-    FarSize = (ResetStart + CodeMemSize) - FarStart;
+        regionStart += regionSize[i];
+    }
 }
 
 void Compiler::LoadCPSR()
@@ -642,12 +653,34 @@ void Compiler::Reset()
     memset(ResetStart, 0xcc, CodeMemSize);
     SetCodePtr(ResetStart);
 
-    NearCode = NearStart;
-    FarCode = FarStart;
+    for (int i = 0; i < 2; i++)
+    {
+        NearCode[i] = NearStart[i];
+        FarCode[i] = FarStart[i];
+    }
 
     LoadStorePatches.clear();
 }
 
+void Compiler::ResetCPU(u32 num)
+{
+    memset(NearStart[num], 0xcc, NearSize[num]);
+    memset(FarStart[num], 0xcc, FarSize[num]);
+
+    NearCode[num] = NearStart[num];
+    FarCode[num] = FarStart[num];
+    SetCodePtr(NearCode[num]);
+
+    for (auto it = LoadStorePatches.begin(); it != LoadStorePatches.end();)
+    {
+        if ((it->first >= NearStart[num] && it->first < NearStart[num] + NearSize[num])
+            || (it->first >= FarStart[num] && it->first < FarStart[num] + FarSize[num]))
+            it = LoadStorePatches.erase(it);
+        else
+            it++;
+    }
+}
+
 bool Compiler::IsJITFault(u8* addr)
 {
     return (u64)addr >= (u64)ResetStart && (u64)addr < (u64)ResetStart + CodeMemSize;
@@ -670,20 +703,23 @@ void Compiler::Comp_SpecialBranchBehaviour(bool taken)
 
 JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, bool hasMemoryInstr)
 {
-    if (NearSize - (GetCodePtr() - NearStart) < 1024 * 32) // guess...
+    Num = cpu->Num;
+
+    if (NearSize[Num] - (NearCode[Num] - NearStart[Num]) < 1024 * 32) // guess...
     {
         printf("near reset\n");
-        ResetBlockCache();
+        ResetBlockCache(Num);
     }
-    if (FarSize - (FarCode - FarStart) < 1024 * 32) // guess...
+    if (FarSize[Num] - (FarCode[Num] - FarStart[Num]) < 1024 * 32) // guess...
     {
         printf("far reset\n");
-        ResetBlockCache();
+        ResetBlockCache(Num);
     }
 
+    SetCodePtr(NearCode[Num]);
+
     ConstantCycles = 0;
     Thumb = thumb;
-    Num = cpu->Num;
     CodeRegion = instrs[0].Addr >> 24;
     CurCPU = cpu;
     // CPSR might have been modified in a previous block
@@ -805,6 +841,8 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
     ADD(32, MDisp(RCPU, offsetof(ARM, Cycles)), Imm32(ConstantCycles));
     JMP((u8*)ARM_Ret, true);
 
+    NearCode[Num] = GetWritableCodePtr();
+
     /*FILE* codeout = fopen("codeout", "a");
     fprintf(codeout, "beginning block argargarg__ %x!!!", instrs[0].Addr);
     fwrite((u8*)res, GetWritableCodePtr() - (u8*)res, 1, codeout);
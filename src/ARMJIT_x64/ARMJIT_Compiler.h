@@ -43,6 +43,8 @@ struct LoadStorePatch
     void* PatchFunc;
     s16 Offset;
     u16 Size;
+    // instruction address | cpu num
+    u32 Site;
 };
 
 struct Op2
@@ -78,6 +80,7 @@ public:
     Compiler();
 
     void Reset();
+    void ResetCPU(u32 num);
 
     JitBlockEntry CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, bool hasMemoryInstr);
 
@@ -216,27 +219,39 @@ public:
 
     void SwitchToNearCode()
     {
-        FarCode = GetWritableCodePtr();
-        SetCodePtr(NearCode);
+        FarCode[Num] = GetWritableCodePtr();
+        SetCodePtr(NearCode[Num]);
     }
 
     void SwitchToFarCode()
     {
-        NearCode = GetWritableCodePtr();
-        SetCodePtr(FarCode);
+        NearCode[Num] = GetWritableCodePtr();
+        SetCodePtr(FarCode[Num]);
+    }
+
+    u32 GetCodeBufferUsed(u32 num)
+    {
+        return (NearCode[num] - NearStart[num]) + (FarCode[num] - FarStart[num]);
+    }
+
+    u32 GetCodeBufferSize(u32 num)
+    {
+        return NearSize[num] + FarSize[num];
     }
 
     bool IsJITFault(u8* addr);
 
-    u8* RewriteMemAccess(u8* pc);
+    u8* RewriteMemAccess(u8* pc, u32& site);
 
-    u8* FarCode;
-    u8* NearCode;
-    u32 FarSize;
-    u32 NearSize;
+    // each cpu has its own near and far code region,
+    // so that one of them running full doesn't throw away the code of the other
+    u8* FarCode[2];
+    u8* NearCode[2];
+    u32 FarSize[2];
+    u32 NearSize[2];
 
-    u8* NearStart;
-    u8* FarStart;
+    u8* NearStart[2];
+    u8* FarStart[2];
 
     void* PatchedStoreFuncs[2][2][3][16];
     void* PatchedLoadFuncs[2][2][3][2][16];
@@ -33,7 +33,7 @@ int squeezePointer(T* ptr)
     return truncated;
 }
 
-u8* Compiler::RewriteMemAccess(u8* pc)
+u8* Compiler::RewriteMemAccess(u8* pc, u32& site)
 {
     auto it = LoadStorePatches.find(pc);
     if (it != LoadStorePatches.end())
@@ -41,6 +41,8 @@ u8* Compiler::RewriteMemAccess(u8* pc)
         LoadStorePatch patch = it->second;
         LoadStorePatches.erase(it);
 
+        site = patch.Site;
+
         //printf("rewriting memory access %p %d %d\n", (u8*)pc-ResetStart, patch.Offset, patch.Size);
 
         XEmitter emitter(pc + (ptrdiff_t)patch.Offset);
@@ -201,7 +203,12 @@ void Compiler::Comp_MemAccess(int rd, int rn, const Op2& op2, int size, int flag
         ? ARMJIT_Memory::ClassifyAddress9(CurInstr.DataRegion)
         : ARMJIT_Memory::ClassifyAddress7(CurInstr.DataRegion);
 
-    if (Config::JIT_FastMemory && ((!Thumb && CurInstr.Cond() != 0xE) || ARMJIT_Memory::IsFastmemCompatible(expectedTarget)))
+    int siteMode = GetFastmemSiteMode(Num, CurInstr.Addr);
+    if (siteMode == fastmemSite_Checked && !ARMJIT_Memory::IsFastmemCompatible(expectedTarget))
+        siteMode = fastmemSite_Slow;
+
+    if (Config::JIT_FastMemory && siteMode != fastmemSite_Slow
+        && ((!Thumb && CurInstr.Cond() != 0xE) || ARMJIT_Memory::IsFastmemCompatible(expectedTarget)))
     {
         if (rdMapped.IsImm())
         {
@@ -209,8 +216,18 @@ void Compiler::Comp_MemAccess(int rd, int rn, const Op2& op2, int size, int flag
             rdMapped = R(RSCRATCH4);
         }
 
+        FixupBranch otherRegion;
+        if (siteMode == fastmemSite_Checked)
+        {
+            MOV(32, R(RSCRATCH), R(RSCRATCH3));
+            SHR(32, R(RSCRATCH), Imm8(24));
+            CMP(32, R(RSCRATCH), Imm32(CurInstr.DataRegion >> 24));
+            otherRegion = J_CC(CC_NE, true);
+        }
+
         u8* memopStart = GetWritableCodePtr();
         LoadStorePatch patch;
+        patch.Site = CurInstr.Addr | Num;
 
         assert(rdMapped.GetSimpleReg() >= 0 && rdMapped.GetSimpleReg() < 16);
         patch.PatchFunc = flags & memop_Store
@@ -263,6 +280,17 @@ void Compiler::Comp_MemAccess(int rd, int rn, const Op2& op2, int size, int flag
         assert(patch.Size >= 5);
 
         LoadStorePatches[memopLoadStoreLocation] = patch;
+
+        if (siteMode == fastmemSite_Checked)
+        {
+            // the slow path is exactly what the access would be patched to
+            SwitchToFarCode();
+            SetJumpTarget(otherRegion);
+            CALL(patch.PatchFunc);
+            FixupBranch ret = J(true);
+            SwitchToNearCode();
+            SetJumpTarget(ret);
+        }
     }
     else
     {
@@ -432,7 +460,8 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
         Comp_AddCycles_CD();
 
     bool compileFastPath = Config::JIT_FastMemory
-        && !usermode && (CurInstr.Cond() < 0xE || ARMJIT_Memory::IsFastmemCompatible(expectedTarget));
+        && !usermode && (CurInstr.Cond() < 0xE || ARMJIT_Memory::IsFastmemCompatible(expectedTarget))
+        && GetFastmemSiteMode(Num, CurInstr.Addr) == fastmemSite_Fast;
 
     // we need to make sure that the stack stays aligned to 16 bytes
 #ifdef _WIN32
@@ -496,6 +525,7 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
 
         LoadStorePatch patch;
         patch.Size = GetWritableCodePtr() - fastPathStart;
+        patch.Site = CurInstr.Addr | Num;
         SwitchToFarCode();
         patch.PatchFunc = GetWritableCodePtr();
 
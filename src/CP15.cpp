@@ -860,6 +860,10 @@ void ARMv5::DataWrite8(u32 addr, u8 val)
 {
     DataRegion = addr;
 
+#ifdef JIT_VERIFY_ENABLED
+    ARMJIT::VerifyLogWrite(0, addr, 8, val);
+#endif
+
     if (addr < ITCMSize)
     {
         DataCycles = 1;
@@ -886,6 +890,10 @@ void ARMv5::DataWrite16(u32 addr, u16 val)
 
     addr &= ~1;
 
+#ifdef JIT_VERIFY_ENABLED
+    ARMJIT::VerifyLogWrite(0, addr, 16, val);
+#endif
+
     if (addr < ITCMSize)
     {
         DataCycles = 1;
@@ -912,6 +920,10 @@ void ARMv5::DataWrite32(u32 addr, u32 val)
 
     addr &= ~3;
 
+#ifdef JIT_VERIFY_ENABLED
+    ARMJIT::VerifyLogWrite(0, addr, 32, val);
+#endif
+
     if (addr < ITCMSize)
     {
         DataCycles = 1;
@@ -936,6 +948,10 @@ void ARMv5::DataWrite32S(u32 addr, u32 val)
 {
     addr &= ~3;
 
+#ifdef JIT_VERIFY_ENABLED
+    ARMJIT::VerifyLogWrite(0, addr, 32, val);
+#endif
+
     if (addr < ITCMSize)
     {
         DataCycles += 1;
@@ -17,6 +17,7 @@
 */
 
 #include <stdio.h>
+#include <algorithm>
 #include "NDS.h"
 #include "DSi.h"
 #include "DMA.h"
@@ -256,7 +257,33 @@ void DMA::Run9()
             }*/
         }
 
-        while (IterCount > 0 && !Stall)
+        if (IsGXFIFODMA && SrcAddrInc == 1)
+        {
+            // display list transfer: feed the GXFIFO straight from main RAM
+            // as many words as fit in the time slice and before the next main RAM mirror
+            u64 unittime = (u64)unitcycles << NDS::ARM9ClockShift;
+
+            while (IterCount > 0 && !Stall && (CurSrcAddr >> 24) == 0x02 && NDS::ARM9Timestamp < NDS::ARM9Target)
+            {
+                u32 offset = CurSrcAddr & NDS::MainRAMMask;
+                u32 num = std::min(IterCount, (NDS::MainRAMMask + 1 - offset) >> 2);
+                num = std::min<u64>(num, (NDS::ARM9Target - NDS::ARM9Timestamp + unittime - 1) / unittime);
+                if (num == 0) break;
+
+                // DSi region lock hack, needs the regular read path
+                if (ConsoleType == 1 && CurSrcAddr <= 0x02FE71B0 && (CurSrcAddr + (num<<2)) > 0x02FE71B0)
+                    break;
+
+                num = GPU3D::WriteToGXFIFO((u32*)&NDS::MainRAM[offset], num);
+
+                NDS::ARM9Timestamp += num * unittime;
+                CurSrcAddr += num<<2;
+                IterCount -= num;
+                RemCount -= num;
+            }
+        }
+
+        while (IterCount > 0 && !Stall && NDS::ARM9Timestamp < NDS::ARM9Target)
         {
             NDS::ARM9Timestamp += (unitcycles << NDS::ARM9ClockShift);
 
@@ -269,8 +296,6 @@ void DMA::Run9()
             CurDstAddr += DstAddrInc<<2;
             IterCount--;
             RemCount--;
-
-            if (NDS::ARM9Timestamp >= NDS::ARM9Target) break;
         }
     }
 
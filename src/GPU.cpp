@@ -23,6 +23,12 @@
 
 #include "GPU2D_Soft.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 namespace GPU
 {
 
@@ -85,7 +91,8 @@ int Renderer = 0;
 GPU2D::Unit GPU2D_A(0);
 GPU2D::Unit GPU2D_B(1);
 
-std::unique_ptr<GPU2D::Renderer2D> GPU2D_Renderer = {};
+std::unique_ptr<GPU2D::Renderer2D> GPU2D_Renderer[2] = {};
+bool ScanlinesQueued = false;
 
 /*
     VRAM invalidation tracking
@@ -122,6 +129,8 @@ VRAMTrackingSet<512*1024, 128*1024> VRAMDirty_Texture;
 VRAMTrackingSet<128*1024, 16*1024> VRAMDirty_TexPal;
 
 NonStupidBitField<128*1024/VRAMDirtyGranularity> VRAMDirty[9];
+u32 VRAMGeneration;
+u32 OAMGeneration[2];
 
 u8 VRAMFlat_ABG[512*1024];
 u8 VRAMFlat_BBG[128*1024];
@@ -145,7 +154,8 @@ std::unique_ptr<GLCompositor> CurGLCompositor = {};
 
 bool Init()
 {
-    GPU2D_Renderer = std::make_unique<GPU2D::SoftRenderer>();
+    GPU2D_Renderer[0] = std::make_unique<GPU2D::SoftRenderer>();
+    GPU2D_Renderer[1] = std::make_unique<GPU2D::SoftRenderer>();
     if (!GPU3D::Init()) return false;
 
     FrontBuffer = 0;
@@ -158,7 +168,8 @@ bool Init()
 
 void DeInit()
 {
-    GPU2D_Renderer.reset();
+    GPU2D_Renderer[0].reset();
+    GPU2D_Renderer[1].reset();
     GPU3D::DeInit();
 
     if (Framebuffer[0][0]) delete[] Framebuffer[0][0];
@@ -169,6 +180,8 @@ void DeInit()
 
 void ResetVRAMCache()
 {
+    VRAMGeneration++;
+
     for (int i = 0; i < 9; i++)
         VRAMDirty[i] = NonStupidBitField<128*1024/VRAMDirtyGranularity>();
 
@@ -197,6 +210,8 @@ void ResetVRAMCache()
 
 void Reset()
 {
+    SyncScanlines();
+
     VCount = 0;
     NextVCount = -1;
     TotalScanlines = 0;
@@ -208,6 +223,8 @@ void Reset()
 
     memset(Palette, 0, 2*1024);
     memset(OAM, 0, 2*1024);
+    OAMGeneration[0]++;
+    OAMGeneration[1]++;
 
     memset(VRAM_A, 0, 128*1024);
     memset(VRAM_B, 0, 128*1024);
@@ -267,7 +284,8 @@ void Reset()
     GPU3D::Reset();
 
     int backbuf = FrontBuffer ? 0 : 1;
-    GPU2D_Renderer->SetFramebuffer(Framebuffer[backbuf][1], Framebuffer[backbuf][0]);
+    GPU2D_Renderer[0]->SetFramebuffer(Framebuffer[backbuf][1], Framebuffer[backbuf][0]);
+    GPU2D_Renderer[1]->SetFramebuffer(Framebuffer[backbuf][1], Framebuffer[backbuf][0]);
 
     ResetRenderer();
 
@@ -279,6 +297,8 @@ void Reset()
 
 void Stop()
 {
+    SyncScanlines();
+
     int fbsize;
     if (GPU3D::CurrentRenderer->Accelerated)
         fbsize = (256*3 + 1) * 192;
@@ -300,6 +320,8 @@ void Stop()
 
 void DoSavestate(Savestate* file)
 {
+    SyncScanlines();
+
     file->Section("GPUG");
 
     file->Var16(&VCount);
@@ -313,6 +335,8 @@ void DoSavestate(Savestate* file)
 
     file->VarArray(Palette, 2*1024);
     file->VarArray(OAM, 2*1024);
+    OAMGeneration[0]++;
+    OAMGeneration[1]++;
 
     file->VarArray(VRAM_A, 128*1024);
     file->VarArray(VRAM_B, 128*1024);
@@ -366,14 +390,19 @@ void DoSavestate(Savestate* file)
 
 void AssignFramebuffers()
 {
+    SyncScanlines();
+
     int backbuf = FrontBuffer ? 0 : 1;
-    if (NDS::PowerControl9 & (1<<15))
+    for (int i = 0; i < 2; i++)
     {
-        GPU2D_Renderer->SetFramebuffer(Framebuffer[backbuf][0], Framebuffer[backbuf][1]);
-    }
-    else
-    {
-        GPU2D_Renderer->SetFramebuffer(Framebuffer[backbuf][1], Framebuffer[backbuf][0]);
+        if (NDS::PowerControl9 & (1<<15))
+        {
+            GPU2D_Renderer[i]->SetFramebuffer(Framebuffer[backbuf][0], Framebuffer[backbuf][1]);
+        }
+        else
+        {
+            GPU2D_Renderer[i]->SetFramebuffer(Framebuffer[backbuf][1], Framebuffer[backbuf][0]);
+        }
     }
 }
 
@@ -439,6 +468,8 @@ void ResetRenderer()
 
 void SetRenderSettings(int renderer, RenderSettings& settings)
 {
+    SyncScanlines();
+
     if (renderer != Renderer)
     {
         DeInitRenderer();
@@ -468,6 +499,9 @@ void SetRenderSettings(int renderer, RenderSettings& settings)
 
     AssignFramebuffers();
 
+    GPU2D_Renderer[0]->SetRenderSettings(settings);
+    GPU2D_Renderer[1]->SetRenderSettings(settings);
+
     if (Renderer == 0)
     {
         GPU3D::CurrentRenderer->SetRenderSettings(settings);
@@ -529,6 +563,9 @@ u8* GetUniqueBankPtr(u32 mask, u32 offset)
 
 void MapVRAM_AB(u32 bank, u8 cnt)
 {
+    SyncScanlines();
+    VRAMGeneration++;
+
     u8 oldcnt = VRAMCNT[bank];
     VRAMCNT[bank] = cnt;
 
@@ -587,6 +624,9 @@ void MapVRAM_AB(u32 bank, u8 cnt)
 
 void MapVRAM_CD(u32 bank, u8 cnt)
 {
+    SyncScanlines();
+    VRAMGeneration++;
+
     u8 oldcnt = VRAMCNT[bank];
     VRAMCNT[bank] = cnt;
 
@@ -671,6 +711,9 @@ void MapVRAM_CD(u32 bank, u8 cnt)
 
 void MapVRAM_E(u32 bank, u8 cnt)
 {
+    SyncScanlines();
+    VRAMGeneration++;
+
     u8 oldcnt = VRAMCNT[bank];
     VRAMCNT[bank] = cnt;
 
@@ -733,6 +776,9 @@ void MapVRAM_E(u32 bank, u8 cnt)
 
 void MapVRAM_FG(u32 bank, u8 cnt)
 {
+    SyncScanlines();
+    VRAMGeneration++;
+
     u8 oldcnt = VRAMCNT[bank];
     VRAMCNT[bank] = cnt;
 
@@ -831,6 +877,9 @@ void MapVRAM_FG(u32 bank, u8 cnt)
 
 void MapVRAM_H(u32 bank, u8 cnt)
 {
+    SyncScanlines();
+    VRAMGeneration++;
+
     u8 oldcnt = VRAMCNT[bank];
     VRAMCNT[bank] = cnt;
 
@@ -891,6 +940,9 @@ void MapVRAM_H(u32 bank, u8 cnt)
 
 void MapVRAM_I(u32 bank, u8 cnt)
 {
+    SyncScanlines();
+    VRAMGeneration++;
+
     u8 oldcnt = VRAMCNT[bank];
     VRAMCNT[bank] = cnt;
 
@@ -970,6 +1022,8 @@ void SetPowerCnt(u32 val)
 
     if (!(val & (1<<0))) printf("!!! CLEARING POWCNT BIT0. DANGER\n");
 
+    SyncScanlines();
+
     GPU2D_A.SetEnabled(val & (1<<1));
     GPU2D_B.SetEnabled(val & (1<<9));
     GPU3D::SetEnabled(val & (1<<3), val & (1<<2));
@@ -1023,27 +1077,28 @@ void StartHBlank(u32 line)
         // note: this should start 48 cycles after the scanline start
         if (line < 192)
         {
-            GPU2D_Renderer->DrawScanline(line, &GPU2D_A);
-            GPU2D_Renderer->DrawScanline(line, &GPU2D_B);
+            GPU2D_Renderer[0]->DrawScanline(line, &GPU2D_A);
+            GPU2D_Renderer[1]->DrawScanline(line, &GPU2D_B);
         }
 
         // sprites are pre-rendered one scanline in advance
         if (line < 191)
         {
-            GPU2D_Renderer->DrawSprites(line+1, &GPU2D_A);
-            GPU2D_Renderer->DrawSprites(line+1, &GPU2D_B);
+            GPU2D_Renderer[0]->DrawSprites(line+1, &GPU2D_A);
+            GPU2D_Renderer[1]->DrawSprites(line+1, &GPU2D_B);
         }
 
         NDS::CheckDMAs(0, 0x02);
     }
     else if (VCount == 215)
     {
+        SyncScanlines();
         GPU3D::VCount215();
     }
     else if (VCount == 262)
     {
-        GPU2D_Renderer->DrawSprites(0, &GPU2D_A);
-        GPU2D_Renderer->DrawSprites(0, &GPU2D_B);
+        GPU2D_Renderer[0]->DrawSprites(0, &GPU2D_A);
+        GPU2D_Renderer[1]->DrawSprites(0, &GPU2D_B);
     }
 
     if (DispStat[0] & (1<<4)) NDS::SetIRQ(0, NDS::IRQ_HBlank);
@@ -1107,7 +1162,7 @@ void StartScanline(u32 line)
     {
         if (line == 0)
         {
-            GPU2D_Renderer->VBlankEnd(&GPU2D_A, &GPU2D_B);
+            GPU2D_Renderer[0]->VBlankEnd(&GPU2D_A, &GPU2D_B);
             GPU2D_A.VBlankEnd();
             GPU2D_B.VBlankEnd();
         }
@@ -1127,6 +1182,9 @@ void StartScanline(u32 line)
     {
         if (VCount == 192)
         {
+            // the frame has to be fully drawn before it's handed over
+            SyncScanlines();
+
             // in reality rendering already finishes at line 144
             // and games might already start to modify texture memory.
             // That doesn't matter for us because we cache the entire
@@ -1254,124 +1312,118 @@ template NonStupidBitField<128*1024/VRAMDirtyGranularity> VRAMTrackingSet<128*10
 template NonStupidBitField<256*1024/VRAMDirtyGranularity> VRAMTrackingSet<256*1024, 16*1024>::DeriveState(u32*);
 template NonStupidBitField<512*1024/VRAMDirtyGranularity> VRAMTrackingSet<512*1024, 16*1024>::DeriveState(u32*);
 
+// copies a range within one mapping unit to the flat copy
+// when several banks are mapped there, they're combined the same way reads do
+inline void CopyVRAMRange(u8* flat, u32 mapping, u32 offset, u32 len)
+{
+    u8* banks[9];
+    u32 numbanks = 0;
+    while (mapping)
+    {
+        u32 num = __builtin_ctz(mapping);
+        mapping &= mapping - 1;
+        banks[numbanks++] = &VRAM[num][offset & VRAMMask[num]];
+    }
+
+    u8* dst = flat + offset;
+    if (numbanks == 0)
+    {
+        memset(dst, 0, len);
+        return;
+    }
+
+    memcpy(dst, banks[0], len);
+    for (u32 j = 1; j < numbanks; j++)
+    {
+        u8* src = banks[j];
+#if defined(__SSE2__)
+        for (u32 i = 0; i < len; i += 16)
+        {
+            __m128i val = _mm_or_si128(_mm_loadu_si128((__m128i*)&dst[i]), _mm_loadu_si128((__m128i*)&src[i]));
+            _mm_storeu_si128((__m128i*)&dst[i], val);
+        }
+#elif defined(__aarch64__)
+        for (u32 i = 0; i < len; i += 16)
+            vst1q_u8(&dst[i], vorrq_u8(vld1q_u8(&dst[i]), vld1q_u8(&src[i])));
+#else
+        for (u32 i = 0; i < len; i += 8)
+            *(u64*)&dst[i] |= *(u64*)&src[i];
+#endif
+    }
+}
+
 template <u32 MappingGranularity, u32 Size>
-inline bool CopyLinearVRAM(u8* flat, u32* mappings, NonStupidBitField<Size>& dirty, u64 (*slowAccess)(u32 addr))
+inline bool CopyLinearVRAM(u8* flat, u32* mappings, NonStupidBitField<Size>& dirty)
 {
     const u32 VRAMBitsPerMapping = MappingGranularity / VRAMDirtyGranularity;
 
     bool change = false;
 
-    typename NonStupidBitField<Size>::Iterator it = dirty.Begin();
-    while (it != dirty.End())
+    for (auto it = dirty.RunsBegin(); it != dirty.RunsEnd(); it++)
     {
-        u32 offset = *it * VRAMDirtyGranularity;
-        u8* dst = flat + offset;
-        u8* fastAccess = GetUniqueBankPtr(mappings[*it / VRAMBitsPerMapping], offset);
-        if (fastAccess)
-        {
-            memcpy(dst, fastAccess, VRAMDirtyGranularity);
-        }
-        else
+        u32 start = (*it).Start;
+        u32 end = start + (*it).Length;
+
+        // split the run where the mapping units, and thus possibly the banks, change
+        while (start < end)
         {
-            for (u32 i = 0; i < VRAMDirtyGranularity; i += 8)
-                *(u64*)&dst[i] = slowAccess(offset + i);
+            u32 unitend = std::min(end, (start / VRAMBitsPerMapping + 1) * VRAMBitsPerMapping);
+
+            CopyVRAMRange(flat, mappings[start / VRAMBitsPerMapping],
+                          start * VRAMDirtyGranularity, (unitend - start) * VRAMDirtyGranularity);
+
+            start = unitend;
         }
+
         change = true;
-        it++;
     }
+
     return change;
 }
 
 bool MakeVRAMFlat_TextureCoherent(NonStupidBitField<512*1024/VRAMDirtyGranularity>& dirty)
 {
-    return CopyLinearVRAM<128*1024>(VRAMFlat_Texture, VRAMMap_Texture, dirty, ReadVRAM_Texture<u64>);
+    return CopyLinearVRAM<128*1024>(VRAMFlat_Texture, VRAMMap_Texture, dirty);
 }
 bool MakeVRAMFlat_TexPalCoherent(NonStupidBitField<128*1024/VRAMDirtyGranularity>& dirty)
 {
-    return CopyLinearVRAM<16*1024>(VRAMFlat_TexPal, VRAMMap_TexPal, dirty, ReadVRAM_TexPal<u64>);
+    return CopyLinearVRAM<16*1024>(VRAMFlat_TexPal, VRAMMap_TexPal, dirty);
 }
 
 bool MakeVRAMFlat_ABGCoherent(NonStupidBitField<512*1024/VRAMDirtyGranularity>& dirty)
 {
-    return CopyLinearVRAM<16*1024>(VRAMFlat_ABG, VRAMMap_ABG, dirty, ReadVRAM_ABG<u64>);
+    return CopyLinearVRAM<16*1024>(VRAMFlat_ABG, VRAMMap_ABG, dirty);
 }
 bool MakeVRAMFlat_BBGCoherent(NonStupidBitField<128*1024/VRAMDirtyGranularity>& dirty)
 {
-    return CopyLinearVRAM<16*1024>(VRAMFlat_BBG, VRAMMap_BBG, dirty, ReadVRAM_BBG<u64>);
+    return CopyLinearVRAM<16*1024>(VRAMFlat_BBG, VRAMMap_BBG, dirty);
 }
 
 bool MakeVRAMFlat_AOBJCoherent(NonStupidBitField<256*1024/VRAMDirtyGranularity>& dirty)
 {
-    return CopyLinearVRAM<16*1024>(VRAMFlat_AOBJ, VRAMMap_AOBJ, dirty, ReadVRAM_AOBJ<u64>);
+    return CopyLinearVRAM<16*1024>(VRAMFlat_AOBJ, VRAMMap_AOBJ, dirty);
 }
 bool MakeVRAMFlat_BOBJCoherent(NonStupidBitField<128*1024/VRAMDirtyGranularity>& dirty)
 {
-    return CopyLinearVRAM<16*1024>(VRAMFlat_BOBJ, VRAMMap_BOBJ, dirty, ReadVRAM_BOBJ<u64>);
-}
-
-template<typename T>
-T ReadVRAM_ABGExtPal(u32 addr)
-{
-    u32 mask = VRAMMap_ABGExtPal[(addr >> 13) & 0x3];
-
-    T ret = 0;
-    if (mask & (1<<4)) ret |= *(T*)&VRAM_E[addr & 0x7FFF];
-    if (mask & (1<<5)) ret |= *(T*)&VRAM_F[addr & 0x3FFF];
-    if (mask & (1<<6)) ret |= *(T*)&VRAM_G[addr & 0x3FFF];
-
-    return ret;
-}
-
-template<typename T>
-T ReadVRAM_BBGExtPal(u32 addr)
-{
-    u32 mask = VRAMMap_BBGExtPal[(addr >> 13) & 0x3];
-
-    T ret = 0;
-    if (mask & (1<<7)) ret |= *(T*)&VRAM_H[addr & 0x7FFF];
-
-    return ret;
-}
-
-template<typename T>
-T ReadVRAM_AOBJExtPal(u32 addr)
-{
-    u32 mask = VRAMMap_AOBJExtPal;
-
-    T ret = 0;
-    if (mask & (1<<4)) ret |= *(T*)&VRAM_F[addr & 0x1FFF];
-    if (mask & (1<<5)) ret |= *(T*)&VRAM_G[addr & 0x1FFF];
-
-    return ret;
-}
-
-template<typename T>
-T ReadVRAM_BOBJExtPal(u32 addr)
-{
-    u32 mask = VRAMMap_BOBJExtPal;
-
-    T ret = 0;
-    if (mask & (1<<8)) ret |= *(T*)&VRAM_I[addr & 0x1FFF];
-
-    return ret;
+    return CopyLinearVRAM<16*1024>(VRAMFlat_BOBJ, VRAMMap_BOBJ, dirty);
 }
 
 bool MakeVRAMFlat_ABGExtPalCoherent(NonStupidBitField<32*1024/VRAMDirtyGranularity>& dirty)
 {
-    return CopyLinearVRAM<8*1024>(VRAMFlat_ABGExtPal, VRAMMap_ABGExtPal, dirty, ReadVRAM_ABGExtPal<u64>);
+    return CopyLinearVRAM<8*1024>(VRAMFlat_ABGExtPal, VRAMMap_ABGExtPal, dirty);
 }
 bool MakeVRAMFlat_BBGExtPalCoherent(NonStupidBitField<32*1024/VRAMDirtyGranularity>& dirty)
 {
-    return CopyLinearVRAM<8*1024>(VRAMFlat_BBGExtPal, VRAMMap_BBGExtPal, dirty, ReadVRAM_BBGExtPal<u64>);
+    return CopyLinearVRAM<8*1024>(VRAMFlat_BBGExtPal, VRAMMap_BBGExtPal, dirty);
 }
 
 bool MakeVRAMFlat_AOBJExtPalCoherent(NonStupidBitField<8*1024/VRAMDirtyGranularity>& dirty)
 {
-    return CopyLinearVRAM<8*1024>(VRAMFlat_AOBJExtPal, &VRAMMap_AOBJExtPal, dirty, ReadVRAM_AOBJExtPal<u64>);
+    return CopyLinearVRAM<8*1024>(VRAMFlat_AOBJExtPal, &VRAMMap_AOBJExtPal, dirty);
 }
 bool MakeVRAMFlat_BOBJExtPalCoherent(NonStupidBitField<8*1024/VRAMDirtyGranularity>& dirty)
 {
-    return CopyLinearVRAM<8*1024>(VRAMFlat_BOBJExtPal, &VRAMMap_BOBJExtPal, dirty, ReadVRAM_BOBJExtPal<u64>);
+    return CopyLinearVRAM<8*1024>(VRAMFlat_BOBJExtPal, &VRAMMap_BOBJExtPal, dirty);
 }
 
 }
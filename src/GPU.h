@@ -78,12 +78,37 @@ extern u32* Framebuffer[2][2];
 extern GPU2D::Unit GPU2D_A;
 extern GPU2D::Unit GPU2D_B;
 
+// one renderer per engine, so that they can draw in parallel
+extern std::unique_ptr<GPU2D::Renderer2D> GPU2D_Renderer[2];
+
 extern int Renderer;
 
+// set when the 2D renderers have scanlines queued up on their threads
+extern bool ScanlinesQueued;
+
+// anything the queued scanlines read from (VRAM, palette, OAM, 2D registers...)
+// needs to go through this before being modified
+inline void SyncScanlines()
+{
+    if (ScanlinesQueued)
+    {
+        GPU2D_Renderer[0]->Sync();
+        GPU2D_Renderer[1]->Sync();
+        ScanlinesQueued = false;
+    }
+}
+
 const u32 VRAMDirtyGranularity = 512;
 
 extern NonStupidBitField<128*1024/VRAMDirtyGranularity> VRAMDirty[9];
 
+// bumped whenever VRAM visible to the 2D engines is written to or remapped
+// so the renderers can tell when their flat copies are still up to date
+extern u32 VRAMGeneration;
+
+// same for each engine's OAM, lets the renderers know when to redo their sprite lists
+extern u32 OAMGeneration[2];
+
 template <u32 Size, u32 MappingGranularity>
 struct VRAMTrackingSet
 {
@@ -255,6 +280,8 @@ T ReadVRAM_LCDC(u32 addr)
 template<typename T>
 void WriteVRAM_LCDC(u32 addr, T val)
 {
+    SyncScanlines();
+
     int bank;
 
     switch (addr & 0xFF8FC000)
@@ -343,6 +370,9 @@ T ReadVRAM_ABG(u32 addr)
 template<typename T>
 void WriteVRAM_ABG(u32 addr, T val)
 {
+    SyncScanlines();
+    VRAMGeneration++;
+
     u32 mask = VRAMMap_ABG[(addr >> 14) & 0x1F];
 
     if (mask & (1<<0))
@@ -404,6 +434,9 @@ T ReadVRAM_AOBJ(u32 addr)
 template<typename T>
 void WriteVRAM_AOBJ(u32 addr, T val)
 {
+    SyncScanlines();
+    VRAMGeneration++;
+
     u32 mask = VRAMMap_AOBJ[(addr >> 14) & 0xF];
 
     if (mask & (1<<0))
@@ -453,6 +486,9 @@ T ReadVRAM_BBG(u32 addr)
 template<typename T>
 void WriteVRAM_BBG(u32 addr, T val)
 {
+    SyncScanlines();
+    VRAMGeneration++;
+
     u32 mask = VRAMMap_BBG[(addr >> 14) & 0x7];
 
     if (mask & (1<<2))
@@ -491,6 +527,9 @@ T ReadVRAM_BOBJ(u32 addr)
 template<typename T>
 void WriteVRAM_BOBJ(u32 addr, T val)
 {
+    SyncScanlines();
+    VRAMGeneration++;
+
     u32 mask = VRAMMap_BOBJ[(addr >> 14) & 0x7];
 
     if (mask & (1<<3))
@@ -582,6 +621,8 @@ T ReadPalette(u32 addr)
 template<typename T>
 void WritePalette(u32 addr, T val)
 {
+    SyncScanlines();
+
     addr &= 0x7FF;
 
     *(T*)&Palette[addr] = val;
@@ -597,10 +638,13 @@ T ReadOAM(u32 addr)
 template<typename T>
 void WriteOAM(u32 addr, T val)
 {
+    SyncScanlines();
+
     addr &= 0x7FF;
 
     *(T*)&OAM[addr] = val;
     OAMDirty |= 1 << (addr / 1024);
+    OAMGeneration[addr / 1024]++;
 }
 
 void SetPowerCnt(u32 val);
@@ -99,6 +99,7 @@ void Unit::Reset()
     memset(BGYRef, 0, 2*4);
     memset(BGXRefInternal, 0, 2*4);
     memset(BGYRefInternal, 0, 2*4);
+    BGRefReload = 0;
     memset(BGRotA, 0, 2*2);
     memset(BGRotB, 0, 2*2);
     memset(BGRotC, 0, 2*2);
@@ -142,6 +143,11 @@ void Unit::DoSavestate(Savestate* file)
 {
     file->Section((char*)(Num ? "GP2B" : "GP2A"));
 
+    // reference points written since the last scanline would be reloaded
+    // before the next one is drawn, doing it now keeps them out of the savestate
+    ReloadBGRefs(BGRefReload, BGXRef, BGYRef);
+    BGRefReload = 0;
+
     file->Var32(&DispCnt);
     file->VarArray(BGCnt, 4*2);
     file->VarArray(BGXPos, 4*2);
@@ -265,6 +271,9 @@ u32 Unit::Read32(u32 addr)
 
 void Unit::Write8(u32 addr, u8 val)
 {
+    if (!IsLineRegister(addr))
+        GPU::SyncScanlines();
+
     switch (addr & 0x00000FFF)
     {
     case 0x000:
@@ -369,6 +378,9 @@ void Unit::Write8(u32 addr, u8 val)
 
 void Unit::Write16(u32 addr, u16 val)
 {
+    if (!IsLineRegister(addr))
+        GPU::SyncScanlines();
+
     switch (addr & 0x00000FFF)
     {
     case 0x000:
@@ -420,21 +432,21 @@ void Unit::Write16(u32 addr, u16 val)
     case 0x026: BGRotD[0] = val; return;
     case 0x028:
         BGXRef[0] = (BGXRef[0] & 0xFFFF0000) | val;
-        if (GPU::VCount < 192) BGXRefInternal[0] = BGXRef[0];
+        if (GPU::VCount < 192) BGRefReload |= (1<<0);
         return;
     case 0x02A:
         if (val & 0x0800) val |= 0xF000;
         BGXRef[0] = (BGXRef[0] & 0xFFFF) | (val << 16);
-        if (GPU::VCount < 192) BGXRefInternal[0] = BGXRef[0];
+        if (GPU::VCount < 192) BGRefReload |= (1<<0);
         return;
     case 0x02C:
         BGYRef[0] = (BGYRef[0] & 0xFFFF0000) | val;
-        if (GPU::VCount < 192) BGYRefInternal[0] = BGYRef[0];
+        if (GPU::VCount < 192) BGRefReload |= (1<<1);
         return;
     case 0x02E:
         if (val & 0x0800) val |= 0xF000;
         BGYRef[0] = (BGYRef[0] & 0xFFFF) | (val << 16);
-        if (GPU::VCount < 192) BGYRefInternal[0] = BGYRef[0];
+        if (GPU::VCount < 192) BGRefReload |= (1<<1);
         return;
 
     case 0x030: BGRotA[1] = val; return;
@@ -443,21 +455,21 @@ void Unit::Write16(u32 addr, u16 val)
     case 0x036: BGRotD[1] = val; return;
     case 0x038:
         BGXRef[1] = (BGXRef[1] & 0xFFFF0000) | val;
-        if (GPU::VCount < 192) BGXRefInternal[1] = BGXRef[1];
+        if (GPU::VCount < 192) BGRefReload |= (1<<2);
         return;
     case 0x03A:
         if (val & 0x0800) val |= 0xF000;
         BGXRef[1] = (BGXRef[1] & 0xFFFF) | (val << 16);
-        if (GPU::VCount < 192) BGXRefInternal[1] = BGXRef[1];
+        if (GPU::VCount < 192) BGRefReload |= (1<<2);
         return;
     case 0x03C:
         BGYRef[1] = (BGYRef[1] & 0xFFFF0000) | val;
-        if (GPU::VCount < 192) BGYRefInternal[1] = BGYRef[1];
+        if (GPU::VCount < 192) BGRefReload |= (1<<3);
         return;
     case 0x03E:
         if (val & 0x0800) val |= 0xF000;
         BGYRef[1] = (BGYRef[1] & 0xFFFF) | (val << 16);
-        if (GPU::VCount < 192) BGYRefInternal[1] = BGYRef[1];
+        if (GPU::VCount < 192) BGRefReload |= (1<<3);
         return;
 
     case 0x040:
@@ -513,6 +525,9 @@ void Unit::Write16(u32 addr, u16 val)
 
 void Unit::Write32(u32 addr, u32 val)
 {
+    if (!IsLineRegister(addr))
+        GPU::SyncScanlines();
+
     switch (addr & 0x00000FFF)
     {
     case 0x000:
@@ -541,23 +556,23 @@ void Unit::Write32(u32 addr, u32 val)
     case 0x028:
         if (val & 0x08000000) val |= 0xF0000000;
         BGXRef[0] = val;
-        if (GPU::VCount < 192) BGXRefInternal[0] = BGXRef[0];
+        if (GPU::VCount < 192) BGRefReload |= (1<<0);
         return;
     case 0x02C:
         if (val & 0x08000000) val |= 0xF0000000;
         BGYRef[0] = val;
-        if (GPU::VCount < 192) BGYRefInternal[0] = BGYRef[0];
+        if (GPU::VCount < 192) BGRefReload |= (1<<1);
         return;
 
     case 0x038:
         if (val & 0x08000000) val |= 0xF0000000;
         BGXRef[1] = val;
-        if (GPU::VCount < 192) BGXRefInternal[1] = BGXRef[1];
+        if (GPU::VCount < 192) BGRefReload |= (1<<2);
         return;
     case 0x03C:
         if (val & 0x08000000) val |= 0xF0000000;
         BGYRef[1] = val;
-        if (GPU::VCount < 192) BGYRefInternal[1] = BGYRef[1];
+        if (GPU::VCount < 192) BGRefReload |= (1<<3);
         return;
     }
 
@@ -565,12 +580,61 @@ void Unit::Write32(u32 addr, u32 val)
     Write16(addr+2, val>>16);
 }
 
-void Unit::UpdateMosaicCounters(u32 line)
+bool Unit::IsLineRegister(u32 addr)
+{
+    addr &= 0xFFF;
+
+    // engine A's BG0 X scroll also scrolls the 3D layer
+    if (addr == 0x010 || addr == 0x011)
+        return Num != 0;
+
+    return (addr >= 0x012 && addr < 0x056) || (addr == 0x06C || addr == 0x06D);
+}
+
+void Unit::GetLineRegisters(LineRegisters& regs)
+{
+    memcpy(regs.BGXPos, BGXPos, 4*2);
+    memcpy(regs.BGYPos, BGYPos, 4*2);
+
+    memcpy(regs.BGXRef, BGXRef, 2*4);
+    memcpy(regs.BGYRef, BGYRef, 2*4);
+    memcpy(regs.BGRotA, BGRotA, 2*2);
+    memcpy(regs.BGRotB, BGRotB, 2*2);
+    memcpy(regs.BGRotC, BGRotC, 2*2);
+    memcpy(regs.BGRotD, BGRotD, 2*2);
+    regs.BGRefReload = BGRefReload;
+    BGRefReload = 0;
+
+    memcpy(regs.Win0Coords, Win0Coords, 4);
+    memcpy(regs.Win1Coords, Win1Coords, 4);
+    memcpy(regs.WinCnt, WinCnt, 4);
+
+    memcpy(regs.BGMosaicSize, BGMosaicSize, 2);
+    memcpy(regs.OBJMosaicSize, OBJMosaicSize, 2);
+
+    regs.BlendCnt = BlendCnt;
+    regs.EVA = EVA;
+    regs.EVB = EVB;
+    regs.EVY = EVY;
+
+    regs.MasterBrightness = MasterBrightness;
+}
+
+void Unit::ReloadBGRefs(u8 mask, s32* xref, s32* yref)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (mask & (1 << (i*2)))     BGXRefInternal[i] = xref[i];
+        if (mask & (1 << (i*2 + 1))) BGYRefInternal[i] = yref[i];
+    }
+}
+
+void Unit::UpdateMosaicCounters(u32 line, LineRegisters& regs)
 {
     // Y mosaic uses incrementing 4-bit counters
     // the transformed Y position is updated every time the counter matches the MOSAIC register
 
-    if (OBJMosaicYCount == OBJMosaicSize[1])
+    if (OBJMosaicYCount == regs.OBJMosaicSize[1])
     {
         OBJMosaicYCount = 0;
         OBJMosaicY = line + 1;
@@ -584,6 +648,8 @@ void Unit::UpdateMosaicCounters(u32 line)
 
 void Unit::VBlank()
 {
+    GPU::SyncScanlines();
+
     if (CaptureLatch)
     {
         CaptureCnt &= ~(1<<31);
@@ -596,7 +662,10 @@ void Unit::VBlank()
 
 void Unit::VBlankEnd()
 {
+    GPU::SyncScanlines();
+
     // TODO: find out the exact time this happens
+    BGRefReload = 0;
     BGXRefInternal[0] = BGXRef[0];
     BGXRefInternal[1] = BGXRef[1];
     BGYRefInternal[0] = BGYRef[0];
@@ -641,16 +710,20 @@ u16* Unit::GetOBJExtPal()
 void Unit::CheckWindows(u32 line)
 {
     line &= 0xFF;
+    if (line == Win0Coords[2] || line == Win0Coords[3] ||
+        line == Win1Coords[2] || line == Win1Coords[3])
+        GPU::SyncScanlines();
+
     if (line == Win0Coords[3])      Win0Active &= ~0x1;
     else if (line == Win0Coords[2]) Win0Active |=  0x1;
     if (line == Win1Coords[3])      Win1Active &= ~0x1;
     else if (line == Win1Coords[2]) Win1Active |=  0x1;
 }
 
-void Unit::CalculateWindowMask(u32 line, u8* windowMask, u8* objWindow)
+void Unit::CalculateWindowMask(u32 line, LineRegisters& regs, u8* windowMask, u8* objWindow)
 {
     for (u32 i = 0; i < 256; i++)
-        windowMask[i] = WinCnt[2]; // window outside
+        windowMask[i] = regs.WinCnt[2]; // window outside
 
     if (DispCnt & (1<<15))
     {
@@ -658,37 +731,37 @@ void Unit::CalculateWindowMask(u32 line, u8* windowMask, u8* objWindow)
         for (int i = 0; i < 256; i++)
         {
             if (objWindow[i])
-                windowMask[i] = WinCnt[3];
+                windowMask[i] = regs.WinCnt[3];
         }
     }
 
     if (DispCnt & (1<<14))
     {
         // window 1
-        u8 x1 = Win1Coords[0];
-        u8 x2 = Win1Coords[1];
+        u8 x1 = regs.Win1Coords[0];
+        u8 x2 = regs.Win1Coords[1];
 
         for (int i = 0; i < 256; i++)
         {
             if (i == x2)      Win1Active &= ~0x2;
             else if (i == x1) Win1Active |=  0x2;
 
-            if (Win1Active == 0x3) windowMask[i] = WinCnt[1];
+            if (Win1Active == 0x3) windowMask[i] = regs.WinCnt[1];
         }
     }
 
     if (DispCnt & (1<<13))
     {
         // window 0
-        u8 x1 = Win0Coords[0];
-        u8 x2 = Win0Coords[1];
+        u8 x1 = regs.Win0Coords[0];
+        u8 x2 = regs.Win0Coords[1];
 
         for (int i = 0; i < 256; i++)
         {
             if (i == x2)      Win0Active &= ~0x2;
             else if (i == x1) Win0Active |=  0x2;
 
-            if (Win0Active == 0x3) windowMask[i] = WinCnt[0];
+            if (Win0Active == 0x3) windowMask[i] = regs.WinCnt[0];
         }
     }
 }
@@ -22,6 +22,11 @@
 #include "types.h"
 #include "Savestate.h"
 
+namespace GPU
+{
+struct RenderSettings;
+}
+
 namespace GPU2D
 {
 
@@ -33,6 +38,37 @@ public:
     Unit(const Unit&) = delete;
     Unit& operator=(const Unit&) = delete;
 
+    // registers games commonly change between scanlines, usually through HBlank DMA.
+    // Scanlines are drawn from a copy of them taken when they're handed to the renderer,
+    // so writing to them doesn't have to wait until a threaded renderer has caught up
+    struct LineRegisters
+    {
+        u16 BGXPos[4];
+        u16 BGYPos[4];
+
+        s32 BGXRef[2];
+        s32 BGYRef[2];
+        s16 BGRotA[2];
+        s16 BGRotB[2];
+        s16 BGRotC[2];
+        s16 BGRotD[2];
+        // reference points written since the last scanline (bit0/1: BG2 X/Y, bit2/3: BG3 X/Y)
+        u8 BGRefReload;
+
+        u8 Win0Coords[4];
+        u8 Win1Coords[4];
+        u8 WinCnt[4];
+
+        u8 BGMosaicSize[2];
+        u8 OBJMosaicSize[2];
+
+        u16 BlendCnt;
+        u8 EVA, EVB;
+        u8 EVY;
+
+        u16 MasterBrightness;
+    };
+
     void Reset();
 
     void DoSavestate(Savestate* file);
@@ -46,6 +82,10 @@ public:
     void Write16(u32 addr, u16 val);
     void Write32(u32 addr, u32 val);
 
+    bool IsLineRegister(u32 addr);
+    void GetLineRegisters(LineRegisters& regs);
+    void ReloadBGRefs(u8 mask, s32* xref, s32* yref);
+
     bool UsesFIFO()
     {
         if (((DispCnt >> 16) & 0x3) == 3)
@@ -69,8 +109,8 @@ public:
     void GetBGVRAM(u8*& data, u32& mask);
     void GetOBJVRAM(u8*& data, u32& mask);
 
-    void UpdateMosaicCounters(u32 line);
-    void CalculateWindowMask(u32 line, u8* windowMask, u8* objWindow);
+    void UpdateMosaicCounters(u32 line, LineRegisters& regs);
+    void CalculateWindowMask(u32 line, LineRegisters& regs, u8* windowMask, u8* objWindow);
 
     u32 Num;
     bool Enabled;
@@ -91,6 +131,7 @@ public:
     s32 BGYRef[2];
     s32 BGXRefInternal[2];
     s32 BGYRefInternal[2];
+    u8 BGRefReload;
     s16 BGRotA[2];
     s16 BGRotB[2];
     s16 BGRotC[2];
@@ -128,6 +169,11 @@ public:
 
     virtual void VBlankEnd(Unit* unitA, Unit* unitB) = 0;
 
+    virtual void SetRenderSettings(GPU::RenderSettings& settings) = 0;
+
+    // waits until all the queued up drawing is done
+    virtual void Sync() = 0;
+
     void SetFramebuffer(u32* unitA, u32* unitB)
     {
         Framebuffer[0] = unitA;
@@ -16,6 +16,7 @@
     with melonDS. If not, see http://www.gnu.org/licenses/.
 */
 
+#include <algorithm>
 #include "GPU2D_Soft.h"
 #include "GPU.h"
 
@@ -34,6 +35,165 @@ SoftRenderer::SoftRenderer()
             MosaicTable[m][x] = offset;
         }
     }
+
+    Sema_DrawStart = Platform::Semaphore_Create();
+    Sema_DrawDone = Platform::Semaphore_Create();
+
+    DrawQueueWritePos = 0;
+    DrawQueueReadPos = 0;
+    NumQueuedCommands = 0;
+
+    Threaded = false;
+    RenderThreadRunning = false;
+
+    BGVRAMGeneration = GPU::VRAMGeneration - 1;
+    OBJVRAMGeneration = GPU::VRAMGeneration - 1;
+
+    // no sprite list yet
+    SpriteListUnit = 2;
+}
+
+SoftRenderer::~SoftRenderer()
+{
+    StopRenderThread();
+
+    Platform::Semaphore_Free(Sema_DrawStart);
+    Platform::Semaphore_Free(Sema_DrawDone);
+}
+
+void SoftRenderer::SetRenderSettings(GPU::RenderSettings& settings)
+{
+    Threaded = settings.Soft_Threaded;
+    SetupRenderThread();
+}
+
+void SoftRenderer::SetupRenderThread()
+{
+    if (Threaded)
+    {
+        if (!RenderThreadRunning.load(std::memory_order_relaxed))
+        {
+            Platform::Semaphore_Reset(Sema_DrawStart);
+            Platform::Semaphore_Reset(Sema_DrawDone);
+
+            DrawQueueWritePos = 0;
+            DrawQueueReadPos = 0;
+            NumQueuedCommands = 0;
+
+            RenderThreadRunning = true;
+            RenderThread = Platform::Thread_Create(std::bind(&SoftRenderer::RenderThreadFunc, this));
+        }
+    }
+    else
+    {
+        StopRenderThread();
+    }
+}
+
+void SoftRenderer::StopRenderThread()
+{
+    if (RenderThreadRunning.load(std::memory_order_relaxed))
+    {
+        Sync();
+
+        RenderThreadRunning = false;
+        Platform::Semaphore_Post(Sema_DrawStart);
+        Platform::Thread_Wait(RenderThread);
+        Platform::Thread_Free(RenderThread);
+    }
+}
+
+void SoftRenderer::RenderThreadFunc()
+{
+    for (;;)
+    {
+        Platform::Semaphore_Wait(Sema_DrawStart);
+        if (!RenderThreadRunning.load(std::memory_order_relaxed))
+            return;
+
+        DrawCommand& cmd = DrawQueue[DrawQueueReadPos];
+        DrawQueueReadPos = (DrawQueueReadPos + 1) & (DrawQueueSize - 1);
+
+        if (cmd.Sprites)
+            DoDrawSprites(cmd.Line, cmd.Target);
+        else
+            DoDrawScanline(cmd.Line, cmd.VCount, cmd.Target, cmd.Regs);
+
+        Platform::Semaphore_Post(Sema_DrawDone);
+    }
+}
+
+void SoftRenderer::QueueCommand(bool sprites, u32 line, Unit* unit)
+{
+    if (NumQueuedCommands == DrawQueueSize)
+        Sync();
+
+    DrawCommand& cmd = DrawQueue[DrawQueueWritePos];
+    cmd.Sprites = sprites;
+    cmd.Line = line;
+    cmd.VCount = GPU::VCount;
+    cmd.Target = unit;
+    if (!sprites)
+        unit->GetLineRegisters(cmd.Regs);
+    DrawQueueWritePos = (DrawQueueWritePos + 1) & (DrawQueueSize - 1);
+
+    NumQueuedCommands++;
+    GPU::ScanlinesQueued = true;
+    Platform::Semaphore_Post(Sema_DrawStart);
+}
+
+void SoftRenderer::Sync()
+{
+    while (NumQueuedCommands > 0)
+    {
+        Platform::Semaphore_Wait(Sema_DrawDone);
+        NumQueuedCommands--;
+    }
+}
+
+template <u32 Size>
+u8* SoftRenderer::DecodeTiles(DecodedTileCache<Size>& cache, u8* vram, u32 vrammask, u32 addr, u32 len)
+{
+    const u32 chunkmask = vrammask / GPU::VRAMDirtyGranularity;
+
+    u32 chunk = (addr & vrammask) / GPU::VRAMDirtyGranularity;
+    u32 lastchunk = ((addr + len - 1) & vrammask) / GPU::VRAMDirtyGranularity;
+
+    for (;;)
+    {
+        if (!cache.Valid[chunk])
+        {
+            u32* src = (u32*)&vram[chunk * GPU::VRAMDirtyGranularity];
+            u64* dst = (u64*)&cache.Data[chunk * GPU::VRAMDirtyGranularity * 2];
+
+            for (u32 i = 0; i < GPU::VRAMDirtyGranularity / 4; i++)
+            {
+                // spread the 8 nibbles out to one byte each
+                u64 pixels = src[i];
+                pixels = (pixels | (pixels << 16)) & 0x0000FFFF0000FFFF;
+                pixels = (pixels | (pixels << 8)) & 0x00FF00FF00FF00FF;
+                pixels = (pixels | (pixels << 4)) & 0x0F0F0F0F0F0F0F0F;
+                dst[i] = pixels;
+            }
+
+            cache.Valid[chunk] = true;
+        }
+
+        if (chunk == lastchunk)
+            break;
+
+        chunk = (chunk + 1) & chunkmask;
+    }
+
+    return cache.Data;
+}
+
+template <u32 Size, u32 DirtySize>
+void SoftRenderer::InvalidateTileCache(DecodedTileCache<Size>& cache, NonStupidBitField<DirtySize>& dirty)
+{
+    // engine B's VRAM is smaller, its dirty bits only cover the start of the cache
+    for (u32 i = 0; i < dirty.DataLength; i++)
+        cache.Valid.Data[i] &= ~dirty.Data[i];
 }
 
 u32 SoftRenderer::ColorBlend4(u32 val1, u32 val2, u32 eva, u32 evb)
@@ -104,7 +264,7 @@ u32 SoftRenderer::ColorComposite(int i, u32 val1, u32 val2)
     u32 flag1 = val1 >> 24;
     u32 flag2 = val2 >> 24;
 
-    u32 blendCnt = CurUnit->BlendCnt;
+    u32 blendCnt = CurRegs->BlendCnt;
 
     u32 target2;
     if      (flag2 & 0x80) target2 = 0x1000;
@@ -124,8 +284,8 @@ u32 SoftRenderer::ColorComposite(int i, u32 val1, u32 val2)
         }
         else
         {
-            eva = CurUnit->EVA;
-            evb = CurUnit->EVB;
+            eva = CurRegs->EVA;
+            evb = CurRegs->EVB;
         }
     }
     else if ((flag1 & 0x40) && (blendCnt & target2))
@@ -147,8 +307,8 @@ u32 SoftRenderer::ColorComposite(int i, u32 val1, u32 val2)
             {
                 if (blendCnt & target2)
                 {
-                    eva = CurUnit->EVA;
-                    evb = CurUnit->EVB;
+                    eva = CurRegs->EVA;
+                    evb = CurRegs->EVB;
                 }
                 else
                     coloreffect = 0;
@@ -160,41 +320,387 @@ u32 SoftRenderer::ColorComposite(int i, u32 val1, u32 val2)
     {
     case 0: return val1;
     case 1: return ColorBlend4(val1, val2, eva, evb);
-    case 2: return ColorBrightnessUp(val1, CurUnit->EVY);
-    case 3: return ColorBrightnessDown(val1, CurUnit->EVY);
+    case 2: return ColorBrightnessUp(val1, CurRegs->EVY);
+    case 3: return ColorBrightnessDown(val1, CurRegs->EVY);
     case 4: return ColorBlend5(val1, val2);
     }
 
     return val1;
 }
 
+#if defined(__SSE2__)
+// the colour functions above, four pixels at a time
+// red/blue are handled as the two 16-bit halves of each pixel, green on its own
+// the multipliers must be present in both halves, all the products fit within 16 bits
+
+inline __m128i Select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+inline __m128i Splat16(__m128i val)
+{
+    return _mm_or_si128(val, _mm_slli_epi32(val, 16));
+}
+
+inline __m128i MergeColors(__m128i rb, __m128i g)
+{
+    return _mm_or_si128(_mm_or_si128(rb, _mm_slli_epi32(g, 8)), _mm_set1_epi32(0xFF000000));
+}
+
+inline __m128i ColorBlend4_Vec(__m128i val1, __m128i val2, __m128i eva, __m128i evb)
+{
+    const __m128i rbmask = _mm_set1_epi32(0x003F003F);
+    const __m128i gmask = _mm_set1_epi32(0x3F);
+
+    __m128i rb = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(val1, rbmask), eva),
+                               _mm_mullo_epi16(_mm_and_si128(val2, rbmask), evb));
+    __m128i g = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(val1, 8), gmask), eva),
+                              _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(val2, 8), gmask), evb));
+
+    rb = _mm_min_epi16(_mm_srli_epi16(rb, 4), rbmask);
+    g = _mm_min_epi16(_mm_srli_epi16(g, 4), gmask);
+
+    return MergeColors(rb, g);
+}
+
+inline __m128i ColorBlend5_Vec(__m128i val1, __m128i val2)
+{
+    const __m128i rbmask = _mm_set1_epi32(0x003F003F);
+    const __m128i gmask = _mm_set1_epi32(0x3F);
+
+    __m128i eva = _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(val1, 24), _mm_set1_epi32(0x1F)), _mm_set1_epi32(1));
+    __m128i evb = _mm_sub_epi32(_mm_set1_epi32(32), eva);
+    __m128i round = _mm_cmplt_epi32(eva, _mm_set1_epi32(17));
+    __m128i opaque = _mm_cmpeq_epi32(eva, _mm_set1_epi32(32));
+    eva = Splat16(eva);
+    evb = Splat16(evb);
+
+    __m128i rb = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(val1, rbmask), eva),
+                               _mm_mullo_epi16(_mm_and_si128(val2, rbmask), evb));
+    __m128i g = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(val1, 8), gmask), eva),
+                              _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(val2, 8), gmask), evb));
+
+    rb = _mm_add_epi16(_mm_srli_epi16(rb, 5), _mm_and_si128(round, _mm_set1_epi32(0x00010001)));
+    g = _mm_add_epi16(_mm_srli_epi16(g, 5), _mm_and_si128(round, _mm_set1_epi32(1)));
+
+    rb = _mm_min_epi16(rb, rbmask);
+    g = _mm_min_epi16(g, gmask);
+
+    return Select(opaque, val1, MergeColors(rb, g));
+}
+
+inline __m128i ColorBrightnessUp_Vec(__m128i val, __m128i factor)
+{
+    const __m128i rbmask = _mm_set1_epi32(0x003F003F);
+    const __m128i gmask = _mm_set1_epi32(0x3F);
+
+    __m128i rb = _mm_and_si128(val, rbmask);
+    __m128i g = _mm_and_si128(_mm_srli_epi32(val, 8), gmask);
+
+    rb = _mm_add_epi16(rb, _mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(rbmask, rb), factor), 4));
+    g = _mm_add_epi16(g, _mm_srli_epi16(_mm_mullo_epi16(_mm_sub_epi16(gmask, g), factor), 4));
+
+    return MergeColors(rb, g);
+}
+
+inline __m128i ColorBrightnessDown_Vec(__m128i val, __m128i factor)
+{
+    const __m128i rbmask = _mm_set1_epi32(0x003F003F);
+    const __m128i gmask = _mm_set1_epi32(0x3F);
+
+    __m128i rb = _mm_and_si128(val, rbmask);
+    __m128i g = _mm_and_si128(_mm_srli_epi32(val, 8), gmask);
+
+    rb = _mm_sub_epi16(rb, _mm_srli_epi16(_mm_mullo_epi16(rb, factor), 4));
+    g = _mm_sub_epi16(g, _mm_srli_epi16(_mm_mullo_epi16(g, factor), 4));
+
+    return MergeColors(rb, g);
+}
+#elif defined(__aarch64__)
+inline uint32x4_t Splat16(uint32x4_t val)
+{
+    return vorrq_u32(val, vshlq_n_u32(val, 16));
+}
+
+inline uint16x8_t MulColors(uint32x4_t val, uint32x4_t factor)
+{
+    return vmulq_u16(vreinterpretq_u16_u32(val), vreinterpretq_u16_u32(factor));
+}
+
+inline uint32x4_t MergeColors(uint16x8_t rb, uint16x8_t g)
+{
+    return vorrq_u32(vorrq_u32(vreinterpretq_u32_u16(rb), vshlq_n_u32(vreinterpretq_u32_u16(g), 8)), vdupq_n_u32(0xFF000000));
+}
+
+inline uint32x4_t ColorBlend4_Vec(uint32x4_t val1, uint32x4_t val2, uint32x4_t eva, uint32x4_t evb)
+{
+    const uint32x4_t rbmask = vdupq_n_u32(0x003F003F);
+    const uint32x4_t gmask = vdupq_n_u32(0x3F);
+
+    uint16x8_t rb = vaddq_u16(MulColors(vandq_u32(val1, rbmask), eva), MulColors(vandq_u32(val2, rbmask), evb));
+    uint16x8_t g = vaddq_u16(MulColors(vandq_u32(vshrq_n_u32(val1, 8), gmask), eva),
+                             MulColors(vandq_u32(vshrq_n_u32(val2, 8), gmask), evb));
+
+    rb = vminq_u16(vshrq_n_u16(rb, 4), vreinterpretq_u16_u32(rbmask));
+    g = vminq_u16(vshrq_n_u16(g, 4), vreinterpretq_u16_u32(gmask));
+
+    return MergeColors(rb, g);
+}
+
+inline uint32x4_t ColorBlend5_Vec(uint32x4_t val1, uint32x4_t val2)
+{
+    const uint32x4_t rbmask = vdupq_n_u32(0x003F003F);
+    const uint32x4_t gmask = vdupq_n_u32(0x3F);
+
+    uint32x4_t eva = vaddq_u32(vandq_u32(vshrq_n_u32(val1, 24), vdupq_n_u32(0x1F)), vdupq_n_u32(1));
+    uint32x4_t evb = vsubq_u32(vdupq_n_u32(32), eva);
+    uint32x4_t round = vcltq_u32(eva, vdupq_n_u32(17));
+    uint32x4_t opaque = vceqq_u32(eva, vdupq_n_u32(32));
+    eva = Splat16(eva);
+    evb = Splat16(evb);
+
+    uint16x8_t rb = vaddq_u16(MulColors(vandq_u32(val1, rbmask), eva), MulColors(vandq_u32(val2, rbmask), evb));
+    uint16x8_t g = vaddq_u16(MulColors(vandq_u32(vshrq_n_u32(val1, 8), gmask), eva),
+                             MulColors(vandq_u32(vshrq_n_u32(val2, 8), gmask), evb));
+
+    rb = vaddq_u16(vshrq_n_u16(rb, 5), vreinterpretq_u16_u32(vandq_u32(round, vdupq_n_u32(0x00010001))));
+    g = vaddq_u16(vshrq_n_u16(g, 5), vreinterpretq_u16_u32(vandq_u32(round, vdupq_n_u32(1))));
+
+    rb = vminq_u16(rb, vreinterpretq_u16_u32(rbmask));
+    g = vminq_u16(g, vreinterpretq_u16_u32(gmask));
+
+    return vbslq_u32(opaque, val1, MergeColors(rb, g));
+}
+
+inline uint32x4_t ColorBrightnessUp_Vec(uint32x4_t val, uint32x4_t factor)
+{
+    const uint32x4_t rbmask = vdupq_n_u32(0x003F003F);
+    const uint32x4_t gmask = vdupq_n_u32(0x3F);
+
+    uint32x4_t rb = vandq_u32(val, rbmask);
+    uint32x4_t g = vandq_u32(vshrq_n_u32(val, 8), gmask);
+
+    uint16x8_t rbinc = vshrq_n_u16(MulColors(vsubq_u32(rbmask, rb), factor), 4);
+    uint16x8_t ginc = vshrq_n_u16(MulColors(vsubq_u32(gmask, g), factor), 4);
+
+    return MergeColors(vaddq_u16(vreinterpretq_u16_u32(rb), rbinc), vaddq_u16(vreinterpretq_u16_u32(g), ginc));
+}
+
+inline uint32x4_t ColorBrightnessDown_Vec(uint32x4_t val, uint32x4_t factor)
+{
+    const uint32x4_t rbmask = vdupq_n_u32(0x003F003F);
+    const uint32x4_t gmask = vdupq_n_u32(0x3F);
+
+    uint32x4_t rb = vandq_u32(val, rbmask);
+    uint32x4_t g = vandq_u32(vshrq_n_u32(val, 8), gmask);
+
+    uint16x8_t rbdec = vshrq_n_u16(MulColors(rb, factor), 4);
+    uint16x8_t gdec = vshrq_n_u16(MulColors(g, factor), 4);
+
+    return MergeColors(vsubq_u16(vreinterpretq_u16_u32(rb), rbdec), vsubq_u16(vreinterpretq_u16_u32(g), gdec));
+}
+#endif
+
+void SoftRenderer::ColorCompositeLine()
+{
+#if defined(__SSE2__) || defined(__aarch64__)
+    // same logic as ColorComposite(), with every effect computed for the whole
+    // group of pixels and the right one picked for each pixel
+    // the effect type is the same for the whole line, only the masks vary
+
+    u32 blendCnt = CurRegs->BlendCnt;
+    u32 effect = (blendCnt >> 6) & 0x3;
+#endif
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i blendcnt = _mm_set1_epi32(blendCnt);
+    const __m128i globaleva = _mm_set1_epi32(CurRegs->EVA);
+    const __m128i globalevb = _mm_set1_epi32(CurRegs->EVB);
+    const __m128i evy = _mm_set1_epi16(CurRegs->EVY);
+
+    for (int i = 0; i < 256; i += 4)
+    {
+        __m128i val1 = _mm_loadu_si128((__m128i*)&BGOBJLine[i]);
+        __m128i val2 = _mm_loadu_si128((__m128i*)&BGOBJLine[256+i]);
+        __m128i winmask = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(*(u32*)&WindowMask[i]), zero), zero);
+
+        __m128i flag1 = _mm_srli_epi32(val1, 24);
+        __m128i flag2 = _mm_srli_epi32(val2, 24);
+
+        __m128i sprite1 = _mm_cmpeq_epi32(_mm_and_si128(flag1, _mm_set1_epi32(0x80)), _mm_set1_epi32(0x80));
+        __m128i layer3d1 = _mm_cmpeq_epi32(_mm_and_si128(flag1, _mm_set1_epi32(0x40)), _mm_set1_epi32(0x40));
+        __m128i sprite2 = _mm_cmpeq_epi32(_mm_and_si128(flag2, _mm_set1_epi32(0x80)), _mm_set1_epi32(0x80));
+        __m128i layer3d2 = _mm_cmpeq_epi32(_mm_and_si128(flag2, _mm_set1_epi32(0x40)), _mm_set1_epi32(0x40));
+
+        __m128i target2 = Select(sprite2, _mm_set1_epi32(0x1000),
+                                 Select(layer3d2, _mm_set1_epi32(0x0100), _mm_slli_epi32(flag2, 8)));
+        __m128i notarget2 = _mm_cmpeq_epi32(_mm_and_si128(blendcnt, target2), zero);
+
+        __m128i spriteblend = _mm_andnot_si128(notarget2, sprite1);
+        __m128i blend3d = _mm_andnot_si128(_mm_or_si128(notarget2, sprite1), layer3d1);
+
+        __m128i target1 = Select(sprite1, _mm_set1_epi32(0x10), Select(layer3d1, _mm_set1_epi32(0x01), flag1));
+        __m128i notarget1 = _mm_cmpeq_epi32(_mm_and_si128(blendcnt, target1), zero);
+        __m128i nowindow = _mm_cmpeq_epi32(_mm_and_si128(winmask, _mm_set1_epi32(0x20)), zero);
+        __m128i special = _mm_andnot_si128(_mm_or_si128(_mm_or_si128(spriteblend, blend3d), _mm_or_si128(notarget1, nowindow)),
+                                           _mm_set1_epi32(-1));
+
+        __m128i blend4 = spriteblend;
+        if (effect == 1)
+            blend4 = _mm_or_si128(blend4, _mm_andnot_si128(notarget2, special));
+
+        __m128i res = val1;
+
+        if (_mm_movemask_epi8(blend4))
+        {
+            __m128i alpha = _mm_and_si128(flag1, _mm_set1_epi32(0x1F));
+            __m128i eva = Select(layer3d1, alpha, globaleva);
+            __m128i evb = Select(layer3d1, _mm_sub_epi32(_mm_set1_epi32(16), alpha), globalevb);
+
+            res = Select(blend4, ColorBlend4_Vec(val1, val2, Splat16(eva), Splat16(evb)), res);
+        }
+        if (_mm_movemask_epi8(blend3d))
+            res = Select(blend3d, ColorBlend5_Vec(val1, val2), res);
+        if (effect >= 2 && _mm_movemask_epi8(special))
+            res = Select(special, (effect == 2) ? ColorBrightnessUp_Vec(val1, evy) : ColorBrightnessDown_Vec(val1, evy), res);
+
+        _mm_storeu_si128((__m128i*)&BGOBJLine[i], res);
+    }
+#elif defined(__aarch64__)
+    const uint32x4_t blendcnt = vdupq_n_u32(blendCnt);
+    const uint32x4_t globaleva = vdupq_n_u32(CurRegs->EVA);
+    const uint32x4_t globalevb = vdupq_n_u32(CurRegs->EVB);
+    const uint32x4_t evy = vreinterpretq_u32_u16(vdupq_n_u16(CurRegs->EVY));
+
+    for (int i = 0; i < 256; i += 4)
+    {
+        uint32x4_t val1 = vld1q_u32(&BGOBJLine[i]);
+        uint32x4_t val2 = vld1q_u32(&BGOBJLine[256+i]);
+        uint32x4_t winmask = vmovl_u16(vget_low_u16(vmovl_u8(vcreate_u8(*(u32*)&WindowMask[i]))));
+
+        uint32x4_t flag1 = vshrq_n_u32(val1, 24);
+        uint32x4_t flag2 = vshrq_n_u32(val2, 24);
+
+        uint32x4_t sprite1 = vtstq_u32(flag1, vdupq_n_u32(0x80));
+        uint32x4_t layer3d1 = vtstq_u32(flag1, vdupq_n_u32(0x40));
+        uint32x4_t sprite2 = vtstq_u32(flag2, vdupq_n_u32(0x80));
+        uint32x4_t layer3d2 = vtstq_u32(flag2, vdupq_n_u32(0x40));
+
+        uint32x4_t target2 = vbslq_u32(sprite2, vdupq_n_u32(0x1000),
+                                       vbslq_u32(layer3d2, vdupq_n_u32(0x0100), vshlq_n_u32(flag2, 8)));
+        uint32x4_t hastarget2 = vtstq_u32(blendcnt, target2);
+
+        uint32x4_t spriteblend = vandq_u32(sprite1, hastarget2);
+        uint32x4_t blend3d = vbicq_u32(vandq_u32(layer3d1, hastarget2), sprite1);
+
+        uint32x4_t target1 = vbslq_u32(sprite1, vdupq_n_u32(0x10), vbslq_u32(layer3d1, vdupq_n_u32(0x01), flag1));
+        uint32x4_t special = vandq_u32(vtstq_u32(blendcnt, target1), vtstq_u32(winmask, vdupq_n_u32(0x20)));
+        special = vbicq_u32(special, vorrq_u32(spriteblend, blend3d));
+
+        uint32x4_t blend4 = spriteblend;
+        if (effect == 1)
+            blend4 = vorrq_u32(blend4, vandq_u32(special, hastarget2));
+
+        uint32x4_t res = val1;
+
+        if (vmaxvq_u32(blend4))
+        {
+            uint32x4_t alpha = vandq_u32(flag1, vdupq_n_u32(0x1F));
+            uint32x4_t eva = vbslq_u32(layer3d1, alpha, globaleva);
+            uint32x4_t evb = vbslq_u32(layer3d1, vsubq_u32(vdupq_n_u32(16), alpha), globalevb);
+
+            res = vbslq_u32(blend4, ColorBlend4_Vec(val1, val2, Splat16(eva), Splat16(evb)), res);
+        }
+        if (vmaxvq_u32(blend3d))
+            res = vbslq_u32(blend3d, ColorBlend5_Vec(val1, val2), res);
+        if (effect >= 2 && vmaxvq_u32(special))
+            res = vbslq_u32(special, (effect == 2) ? ColorBrightnessUp_Vec(val1, evy) : ColorBrightnessDown_Vec(val1, evy), res);
+
+        vst1q_u32(&BGOBJLine[i], res);
+    }
+#else
+    for (int i = 0; i < 256; i++)
+    {
+        u32 val1 = BGOBJLine[i];
+        u32 val2 = BGOBJLine[256+i];
+
+        BGOBJLine[i] = ColorComposite(i, val1, val2);
+    }
+#endif
+}
+
 void SoftRenderer::DrawScanline(u32 line, Unit* unit)
+{
+    // display capture and the display FIFO exchange data with the
+    // emulator thread during the frame, so those lines are drawn right away
+    if (RenderThreadRunning.load(std::memory_order_relaxed))
+    {
+        bool sync = (unit->Num == 0) &&
+                    ((unit->CaptureCnt & (1<<31)) || unit->CaptureLatch || unit->UsesFIFO());
+
+        if (!sync)
+        {
+            QueueCommand(false, line, unit);
+            return;
+        }
+
+        Sync();
+    }
+
+    Unit::LineRegisters regs;
+    unit->GetLineRegisters(regs);
+    DoDrawScanline(line, GPU::VCount, unit, regs);
+}
+
+void SoftRenderer::DrawSprites(u32 line, Unit* unit)
+{
+    if (RenderThreadRunning.load(std::memory_order_relaxed))
+        QueueCommand(true, line, unit);
+    else
+        DoDrawSprites(line, unit);
+}
+
+void SoftRenderer::DoDrawScanline(u32 line, u32 vcount, Unit* unit, Unit::LineRegisters& regs)
 {
     CurUnit = unit;
+    CurRegs = &regs;
+
+    // reference points written during the previous line take effect from this one on
+    CurUnit->ReloadBGRefs(regs.BGRefReload, regs.BGXRef, regs.BGYRef);
 
     int stride = GPU3D::CurrentRenderer->Accelerated ? (256*3 + 1) : 256;
     u32* dst = &Framebuffer[CurUnit->Num][stride * line];
 
     int n3dline = line;
-    line = GPU::VCount;
+    line = vcount;
 
-    if (CurUnit->Num == 0)
-    {
-        auto bgDirty = GPU::VRAMDirty_ABG.DeriveState(GPU::VRAMMap_ABG);
-        GPU::MakeVRAMFlat_ABGCoherent(bgDirty);
-        auto bgExtPalDirty = GPU::VRAMDirty_ABGExtPal.DeriveState(GPU::VRAMMap_ABGExtPal);
-        GPU::MakeVRAMFlat_ABGExtPalCoherent(bgExtPalDirty);
-        auto objExtPalDirty = GPU::VRAMDirty_AOBJExtPal.DeriveState(&GPU::VRAMMap_AOBJExtPal);
-        GPU::MakeVRAMFlat_AOBJExtPalCoherent(objExtPalDirty);
-    }
-    else
+    // nothing to update if VRAM wasn't written to or remapped since the last time
+    if (BGVRAMGeneration != GPU::VRAMGeneration)
     {
-        auto bgDirty = GPU::VRAMDirty_BBG.DeriveState(GPU::VRAMMap_BBG);
-        GPU::MakeVRAMFlat_BBGCoherent(bgDirty);
-        auto bgExtPalDirty = GPU::VRAMDirty_BBGExtPal.DeriveState(GPU::VRAMMap_BBGExtPal);
-        GPU::MakeVRAMFlat_BBGExtPalCoherent(bgExtPalDirty);
-        auto objExtPalDirty = GPU::VRAMDirty_BOBJExtPal.DeriveState(&GPU::VRAMMap_BOBJExtPal);
-        GPU::MakeVRAMFlat_BOBJExtPalCoherent(objExtPalDirty);
+        BGVRAMGeneration = GPU::VRAMGeneration;
+
+        if (CurUnit->Num == 0)
+        {
+            auto bgDirty = GPU::VRAMDirty_ABG.DeriveState(GPU::VRAMMap_ABG);
+            GPU::MakeVRAMFlat_ABGCoherent(bgDirty);
+            InvalidateTileCache(BGTileCache, bgDirty);
+            auto bgExtPalDirty = GPU::VRAMDirty_ABGExtPal.DeriveState(GPU::VRAMMap_ABGExtPal);
+            GPU::MakeVRAMFlat_ABGExtPalCoherent(bgExtPalDirty);
+            auto objExtPalDirty = GPU::VRAMDirty_AOBJExtPal.DeriveState(&GPU::VRAMMap_AOBJExtPal);
+            GPU::MakeVRAMFlat_AOBJExtPalCoherent(objExtPalDirty);
+        }
+        else
+        {
+            auto bgDirty = GPU::VRAMDirty_BBG.DeriveState(GPU::VRAMMap_BBG);
+            GPU::MakeVRAMFlat_BBGCoherent(bgDirty);
+            InvalidateTileCache(BGTileCache, bgDirty);
+            auto bgExtPalDirty = GPU::VRAMDirty_BBGExtPal.DeriveState(GPU::VRAMMap_BBGExtPal);
+            GPU::MakeVRAMFlat_BBGExtPalCoherent(bgExtPalDirty);
+            auto objExtPalDirty = GPU::VRAMDirty_BOBJExtPal.DeriveState(&GPU::VRAMMap_BOBJExtPal);
+            GPU::MakeVRAMFlat_BOBJExtPalCoherent(objExtPalDirty);
+        }
     }
 
     bool forceblank = false;
@@ -238,7 +744,7 @@ void SoftRenderer::DrawScanline(u32 line, Unit* unit)
 
     // always render regular graphics
     DrawScanline_BGOBJ(line);
-    CurUnit->UpdateMosaicCounters(line);
+    CurUnit->UpdateMosaicCounters(line, *CurRegs);
 
     switch (dispmode)
     {
@@ -316,7 +822,7 @@ void SoftRenderer::DrawScanline(u32 line, Unit* unit)
             DoCapture(line, capwidth);
     }
 
-    u32 masterBrightness = CurUnit->MasterBrightness;
+    u32 masterBrightness = CurRegs->MasterBrightness;
 
     if (GPU3D::CurrentRenderer->Accelerated)
     {
@@ -333,10 +839,25 @@ void SoftRenderer::DrawScanline(u32 line, Unit* unit)
             u32 factor = masterBrightness & 0x1F;
             if (factor > 16) factor = 16;
 
+#if defined(__SSE2__)
+            const __m128i vfactor = _mm_set1_epi16(factor);
+            for (int i = 0; i < 256; i += 4)
+            {
+                __m128i val = _mm_loadu_si128((__m128i*)&dst[i]);
+                _mm_storeu_si128((__m128i*)&dst[i], ColorBrightnessUp_Vec(val, vfactor));
+            }
+#elif defined(__aarch64__)
+            const uint32x4_t vfactor = vreinterpretq_u32_u16(vdupq_n_u16(factor));
+            for (int i = 0; i < 256; i += 4)
+            {
+                vst1q_u32(&dst[i], ColorBrightnessUp_Vec(vld1q_u32(&dst[i]), vfactor));
+            }
+#else
             for (int i = 0; i < 256; i++)
             {
                 dst[i] = ColorBrightnessUp(dst[i], factor);
             }
+#endif
         }
         else if ((masterBrightness >> 14) == 2)
         {
@@ -344,16 +865,58 @@ void SoftRenderer::DrawScanline(u32 line, Unit* unit)
             u32 factor = masterBrightness & 0x1F;
             if (factor > 16) factor = 16;
 
+#if defined(__SSE2__)
+            const __m128i vfactor = _mm_set1_epi16(factor);
+            for (int i = 0; i < 256; i += 4)
+            {
+                __m128i val = _mm_loadu_si128((__m128i*)&dst[i]);
+                _mm_storeu_si128((__m128i*)&dst[i], ColorBrightnessDown_Vec(val, vfactor));
+            }
+#elif defined(__aarch64__)
+            const uint32x4_t vfactor = vreinterpretq_u32_u16(vdupq_n_u16(factor));
+            for (int i = 0; i < 256; i += 4)
+            {
+                vst1q_u32(&dst[i], ColorBrightnessDown_Vec(vld1q_u32(&dst[i]), vfactor));
+            }
+#else
             for (int i = 0; i < 256; i++)
             {
                 dst[i] = ColorBrightnessDown(dst[i], factor);
             }
+#endif
         }
     }
 
     // convert to 32-bit BGRA
     // note: 32-bit RGBA would be more straightforward, but
     // BGRA seems to be more compatible (Direct2D soft, cairo...)
+#if defined(__SSE2__)
+    for (int i = 0; i < 256; i += 4)
+    {
+        __m128i c = _mm_loadu_si128((__m128i*)&dst[i]);
+
+        __m128i r = _mm_and_si128(_mm_slli_epi32(c, 18), _mm_set1_epi32(0xFC0000));
+        __m128i g = _mm_and_si128(_mm_slli_epi32(c, 2), _mm_set1_epi32(0xFC00));
+        __m128i b = _mm_and_si128(_mm_srli_epi32(c, 14), _mm_set1_epi32(0xFC));
+        c = _mm_or_si128(_mm_or_si128(r, g), b);
+
+        c = _mm_or_si128(c, _mm_srli_epi32(_mm_and_si128(c, _mm_set1_epi32(0xC0C0C0)), 6));
+        _mm_storeu_si128((__m128i*)&dst[i], _mm_or_si128(c, _mm_set1_epi32(0xFF000000)));
+    }
+#elif defined(__aarch64__)
+    for (int i = 0; i < 256; i += 4)
+    {
+        uint32x4_t c = vld1q_u32(&dst[i]);
+
+        uint32x4_t r = vandq_u32(vshlq_n_u32(c, 18), vdupq_n_u32(0xFC0000));
+        uint32x4_t g = vandq_u32(vshlq_n_u32(c, 2), vdupq_n_u32(0xFC00));
+        uint32x4_t b = vandq_u32(vshrq_n_u32(c, 14), vdupq_n_u32(0xFC));
+        c = vorrq_u32(vorrq_u32(r, g), b);
+
+        c = vorrq_u32(c, vshrq_n_u32(vandq_u32(c, vdupq_n_u32(0xC0C0C0)), 6));
+        vst1q_u32(&dst[i], vorrq_u32(c, vdupq_n_u32(0xFF000000)));
+    }
+#else
     for (int i = 0; i < 256; i+=2)
     {
         u64 c = *(u64*)&dst[i];
@@ -365,6 +928,7 @@ void SoftRenderer::DrawScanline(u32 line, Unit* unit)
 
         *(u64*)&dst[i] = c | ((c & 0x00C0C0C000C0C0C0) >> 6) | 0xFF000000FF000000;
     }
+#endif
 }
 
 void SoftRenderer::VBlankEnd(Unit* unitA, Unit* unitB)
@@ -380,6 +944,90 @@ void SoftRenderer::VBlankEnd(Unit* unitA, Unit* unitB)
 #endif
 }
 
+#if defined(__SSE2__)
+// converts eight pixels to the 15-bit format used for capture
+inline __m128i CaptureColors_Vec(u32* src)
+{
+    __m128i res[2];
+    for (int i = 0; i < 2; i++)
+    {
+        __m128i val = _mm_loadu_si128((__m128i*)&src[i*4]);
+
+        __m128i r = _mm_and_si128(_mm_srli_epi32(val, 1), _mm_set1_epi32(0x001F));
+        __m128i g = _mm_and_si128(_mm_srli_epi32(val, 4), _mm_set1_epi32(0x03E0));
+        __m128i b = _mm_and_si128(_mm_srli_epi32(val, 7), _mm_set1_epi32(0x7C00));
+
+        // the alpha bit is sign extended so the values survive the signed pack below
+        __m128i a = _mm_cmpeq_epi32(_mm_and_si128(val, _mm_set1_epi32(0xFF000000)), _mm_setzero_si128());
+        a = _mm_andnot_si128(a, _mm_set1_epi32(0xFFFF8000));
+
+        res[i] = _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, a));
+    }
+
+    return _mm_packs_epi32(res[0], res[1]);
+}
+
+inline __m128i CaptureBlend_Vec(__m128i valA, __m128i valB, __m128i eva, __m128i evb, __m128i alphaA, __m128i alphaB)
+{
+    const __m128i mask = _mm_set1_epi16(0x1F);
+
+    // pixels with the alpha bit clear don't contribute
+    valA = _mm_and_si128(valA, _mm_srai_epi16(valA, 15));
+    valB = _mm_and_si128(valB, _mm_srai_epi16(valB, 15));
+
+    __m128i r = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(valA, mask), eva),
+                              _mm_mullo_epi16(_mm_and_si128(valB, mask), evb));
+    __m128i g = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(valA, 5), mask), eva),
+                              _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(valB, 5), mask), evb));
+    __m128i b = _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(valA, 10), mask), eva),
+                              _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(valB, 10), mask), evb));
+
+    r = _mm_min_epi16(_mm_srli_epi16(r, 4), mask);
+    g = _mm_min_epi16(_mm_srli_epi16(g, 4), mask);
+    b = _mm_min_epi16(_mm_srli_epi16(b, 4), mask);
+    __m128i a = _mm_or_si128(_mm_and_si128(valA, alphaA), _mm_and_si128(valB, alphaB));
+
+    return _mm_or_si128(_mm_or_si128(r, _mm_slli_epi16(g, 5)), _mm_or_si128(_mm_slli_epi16(b, 10), a));
+}
+#elif defined(__aarch64__)
+inline uint16x8_t CaptureColors_Vec(u32* src)
+{
+    uint16x4_t res[2];
+    for (int i = 0; i < 2; i++)
+    {
+        uint32x4_t val = vld1q_u32(&src[i*4]);
+
+        uint32x4_t r = vandq_u32(vshrq_n_u32(val, 1), vdupq_n_u32(0x001F));
+        uint32x4_t g = vandq_u32(vshrq_n_u32(val, 4), vdupq_n_u32(0x03E0));
+        uint32x4_t b = vandq_u32(vshrq_n_u32(val, 7), vdupq_n_u32(0x7C00));
+        uint32x4_t a = vandq_u32(vtstq_u32(val, vdupq_n_u32(0xFF000000)), vdupq_n_u32(0x8000));
+
+        res[i] = vmovn_u32(vorrq_u32(vorrq_u32(r, g), vorrq_u32(b, a)));
+    }
+
+    return vcombine_u16(res[0], res[1]);
+}
+
+inline uint16x8_t CaptureBlend_Vec(uint16x8_t valA, uint16x8_t valB, uint16x8_t eva, uint16x8_t evb, uint16x8_t alphaA, uint16x8_t alphaB)
+{
+    const uint16x8_t mask = vdupq_n_u16(0x1F);
+
+    valA = vandq_u16(valA, vtstq_u16(valA, vdupq_n_u16(0x8000)));
+    valB = vandq_u16(valB, vtstq_u16(valB, vdupq_n_u16(0x8000)));
+
+    uint16x8_t r = vmlaq_u16(vmulq_u16(vandq_u16(valA, mask), eva), vandq_u16(valB, mask), evb);
+    uint16x8_t g = vmlaq_u16(vmulq_u16(vandq_u16(vshrq_n_u16(valA, 5), mask), eva), vandq_u16(vshrq_n_u16(valB, 5), mask), evb);
+    uint16x8_t b = vmlaq_u16(vmulq_u16(vandq_u16(vshrq_n_u16(valA, 10), mask), eva), vandq_u16(vshrq_n_u16(valB, 10), mask), evb);
+
+    r = vminq_u16(vshrq_n_u16(r, 4), mask);
+    g = vminq_u16(vshrq_n_u16(g, 4), mask);
+    b = vminq_u16(vshrq_n_u16(b, 4), mask);
+    uint16x8_t a = vorrq_u16(vandq_u16(valA, alphaA), vandq_u16(valB, alphaB));
+
+    return vorrq_u16(vorrq_u16(r, vshlq_n_u16(g, 5)), vorrq_u16(vshlq_n_u16(b, 10), a));
+}
+#endif
+
 void SoftRenderer::DoCapture(u32 line, u32 width)
 {
     u32 captureCnt = CurUnit->CaptureCnt;
@@ -488,6 +1136,70 @@ void SoftRenderer::DoCapture(u32 line, u32 width)
     static_assert(GPU::VRAMDirtyGranularity == 512, "");
     GPU::VRAMDirty[dstvram][(dstaddr * 2) / GPU::VRAMDirtyGranularity] = true;
 
+#if defined(__SSE2__) || defined(__aarch64__)
+    // both addresses are multiples of the capture width, so a line never
+    // wraps around, and it can be processed eight pixels at a time
+    u16* dstline = &dst[dstaddr];
+    u16* srcBline = srcB ? &srcB[srcBaddr] : NULL;
+
+    switch ((captureCnt >> 29) & 0x3)
+    {
+    case 0: // source A
+        for (u32 i = 0; i < width; i += 8)
+        {
+#if defined(__SSE2__)
+            _mm_storeu_si128((__m128i*)&dstline[i], CaptureColors_Vec(&srcA[i]));
+#else
+            vst1q_u16(&dstline[i], CaptureColors_Vec(&srcA[i]));
+#endif
+        }
+        break;
+
+    case 1: // source B
+        if (srcBline)
+            memcpy(dstline, srcBline, width * 2);
+        else
+            memset(dstline, 0, width * 2);
+        break;
+
+    case 2: // sources A+B
+    case 3:
+        {
+            u32 eva = captureCnt & 0x1F;
+            u32 evb = (captureCnt >> 8) & 0x1F;
+
+            // checkme
+            if (eva > 16) eva = 16;
+            if (evb > 16) evb = 16;
+
+            // without source B, this works out the same as blending with transparent pixels
+#if defined(__SSE2__)
+            __m128i veva = _mm_set1_epi16(eva);
+            __m128i vevb = _mm_set1_epi16(evb);
+            __m128i alphaA = _mm_set1_epi16(eva > 0 ? 0x8000 : 0);
+            __m128i alphaB = _mm_set1_epi16(evb > 0 ? 0x8000 : 0);
+
+            for (u32 i = 0; i < width; i += 8)
+            {
+                __m128i valB = srcBline ? _mm_loadu_si128((__m128i*)&srcBline[i]) : _mm_setzero_si128();
+                _mm_storeu_si128((__m128i*)&dstline[i], CaptureBlend_Vec(CaptureColors_Vec(&srcA[i]), valB, veva, vevb, alphaA, alphaB));
+            }
+#else
+            uint16x8_t veva = vdupq_n_u16(eva);
+            uint16x8_t vevb = vdupq_n_u16(evb);
+            uint16x8_t alphaA = vdupq_n_u16(eva > 0 ? 0x8000 : 0);
+            uint16x8_t alphaB = vdupq_n_u16(evb > 0 ? 0x8000 : 0);
+
+            for (u32 i = 0; i < width; i += 8)
+            {
+                uint16x8_t valB = srcBline ? vld1q_u16(&srcBline[i]) : vdupq_n_u16(0);
+                vst1q_u16(&dstline[i], CaptureBlend_Vec(CaptureColors_Vec(&srcA[i]), valB, veva, vevb, alphaA, alphaB));
+            }
+#endif
+        }
+        break;
+    }
+#else
     switch ((captureCnt >> 29) & 0x3)
     {
     case 0: // source A
@@ -600,12 +1312,13 @@ void SoftRenderer::DoCapture(u32 line, u32 width)
         }
         break;
     }
+#endif
 }
 
 #define DoDrawBG(type, line, num) \
     do \
     { \
-        if ((bgCnt[num] & 0x0040) && (CurUnit->BGMosaicSize[0] > 0)) \
+        if ((bgCnt[num] & 0x0040) && (CurRegs->BGMosaicSize[0] > 0)) \
         { \
             if (GPU3D::CurrentRenderer->Accelerated) DrawBG_##type<true, DrawPixel_Accel>(line, num); \
             else DrawBG_##type<true, DrawPixel_Normal>(line, num); \
@@ -620,7 +1333,7 @@ void SoftRenderer::DoCapture(u32 line, u32 width)
 #define DoDrawBG_Large(line) \
     do \
     { \
-        if ((bgCnt[2] & 0x0040) && (CurUnit->BGMosaicSize[0] > 0)) \
+        if ((bgCnt[2] & 0x0040) && (CurRegs->BGMosaicSize[0] > 0)) \
         { \
             if (GPU3D::CurrentRenderer->Accelerated) DrawBG_Large<true, DrawPixel_Accel>(line); \
             else DrawBG_Large<true, DrawPixel_Normal>(line); \
@@ -779,12 +1492,25 @@ void SoftRenderer::DrawScanline_BGOBJ(u32 line)
     }
 
     if (CurUnit->DispCnt & 0xE000)
-        CurUnit->CalculateWindowMask(line, WindowMask, OBJWindow[CurUnit->Num]);
+    {
+        CurUnit->CalculateWindowMask(line, *CurRegs, WindowMask, OBJWindow[CurUnit->Num]);
+
+        u64 common = 0xFFFFFFFFFFFFFFFF;
+        for (int i = 0; i < 256; i+=8)
+            common &= *(u64*)&WindowMask[i];
+        common &= common >> 32;
+        common &= common >> 16;
+        common &= common >> 8;
+        WindowMaskCommon = common & 0xFF;
+    }
     else
+    {
         memset(WindowMask, 0xFF, 256);
+        WindowMaskCommon = 0xFF;
+    }
 
     ApplySpriteMosaicX();
-    CurBGXMosaicTable = MosaicTable[CurUnit->BGMosaicSize[0]];
+    CurBGXMosaicTable = MosaicTable[CurRegs->BGMosaicSize[0]];
 
     switch (CurUnit->DispCnt & 0x7)
     {
@@ -799,17 +1525,10 @@ void SoftRenderer::DrawScanline_BGOBJ(u32 line)
     }
 
     // color special effects
-    // can likely be optimized
 
     if (!GPU3D::CurrentRenderer->Accelerated)
     {
-        for (int i = 0; i < 256; i++)
-        {
-            u32 val1 = BGOBJLine[i];
-            u32 val2 = BGOBJLine[256+i];
-
-            BGOBJLine[i] = ColorComposite(i, val1, val2);
-        }
+        ColorCompositeLine();
     }
     else
     {
@@ -824,7 +1543,7 @@ void SoftRenderer::DrawScanline_BGOBJ(u32 line)
                 u32 flag1 = val1 >> 24;
                 u32 flag2 = val2 >> 24;
 
-                u32 bldcnteffect = (CurUnit->BlendCnt >> 6) & 0x3;
+                u32 bldcnteffect = (CurRegs->BlendCnt >> 6) & 0x3;
 
                 u32 target1;
                 if      (flag1 & 0x80) target1 = 0x0010;
@@ -836,7 +1555,7 @@ void SoftRenderer::DrawScanline_BGOBJ(u32 line)
                 else if (flag2 & 0x40) target2 = 0x0100;
                 else                   target2 = flag2 << 8;
 
-                if (((flag1 & 0xC0) == 0x40) && (CurUnit->BlendCnt & target2))
+                if (((flag1 & 0xC0) == 0x40) && (CurRegs->BlendCnt & target2))
                 {
                     // 3D on top, blending
 
@@ -849,14 +1568,14 @@ void SoftRenderer::DrawScanline_BGOBJ(u32 line)
                     // 3D on top, normal/fade
 
                     if (bldcnteffect == 1)             bldcnteffect = 0;
-                    if (!(CurUnit->BlendCnt & 0x0001)) bldcnteffect = 0;
+                    if (!(CurRegs->BlendCnt & 0x0001)) bldcnteffect = 0;
                     if (!(WindowMask[i] & 0x20))       bldcnteffect = 0;
 
                     BGOBJLine[i]     = val2;
                     BGOBJLine[256+i] = ColorComposite(i, val2, val3);
-                    BGOBJLine[512+i] = (bldcnteffect << 24) | (CurUnit->EVY << 8);
+                    BGOBJLine[512+i] = (bldcnteffect << 24) | (CurRegs->EVY << 8);
                 }
-                else if (((flag2 & 0xC0) == 0x40) && ((CurUnit->BlendCnt & 0x01C0) == 0x0140))
+                else if (((flag2 & 0xC0) == 0x40) && ((CurRegs->BlendCnt & 0x01C0) == 0x0140))
                 {
                     // 3D on bottom, blending
 
@@ -866,18 +1585,18 @@ void SoftRenderer::DrawScanline_BGOBJ(u32 line)
                         eva = flag1 & 0x1F;
                         evb = 16 - eva;
                     }
-                    else if (((CurUnit->BlendCnt & target1) && (WindowMask[i] & 0x20)) ||
+                    else if (((CurRegs->BlendCnt & target1) && (WindowMask[i] & 0x20)) ||
                             ((flag1 & 0xC0) == 0x80))
                     {
-                        eva = CurUnit->EVA;
-                        evb = CurUnit->EVB;
+                        eva = CurRegs->EVA;
+                        evb = CurRegs->EVB;
                     }
                     else
                         bldcnteffect = 7;
 
                     BGOBJLine[i]     = val1;
                     BGOBJLine[256+i] = ColorComposite(i, val1, val3);
-                    BGOBJLine[512+i] = (bldcnteffect << 24) | (CurUnit->EVB << 16) | (CurUnit->EVA << 8);
+                    BGOBJLine[512+i] = (bldcnteffect << 24) | (CurRegs->EVB << 16) | (CurRegs->EVA << 8);
                 }
                 else
                 {
@@ -906,7 +1625,7 @@ void SoftRenderer::DrawScanline_BGOBJ(u32 line)
     if (CurUnit->BGMosaicY >= CurUnit->BGMosaicYMax)
     {
         CurUnit->BGMosaicY = 0;
-        CurUnit->BGMosaicYMax = CurUnit->BGMosaicSize[1];
+        CurUnit->BGMosaicYMax = CurRegs->BGMosaicSize[1];
     }
     else
         CurUnit->BGMosaicY++;
@@ -975,15 +1694,43 @@ void SoftRenderer::DrawBG_3D()
 
 template<bool mosaic, SoftRenderer::DrawPixel drawPixel>
 void SoftRenderer::DrawBG_Text(u32 line, u32 bgnum)
+{
+    // pick a version of the tile loop specialised for this layer's configuration
+    bool bpp8 = CurUnit->BGCnt[bgnum] & 0x0080;
+    bool extpal = bpp8 && (CurUnit->DispCnt & 0x40000000);
+    bool window = !(WindowMaskCommon & (1<<bgnum));
+
+    if (bpp8)
+    {
+        if (extpal)
+        {
+            if (window) DrawBG_TextTiles<mosaic, drawPixel, true, true, true>(line, bgnum);
+            else        DrawBG_TextTiles<mosaic, drawPixel, true, true, false>(line, bgnum);
+        }
+        else
+        {
+            if (window) DrawBG_TextTiles<mosaic, drawPixel, true, false, true>(line, bgnum);
+            else        DrawBG_TextTiles<mosaic, drawPixel, true, false, false>(line, bgnum);
+        }
+    }
+    else
+    {
+        if (window) DrawBG_TextTiles<mosaic, drawPixel, false, false, true>(line, bgnum);
+        else        DrawBG_TextTiles<mosaic, drawPixel, false, false, false>(line, bgnum);
+    }
+}
+
+template<bool mosaic, SoftRenderer::DrawPixel drawPixel, bool bpp8, bool extpal, bool window>
+void SoftRenderer::DrawBG_TextTiles(u32 line, u32 bgnum)
 {
     u16 bgcnt = CurUnit->BGCnt[bgnum];
 
     u32 tilesetaddr, tilemapaddr;
     u16* pal;
-    u32 extpal, extpalslot;
+    u32 extpalslot;
 
-    u16 xoff = CurUnit->BGXPos[bgnum];
-    u16 yoff = CurUnit->BGYPos[bgnum] + line;
+    u16 xoff = CurRegs->BGXPos[bgnum];
+    u16 yoff = CurRegs->BGYPos[bgnum] + line;
 
     if (bgcnt & 0x0040)
     {
@@ -993,7 +1740,6 @@ void SoftRenderer::DrawBG_Text(u32 line, u32 bgnum)
 
     u32 widexmask = (bgcnt & 0x4000) ? 0x100 : 0;
 
-    extpal = (CurUnit->DispCnt & 0x40000000);
     if (extpal) extpalslot = ((bgnum<2) && (bgcnt&0x2000)) ? (2+bgnum) : bgnum;
 
     u8* bgvram;
@@ -1024,116 +1770,135 @@ void SoftRenderer::DrawBG_Text(u32 line, u32 bgnum)
     else
         tilemapaddr += ((yoff & 0xF8) << 3);
 
+    u32 winmask = 1 << bgnum;
+    u32 pixelflag = 0x01000000 << bgnum;
+
     u16 curtile;
     u16* curpal;
     u32 pixelsaddr;
     u8 color;
-    u32 lastxpos;
 
-    if (bgcnt & 0x0080)
+    if (!mosaic)
     {
-        // 256-color
-
-        // preload shit as needed
-        if ((xoff & 0x7) || mosaic)
+        // go one tile at a time, fetching the whole tile row at once
+        // tile rows are aligned, so they never straddle the VRAM mask
+        // 16-color tiles are read from the decoded tile cache
+        for (int i = 0; i < 256;)
         {
             curtile = *(u16*)&bgvram[(tilemapaddr + ((xoff & 0xF8) >> 2) + ((xoff & widexmask) << 3)) & bgvrammask];
 
-            if (extpal) curpal = CurUnit->GetBGExtPal(extpalslot, curtile>>12);
-            else        curpal = pal;
-
-            pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 6)
-                                     + (((curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7)) << 3);
-        }
-
-        if (mosaic) lastxpos = xoff;
-
-        for (int i = 0; i < 256; i++)
-        {
-            u32 xpos;
-            if (mosaic) xpos = xoff - CurBGXMosaicTable[i];
-            else        xpos = xoff;
+            u32 tilex = xoff & 0x7;
+            u32 count = std::min<u32>(8 - tilex, 256 - i);
+            u32 tiley = (curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7);
 
-            if ((!mosaic && (!(xpos & 0x7))) ||
-                (mosaic && ((xpos >> 3) != (lastxpos >> 3))))
+            u64 pixels;
+            if (bpp8)
             {
-                // load a new tile
-                curtile = *(u16*)&bgvram[(tilemapaddr + ((xpos & 0xF8) >> 2) + ((xpos & widexmask) << 3)) & bgvrammask];
+                pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 6) + (tiley << 3);
+                pixels = *(u64*)&bgvram[pixelsaddr & bgvrammask];
 
                 if (extpal) curpal = CurUnit->GetBGExtPal(extpalslot, curtile>>12);
                 else        curpal = pal;
+            }
+            else
+            {
+                pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 5) + (tiley << 2);
+                u8* tiles = DecodeTiles(BGTileCache, bgvram, bgvrammask, pixelsaddr, 4);
+                pixels = *(u64*)&tiles[(pixelsaddr & bgvrammask) << 1];
 
-                pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 6)
-                                         + (((curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7)) << 3);
-
-                if (mosaic) lastxpos = xpos;
+                curpal = pal + ((curtile & 0xF000) >> 8);
             }
 
-            // draw pixel
-            if (WindowMask[i] & (1<<bgnum))
+            // fully transparent tile rows are common, skip them
+            if (pixels)
             {
-                u32 tilexoff = (curtile & 0x0400) ? (7-(xpos&0x7)) : (xpos&0x7);
-                color = bgvram[(pixelsaddr + tilexoff) & bgvrammask];
+                for (u32 j = 0; j < count; j++)
+                {
+                    if (window && !(WindowMask[i+j] & winmask))
+                        continue;
 
-                if (color)
-                    drawPixel(&BGOBJLine[i], curpal[color], 0x01000000<<bgnum);
+                    u32 tilexoff = (curtile & 0x0400) ? (7-(tilex+j)) : (tilex+j);
+                    color = pixels >> (tilexoff << 3);
+
+                    if (color)
+                        drawPixel(&BGOBJLine[i+j], curpal[color], pixelflag);
+                }
             }
 
-            xoff++;
+            i += count;
+            xoff += count;
         }
+
+        return;
     }
-    else
+
+    u32 lastxpos = xoff;
+
+    // preload shit as needed
+    curtile = *(u16*)&bgvram[(tilemapaddr + ((xoff & 0xF8) >> 2) + ((xoff & widexmask) << 3)) & bgvrammask];
+    if (bpp8)
     {
-        // 16-color
+        if (extpal) curpal = CurUnit->GetBGExtPal(extpalslot, curtile>>12);
+        else        curpal = pal;
 
-        // preload shit as needed
-        if ((xoff & 0x7) || mosaic)
-        {
-            curtile = *(u16*)&bgvram[((tilemapaddr + ((xoff & 0xF8) >> 2) + ((xoff & widexmask) << 3))) & bgvrammask];
-            curpal = pal + ((curtile & 0xF000) >> 8);
-            pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 5)
-                                     + (((curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7)) << 2);
-        }
+        pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 6)
+                                 + (((curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7)) << 3);
+    }
+    else
+    {
+        curpal = pal + ((curtile & 0xF000) >> 8);
+        pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 5)
+                                 + (((curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7)) << 2);
+    }
 
-        if (mosaic) lastxpos = xoff;
+    for (int i = 0; i < 256; i++)
+    {
+        u32 xpos = xoff - CurBGXMosaicTable[i];
 
-        for (int i = 0; i < 256; i++)
+        if ((xpos >> 3) != (lastxpos >> 3))
         {
-            u32 xpos;
-            if (mosaic) xpos = xoff - CurBGXMosaicTable[i];
-            else        xpos = xoff;
+            // load a new tile
+            curtile = *(u16*)&bgvram[(tilemapaddr + ((xpos & 0xF8) >> 2) + ((xpos & widexmask) << 3)) & bgvrammask];
+            if (bpp8)
+            {
+                if (extpal) curpal = CurUnit->GetBGExtPal(extpalslot, curtile>>12);
+                else        curpal = pal;
 
-            if ((!mosaic && (!(xpos & 0x7))) ||
-                (mosaic && ((xpos >> 3) != (lastxpos >> 3))))
+                pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 6)
+                                         + (((curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7)) << 3);
+            }
+            else
             {
-                // load a new tile
-                curtile = *(u16*)&bgvram[(tilemapaddr + ((xpos & 0xF8) >> 2) + ((xpos & widexmask) << 3)) & bgvrammask];
                 curpal = pal + ((curtile & 0xF000) >> 8);
                 pixelsaddr = tilesetaddr + ((curtile & 0x03FF) << 5)
                                          + (((curtile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7)) << 2);
-
-                if (mosaic) lastxpos = xpos;
             }
 
-            // draw pixel
-            if (WindowMask[i] & (1<<bgnum))
-            {
-                u32 tilexoff = (curtile & 0x0400) ? (7-(xpos&0x7)) : (xpos&0x7);
-                if (tilexoff & 0x1)
-                {
-                    color = bgvram[(pixelsaddr + (tilexoff >> 1)) & bgvrammask] >> 4;
-                }
-                else
-                {
-                    color = bgvram[(pixelsaddr + (tilexoff >> 1)) & bgvrammask] & 0x0F;
-                }
+            lastxpos = xpos;
+        }
 
-                if (color)
-                    drawPixel(&BGOBJLine[i], curpal[color], 0x01000000<<bgnum);
+        // draw pixel
+        if (!window || (WindowMask[i] & winmask))
+        {
+            u32 tilexoff = (curtile & 0x0400) ? (7-(xpos&0x7)) : (xpos&0x7);
+            if (bpp8)
+            {
+                color = bgvram[(pixelsaddr + tilexoff) & bgvrammask];
+            }
+            else if (tilexoff & 0x1)
+            {
+                color = bgvram[(pixelsaddr + (tilexoff >> 1)) & bgvrammask] >> 4;
+            }
+            else
+            {
+                color = bgvram[(pixelsaddr + (tilexoff >> 1)) & bgvrammask] & 0x0F;
             }
 
-            xoff++;
+            if (color)
+                drawPixel(&BGOBJLine[i], curpal[color], pixelflag);
         }
+
+        xoff++;
     }
 }
 
@@ -1159,10 +1924,10 @@ void SoftRenderer::DrawBG_Affine(u32 line, u32 bgnum)
     if (bgcnt & 0x2000) overflowmask = 0;
     else                overflowmask = ~(coordmask | 0x7FF);
 
-    s16 rotA = CurUnit->BGRotA[bgnum-2];
-    s16 rotB = CurUnit->BGRotB[bgnum-2];
-    s16 rotC = CurUnit->BGRotC[bgnum-2];
-    s16 rotD = CurUnit->BGRotD[bgnum-2];
+    s16 rotA = CurRegs->BGRotA[bgnum-2];
+    s16 rotB = CurRegs->BGRotB[bgnum-2];
+    s16 rotC = CurRegs->BGRotC[bgnum-2];
+    s16 rotD = CurRegs->BGRotD[bgnum-2];
 
     s32 rotX = CurUnit->BGXRefInternal[bgnum-2];
     s32 rotY = CurUnit->BGYRefInternal[bgnum-2];
@@ -1253,10 +2018,10 @@ void SoftRenderer::DrawBG_Extended(u32 line, u32 bgnum)
 
     extpal = (CurUnit->DispCnt & 0x40000000);
 
-    s16 rotA = CurUnit->BGRotA[bgnum-2];
-    s16 rotB = CurUnit->BGRotB[bgnum-2];
-    s16 rotC = CurUnit->BGRotC[bgnum-2];
-    s16 rotD = CurUnit->BGRotD[bgnum-2];
+    s16 rotA = CurRegs->BGRotA[bgnum-2];
+    s16 rotB = CurRegs->BGRotB[bgnum-2];
+    s16 rotC = CurRegs->BGRotC[bgnum-2];
+    s16 rotD = CurRegs->BGRotD[bgnum-2];
 
     s32 rotX = CurUnit->BGXRefInternal[bgnum-2];
     s32 rotY = CurUnit->BGYRefInternal[bgnum-2];
@@ -1493,10 +2258,10 @@ void SoftRenderer::DrawBG_Large(u32 line) // BG is always BG2
         ofymask = ~ymask;
     }
 
-    s16 rotA = CurUnit->BGRotA[0];
-    s16 rotB = CurUnit->BGRotB[0];
-    s16 rotC = CurUnit->BGRotC[0];
-    s16 rotD = CurUnit->BGRotD[0];
+    s16 rotA = CurRegs->BGRotA[0];
+    s16 rotB = CurRegs->BGRotB[0];
+    s16 rotC = CurRegs->BGRotC[0];
+    s16 rotD = CurRegs->BGRotD[0];
 
     s32 rotX = CurUnit->BGXRefInternal[0];
     s32 rotY = CurUnit->BGYRefInternal[0];
@@ -1565,12 +2330,12 @@ void SoftRenderer::ApplySpriteMosaicX()
     // apply X mosaic if needed
     // X mosaic for sprites is applied after all sprites are rendered
 
-    if (CurUnit->OBJMosaicSize[0] == 0) return;
+    if (CurRegs->OBJMosaicSize[0] == 0) return;
 
     u32* objLine = OBJLine[CurUnit->Num];
     u8* objIndex = OBJIndex[CurUnit->Num];
 
-    u8* curOBJXMosaicTable = MosaicTable[CurUnit->OBJMosaicSize[1]];
+    u8* curOBJXMosaicTable = MosaicTable[CurRegs->OBJMosaicSize[1]];
 
     u32 lastcolor = objLine[0];
 
@@ -1649,7 +2414,7 @@ void SoftRenderer::InterleaveSprites(u32 prio)
         DrawSprite_##type<false>(__VA_ARGS__); \
     }
 
-void SoftRenderer::DrawSprites(u32 line, Unit* unit)
+void SoftRenderer::DoDrawSprites(u32 line, Unit* unit)
 {
     CurUnit = unit;
 
@@ -1665,15 +2430,22 @@ void SoftRenderer::DrawSprites(u32 line, Unit* unit)
         CurUnit->OBJMosaicYCount = 0;
     }
 
-    if (CurUnit->Num == 0)
+    if (OBJVRAMGeneration != GPU::VRAMGeneration)
     {
-        auto objDirty = GPU::VRAMDirty_AOBJ.DeriveState(GPU::VRAMMap_AOBJ);
-        GPU::MakeVRAMFlat_AOBJCoherent(objDirty);
-    }
-    else
-    {
-        auto objDirty = GPU::VRAMDirty_BOBJ.DeriveState(GPU::VRAMMap_BOBJ);
-        GPU::MakeVRAMFlat_BOBJCoherent(objDirty);
+        OBJVRAMGeneration = GPU::VRAMGeneration;
+
+        if (CurUnit->Num == 0)
+        {
+            auto objDirty = GPU::VRAMDirty_AOBJ.DeriveState(GPU::VRAMMap_AOBJ);
+            GPU::MakeVRAMFlat_AOBJCoherent(objDirty);
+            InvalidateTileCache(OBJTileCache, objDirty);
+        }
+        else
+        {
+            auto objDirty = GPU::VRAMDirty_BOBJ.DeriveState(GPU::VRAMMap_BOBJ);
+            GPU::MakeVRAMFlat_BOBJCoherent(objDirty);
+            InvalidateTileCache(OBJTileCache, objDirty);
+        }
     }
 
     NumSprites[CurUnit->Num] = 0;
@@ -1683,6 +2455,50 @@ void SoftRenderer::DrawSprites(u32 line, Unit* unit)
 
     memset(OBJIndex, 0xFF, 256);
 
+    if (SpriteListUnit != CurUnit->Num || SpriteListGeneration != GPU::OAMGeneration[CurUnit->Num])
+        BuildSpriteList();
+
+    // sprites with Y mosaic are looked up at the mosaic line instead
+    u32 mosaicline = CurUnit->OBJMosaicY;
+
+    for (int i = 0; i < 2; i++)
+    {
+        u64 mask = (SpriteLineMask[line & 0xFF][i] & ~MosaicSpriteMask[i]) |
+                   (SpriteLineMask[mosaicline][i] & MosaicSpriteMask[i]);
+
+        while (mask)
+        {
+            SpriteEntry& sprite = SpriteList[(i << 6) + __builtin_ctzll(mask)];
+            mask &= mask - 1;
+
+            bool iswin = sprite.Window;
+
+            u32 sprline = sprite.Mosaic ? mosaicline : line;
+            u32 ypos = (sprline - sprite.YPos) & 0xFF;
+
+            if (sprite.Rotscale)
+            {
+                DoDrawSprite(Rotscale, sprite.Num, sprite.BoundWidth, sprite.BoundHeight, sprite.Width, sprite.Height, sprite.XPos, ypos);
+            }
+            else
+            {
+                DoDrawSprite(Normal, sprite.Num, sprite.Width, sprite.Height, sprite.XPos, ypos);
+            }
+
+            NumSprites[CurUnit->Num]++;
+        }
+    }
+}
+
+void SoftRenderer::BuildSpriteList()
+{
+    SpriteListUnit = CurUnit->Num;
+    SpriteListGeneration = GPU::OAMGeneration[CurUnit->Num];
+
+    memset(SpriteLineMask, 0, sizeof(SpriteLineMask));
+    MosaicSpriteMask[0] = 0;
+    MosaicSpriteMask[1] = 0;
+
     u16* oam = (u16*)&GPU::OAM[CurUnit->Num ? 0x400 : 0];
 
     const s32 spritewidth[16] =
@@ -1700,6 +2516,8 @@ void SoftRenderer::DrawSprites(u32 line, Unit* unit)
         64, 32, 64, 8
     };
 
+    u32 count = 0;
+
     for (int bgnum = 0x0C00; bgnum >= 0x0000; bgnum -= 0x0400)
     {
         for (int sprnum = 127; sprnum >= 0; sprnum--)
@@ -1709,68 +2527,48 @@ void SoftRenderer::DrawSprites(u32 line, Unit* unit)
             if ((attrib[2] & 0x0C00) != bgnum)
                 continue;
 
-            bool iswin = (((attrib[0] >> 10) & 0x3) == 2);
+            bool rotscale = attrib[0] & 0x0100;
+            if (!rotscale && (attrib[0] & 0x0200))
+                continue;
 
-            u32 sprline;
-            if ((attrib[0] & 0x1000) && !iswin)
-            {
-                // apply Y mosaic
-                sprline = CurUnit->OBJMosaicY;
-            }
-            else
-                sprline = line;
+            u32 sizeparam = (attrib[0] >> 14) | ((attrib[1] & 0xC000) >> 12);
+            s32 width = spritewidth[sizeparam];
+            s32 height = spriteheight[sizeparam];
+            s32 boundwidth = width;
+            s32 boundheight = height;
 
-            if (attrib[0] & 0x0100)
+            if (rotscale && (attrib[0] & 0x0200))
             {
-                u32 sizeparam = (attrib[0] >> 14) | ((attrib[1] & 0xC000) >> 12);
-                s32 width = spritewidth[sizeparam];
-                s32 height = spriteheight[sizeparam];
-                s32 boundwidth = width;
-                s32 boundheight = height;
-
-                if (attrib[0] & 0x0200)
-                {
-                    boundwidth <<= 1;
-                    boundheight <<= 1;
-                }
-
-                u32 ypos = attrib[0] & 0xFF;
-                ypos = (sprline - ypos) & 0xFF;
-                if (ypos >= (u32)boundheight)
-                    continue;
-
-                s32 xpos = (s32)(attrib[1] << 23) >> 23;
-                if (xpos <= -boundwidth)
-                    continue;
-
-                u32 rotparamgroup = (attrib[1] >> 9) & 0x1F;
-
-                DoDrawSprite(Rotscale, sprnum, boundwidth, boundheight, width, height, xpos, ypos);
-
-                NumSprites[CurUnit->Num]++;
+                boundwidth <<= 1;
+                boundheight <<= 1;
             }
-            else
-            {
-                if (attrib[0] & 0x0200)
-                    continue;
 
-                u32 sizeparam = (attrib[0] >> 14) | ((attrib[1] & 0xC000) >> 12);
-                s32 width = spritewidth[sizeparam];
-                s32 height = spriteheight[sizeparam];
+            s32 xpos = (s32)(attrib[1] << 23) >> 23;
+            if (xpos <= -boundwidth)
+                continue;
+
+            bool iswin = (((attrib[0] >> 10) & 0x3) == 2);
 
-                u32 ypos = attrib[0] & 0xFF;
-                ypos = (sprline - ypos) & 0xFF;
-                if (ypos >= (u32)height)
-                    continue;
+            SpriteEntry& sprite = SpriteList[count];
+            sprite.Num = sprnum;
+            sprite.Rotscale = rotscale;
+            sprite.Window = iswin;
+            sprite.Mosaic = (attrib[0] & 0x1000) && !iswin;
+            sprite.XPos = xpos;
+            sprite.YPos = attrib[0] & 0xFF;
+            sprite.Width = width;
+            sprite.Height = height;
+            sprite.BoundWidth = boundwidth;
+            sprite.BoundHeight = boundheight;
 
-                s32 xpos = (s32)(attrib[1] << 23) >> 23;
-                if (xpos <= -width)
-                    continue;
+            u64 bit = 1ULL << (count & 63);
+            for (s32 y = 0; y < boundheight; y++)
+                SpriteLineMask[(sprite.YPos + y) & 0xFF][count >> 6] |= bit;
 
-                DoDrawSprite(Normal, sprnum, width, height, xpos, ypos);
+            if (sprite.Mosaic)
+                MosaicSpriteMask[count >> 6] |= bit;
 
-                NumSprites[CurUnit->Num]++;
-            }
+            count++;
         }
     }
 }
@@ -1963,15 +2761,18 @@ void SoftRenderer::DrawSprite_Rotscale(u32 num, u32 boundwidth, u32 boundheight,
                 pixelattr |= ((attrib[2] & 0xF000) >> 8);
             }
 
+            // the sprite can be sampled anywhere, so get all of its tiles decoded
+            u8* tiles = DecodeTiles(OBJTileCache, objvram, objvrammask, pixelsaddr,
+                                    ((height >> 11) - 1) * ytilefactor + (width >> 11) * 32);
+            u32 tilesmask = (objvrammask << 1) | 1;
+            pixelsaddr <<= 1;
+            ytilefactor <<= 1;
+
             for (; xoff < boundwidth;)
             {
                 if ((u32)rotX < width && (u32)rotY < height)
                 {
-                    color = objvram[(pixelsaddr + ((rotY>>11)*ytilefactor) + ((rotY&0x700)>>6) + ((rotX>>11)*32) + ((rotX&0x700)>>9)) & objvrammask];
-                    if (rotX & 0x100)
-                        color >>= 4;
-                    else
-                        color &= 0x0F;
+                    color = tiles[(pixelsaddr + ((rotY>>11)*ytilefactor) + ((rotY&0x700)>>5) + ((rotX>>11)*64) + ((rotX&0x700)>>8)) & tilesmask];
 
                     if (color)
                     {
@@ -2205,36 +3006,31 @@ void SoftRenderer::DrawSprite_Normal(u32 num, u32 width, u32 height, s32 xpos, s
                 pixelattr |= ((attrib[2] & 0xF000) >> 8);
             }
 
-            // TODO: optimize VRAM access!!
-            // TODO: do xflip better? the 'two pixels per byte' thing makes it a bit shitty
+            // the decoded tiles are laid out like 256-color ones
+            u8* tiles = DecodeTiles(OBJTileCache, objvram, objvrammask, pixelsaddr, ((width >> 3) - 1) * 32 + 4);
+            u32 tilesmask = (objvrammask << 1) | 1;
+            pixelsaddr <<= 1;
 
             if (attrib[1] & 0x1000) // xflip
             {
-                pixelsaddr += (((width-1) & wmask) << 2);
-                pixelsaddr += (((width-1) & 0x7) >> 1);
-                pixelsaddr -= ((xoff & wmask) << 2);
-                pixelsaddr -= ((xoff & 0x7) >> 1);
+                pixelsaddr += (((width-1) & wmask) << 3);
+                pixelsaddr += ((width-1) & 0x7);
+                pixelsaddr -= ((xoff & wmask) << 3);
+                pixelsaddr -= (xoff & 0x7);
                 pixelstride = -1;
             }
             else
             {
-                pixelsaddr += ((xoff & wmask) << 2);
-                pixelsaddr += ((xoff & 0x7) >> 1);
+                pixelsaddr += ((xoff & wmask) << 3);
+                pixelsaddr += (xoff & 0x7);
                 pixelstride = 1;
             }
 
             for (; xoff < xend;)
             {
-                if (attrib[1] & 0x1000)
-                {
-                    if (xoff & 0x1) { color = objvram[pixelsaddr & objvrammask] & 0x0F; pixelsaddr--; }
-                    else              color = objvram[pixelsaddr & objvrammask] >> 4;
-                }
-                else
-                {
-                    if (xoff & 0x1) { color = objvram[pixelsaddr & objvrammask] >> 4; pixelsaddr++; }
-                    else              color = objvram[pixelsaddr & objvrammask] & 0x0F;
-                }
+                color = tiles[pixelsaddr & tilesmask];
+
+                pixelsaddr += pixelstride;
 
                 if (color)
                 {
@@ -2252,7 +3048,7 @@ void SoftRenderer::DrawSprite_Normal(u32 num, u32 width, u32 height, s32 xpos, s
 
                 xoff++;
                 xpos++;
-                if (!(xoff & 0x7)) pixelsaddr += ((attrib[1] & 0x1000) ? -28 : 28);
+                if (!(xoff & 0x7)) pixelsaddr += (56 * pixelstride);
             }
         }
     }
@@ -19,6 +19,15 @@
 #pragma once
 
 #include "GPU2D.h"
+#include "GPU.h"
+#include "Platform.h"
+#include <atomic>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 namespace GPU2D
 {
@@ -27,16 +36,55 @@ class SoftRenderer : public Renderer2D
 {
 public:
     SoftRenderer();
-    ~SoftRenderer() override {}
+    ~SoftRenderer() override;
 
     void DrawScanline(u32 line, Unit* unit) override;
     void DrawSprites(u32 line, Unit* unit) override;
     void VBlankEnd(Unit* unitA, Unit* unitB) override;
+
+    void SetRenderSettings(GPU::RenderSettings& settings) override;
+    void Sync() override;
 private:
-    alignas(8) u32 BGOBJLine[256*3];
+    // each engine gets its own renderer, so the scratch buffers aren't shared between them
+    // when threaded, scanlines are drawn on a separate thread, in the order they were queued
+    // the emulator thread waits for them to be done before modifying anything they read from,
+    // save for the registers that change between scanlines, which are copied along with each one
+    struct DrawCommand
+    {
+        Unit* Target;
+        bool Sprites;
+        u16 Line;
+        u16 VCount;
+        Unit::LineRegisters Regs;
+    };
+
+    static constexpr u32 DrawQueueSize = 1024;
+    DrawCommand DrawQueue[DrawQueueSize];
+    u32 DrawQueueWritePos;
+    u32 DrawQueueReadPos;
+    u32 NumQueuedCommands;
+
+    bool Threaded;
+    Platform::Thread* RenderThread;
+    std::atomic_bool RenderThreadRunning;
+    Platform::Semaphore* Sema_DrawStart;
+    Platform::Semaphore* Sema_DrawDone;
+
+    void SetupRenderThread();
+    void StopRenderThread();
+    void RenderThreadFunc();
+    void QueueCommand(bool sprites, u32 line, Unit* unit);
+
+    void DoDrawScanline(u32 line, u32 vcount, Unit* unit, Unit::LineRegisters& regs);
+    void DoDrawSprites(u32 line, Unit* unit);
+
+    Unit::LineRegisters* CurRegs;
+
+    alignas(16) u32 BGOBJLine[256*3];
     u32* _3DLine;
 
     alignas(8) u8 WindowMask[256];
+    u8 WindowMaskCommon; // bits set for every pixel of WindowMask
 
     alignas(8) u32 OBJLine[2][256];
     alignas(8) u8 OBJIndex[2][256];
@@ -44,6 +92,47 @@ private:
 
     u32 NumSprites[2];
 
+    // sprites that can show up on screen, in drawing order, with their attributes decoded
+    // rebuilt whenever OAM changes, each scanline then only visits the sprites covering it
+    struct SpriteEntry
+    {
+        u8 Num;
+        bool Rotscale;
+        bool Window;
+        bool Mosaic;
+        s16 XPos;
+        u8 YPos;
+        u8 Width, Height;
+        u8 BoundWidth, BoundHeight;
+    };
+
+    SpriteEntry SpriteList[128];
+    u64 SpriteLineMask[256][2];
+    u64 MosaicSpriteMask[2];
+    u32 SpriteListUnit;
+    u32 SpriteListGeneration;
+
+    // VRAM generation the flat BG and OBJ VRAM copies were last updated at
+    u32 BGVRAMGeneration;
+    u32 OBJVRAMGeneration;
+
+    // 4bpp tile graphics expanded to one byte per pixel, so they can be read like 256-color ones
+    // VRAM is decoded 512 bytes at a time when first used, and again once it's marked dirty
+    template <u32 Size>
+    struct DecodedTileCache
+    {
+        alignas(8) u8 Data[Size * 2];
+        NonStupidBitField<Size/GPU::VRAMDirtyGranularity> Valid;
+    };
+
+    DecodedTileCache<512*1024> BGTileCache;
+    DecodedTileCache<256*1024> OBJTileCache;
+
+    template <u32 Size>
+    u8* DecodeTiles(DecodedTileCache<Size>& cache, u8* vram, u32 vrammask, u32 addr, u32 len);
+    template <u32 Size, u32 DirtySize>
+    void InvalidateTileCache(DecodedTileCache<Size>& cache, NonStupidBitField<DirtySize>& dirty);
+
     u8* CurBGXMosaicTable;
     u8 MosaicTable[16][256];
 
@@ -52,6 +141,7 @@ private:
     u32 ColorBrightnessUp(u32 val, u32 factor);
     u32 ColorBrightnessDown(u32 val, u32 factor);
     u32 ColorComposite(int i, u32 val1, u32 val2);
+    void ColorCompositeLine();
 
     template<u32 bgmode> void DrawScanlineBGMode(u32 line);
     void DrawScanlineBGMode6(u32 line);
@@ -65,10 +155,12 @@ private:
 
     void DrawBG_3D();
     template<bool mosaic, DrawPixel drawPixel> void DrawBG_Text(u32 line, u32 bgnum);
+    template<bool mosaic, DrawPixel drawPixel, bool bpp8, bool extpal, bool window> void DrawBG_TextTiles(u32 line, u32 bgnum);
     template<bool mosaic, DrawPixel drawPixel> void DrawBG_Affine(u32 line, u32 bgnum);
     template<bool mosaic, DrawPixel drawPixel> void DrawBG_Extended(u32 line, u32 bgnum);
     template<bool mosaic, DrawPixel drawPixel> void DrawBG_Large(u32 line);
 
+    void BuildSpriteList();
     void ApplySpriteMosaicX();
     template<DrawPixel drawPixel>
     void InterleaveSprites(u32 prio);
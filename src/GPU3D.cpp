@@ -19,6 +19,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 #include "NDS.h"
 #include "GPU.h"
 #include "FIFO.h"
@@ -192,6 +197,8 @@ u32 ExecParamCount;
 
 u64 Timestamp;
 s32 CycleCount;
+bool RunningBatch;
+bool FIFOCheckPending;
 s32 VertexPipeline;
 s32 NormalPipeline;
 s32 PolygonPipeline;
@@ -224,6 +231,7 @@ s32 TexMatrixStackPointer;
 
 void MatrixLoadIdentity(s32* m);
 void UpdateClipMatrix();
+void SetupMathFuncs();
 
 
 u32 PolygonMode;
@@ -277,6 +285,8 @@ std::unique_ptr<GPU3D::Renderer3D> CurrentRenderer = {};
 
 bool Init()
 {
+    SetupMathFuncs();
+
     return true;
 }
 
@@ -330,6 +340,8 @@ void Reset()
 
     Timestamp = 0;
     CycleCount = 0;
+    RunningBatch = false;
+    FIFOCheckPending = false;
     VertexPipeline = 0;
     NormalPipeline = 0;
     PolygonPipeline = 0;
@@ -635,6 +647,197 @@ void SetEnabled(bool geometry, bool rendering)
 
 
 
+// fixed point matrix products, used for the matrix commands and vertex transforms.
+// each of the numout output rows is the sum of the four rows of 'rows',
+// weighted by the four coefficients for that row, shifted down by 12.
+// the products are 64-bit, only the low 32 bits of the result are kept
+// so it doesn't matter whether the final shift is arithmetic or logical.
+// out may not overlap rows.
+
+void MatrixProduct_Scalar(s32* out, const s32* coefs, int numout, const s32* rows)
+{
+    for (int r = 0; r < numout; r++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            s64 sum = 0;
+            for (int k = 0; k < 4; k++)
+                sum += (s64)coefs[r*4 + k] * rows[k*4 + j];
+            out[r*4 + j] = sum >> 12;
+        }
+    }
+}
+
+// the normal is transformed and dotted with all four light directions at once
+// these are done with 32-bit products, like on hardware
+void LightingProducts_Scalar(s32* normaltrans, s32* diffdot, s32* shinedot)
+{
+    normaltrans[0] = (Normal[0]*VecMatrix[0] + Normal[1]*VecMatrix[4] + Normal[2]*VecMatrix[8]) >> 12;
+    normaltrans[1] = (Normal[0]*VecMatrix[1] + Normal[1]*VecMatrix[5] + Normal[2]*VecMatrix[9]) >> 12;
+    normaltrans[2] = (Normal[0]*VecMatrix[2] + Normal[1]*VecMatrix[6] + Normal[2]*VecMatrix[10]) >> 12;
+
+    for (int i = 0; i < 4; i++)
+    {
+        diffdot[i] = LightDirection[i][0]*normaltrans[0] +
+                     LightDirection[i][1]*normaltrans[1] +
+                     LightDirection[i][2]*normaltrans[2];
+
+        shinedot[i] = (LightDirection[i][0]>>1)*normaltrans[0] +
+                      (LightDirection[i][1]>>1)*normaltrans[1] +
+                      ((LightDirection[i][2]-0x200)>>1)*normaltrans[2];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse4.1")))
+void MatrixProduct_SSE41(s32* out, const s32* coefs, int numout, const s32* rows)
+{
+    __m128i row[4], rowodd[4];
+    for (int k = 0; k < 4; k++)
+    {
+        row[k] = _mm_loadu_si128((__m128i*)&rows[k*4]);
+        rowodd[k] = _mm_srli_epi64(row[k], 32);
+    }
+
+    for (int r = 0; r < numout; r++)
+    {
+        // columns 0 and 2 in even, 1 and 3 in odd
+        __m128i even = _mm_setzero_si128();
+        __m128i odd = _mm_setzero_si128();
+        for (int k = 0; k < 4; k++)
+        {
+            __m128i coef = _mm_set1_epi32(coefs[r*4 + k]);
+            even = _mm_add_epi64(even, _mm_mul_epi32(row[k], coef));
+            odd = _mm_add_epi64(odd, _mm_mul_epi32(rowodd[k], coef));
+        }
+
+        even = _mm_and_si128(_mm_srli_epi64(even, 12), _mm_set1_epi64x(0xFFFFFFFF));
+        odd = _mm_slli_epi64(_mm_srli_epi64(odd, 12), 32);
+        _mm_storeu_si128((__m128i*)&out[r*4], _mm_or_si128(even, odd));
+    }
+}
+
+__attribute__((target("avx2")))
+void MatrixProduct_AVX2(s32* out, const s32* coefs, int numout, const s32* rows)
+{
+    __m256i row[4];
+    for (int k = 0; k < 4; k++)
+        row[k] = _mm256_cvtepi32_epi64(_mm_loadu_si128((__m128i*)&rows[k*4]));
+
+    const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    for (int r = 0; r < numout; r++)
+    {
+        __m256i sum = _mm256_setzero_si256();
+        for (int k = 0; k < 4; k++)
+            sum = _mm256_add_epi64(sum, _mm256_mul_epi32(row[k], _mm256_set1_epi32(coefs[r*4 + k])));
+
+        sum = _mm256_permutevar8x32_epi32(_mm256_srli_epi64(sum, 12), pack);
+        _mm_storeu_si128((__m128i*)&out[r*4], _mm256_castsi256_si128(sum));
+    }
+}
+
+__attribute__((target("sse4.1")))
+void LightingProducts_SSE41(s32* normaltrans, s32* diffdot, s32* shinedot)
+{
+    __m128i trans = _mm_setzero_si128();
+    for (int k = 0; k < 3; k++)
+        trans = _mm_add_epi32(trans, _mm_mullo_epi32(_mm_loadu_si128((__m128i*)&VecMatrix[k*4]), _mm_set1_epi32(Normal[k])));
+    trans = _mm_srai_epi32(trans, 12);
+
+    alignas(16) s32 res[4];
+    _mm_store_si128((__m128i*)res, trans);
+    normaltrans[0] = res[0];
+    normaltrans[1] = res[1];
+    normaltrans[2] = res[2];
+
+    __m128i diff = _mm_setzero_si128();
+    __m128i shine = _mm_setzero_si128();
+    for (int k = 0; k < 3; k++)
+    {
+        __m128i dir = _mm_setr_epi32(LightDirection[0][k], LightDirection[1][k], LightDirection[2][k], LightDirection[3][k]);
+        __m128i n = _mm_set1_epi32(normaltrans[k]);
+
+        diff = _mm_add_epi32(diff, _mm_mullo_epi32(dir, n));
+        if (k == 2) dir = _mm_sub_epi32(dir, _mm_set1_epi32(0x200));
+        shine = _mm_add_epi32(shine, _mm_mullo_epi32(_mm_srai_epi32(dir, 1), n));
+    }
+
+    _mm_storeu_si128((__m128i*)diffdot, diff);
+    _mm_storeu_si128((__m128i*)shinedot, shine);
+}
+
+#elif defined(__aarch64__)
+
+void MatrixProduct_NEON(s32* out, const s32* coefs, int numout, const s32* rows)
+{
+    int32x4_t row[4];
+    for (int k = 0; k < 4; k++)
+        row[k] = vld1q_s32(&rows[k*4]);
+
+    for (int r = 0; r < numout; r++)
+    {
+        int64x2_t lo = vdupq_n_s64(0);
+        int64x2_t hi = vdupq_n_s64(0);
+        for (int k = 0; k < 4; k++)
+        {
+            lo = vmlal_n_s32(lo, vget_low_s32(row[k]), coefs[r*4 + k]);
+            hi = vmlal_n_s32(hi, vget_high_s32(row[k]), coefs[r*4 + k]);
+        }
+
+        vst1q_s32(&out[r*4], vcombine_s32(vmovn_s64(vshrq_n_s64(lo, 12)), vmovn_s64(vshrq_n_s64(hi, 12))));
+    }
+}
+
+void LightingProducts_NEON(s32* normaltrans, s32* diffdot, s32* shinedot)
+{
+    int32x4_t trans = vdupq_n_s32(0);
+    for (int k = 0; k < 3; k++)
+        trans = vmlaq_n_s32(trans, vld1q_s32(&VecMatrix[k*4]), Normal[k]);
+    trans = vshrq_n_s32(trans, 12);
+
+    normaltrans[0] = vgetq_lane_s32(trans, 0);
+    normaltrans[1] = vgetq_lane_s32(trans, 1);
+    normaltrans[2] = vgetq_lane_s32(trans, 2);
+
+    int32x4_t diff = vdupq_n_s32(0);
+    int32x4_t shine = vdupq_n_s32(0);
+    for (int k = 0; k < 3; k++)
+    {
+        int32x4_t dir = {LightDirection[0][k], LightDirection[1][k], LightDirection[2][k], LightDirection[3][k]};
+
+        diff = vmlaq_n_s32(diff, dir, normaltrans[k]);
+        if (k == 2) dir = vsubq_s32(dir, vdupq_n_s32(0x200));
+        shine = vmlaq_n_s32(shine, vshrq_n_s32(dir, 1), normaltrans[k]);
+    }
+
+    vst1q_s32(diffdot, diff);
+    vst1q_s32(shinedot, shine);
+}
+
+#endif
+
+void (*MatrixProduct)(s32* out, const s32* coefs, int numout, const s32* rows) = MatrixProduct_Scalar;
+void (*LightingProducts)(s32* normaltrans, s32* diffdot, s32* shinedot) = LightingProducts_Scalar;
+
+void SetupMathFuncs()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        MatrixProduct = MatrixProduct_AVX2;
+    else if (__builtin_cpu_supports("sse4.1"))
+        MatrixProduct = MatrixProduct_SSE41;
+
+    if (__builtin_cpu_supports("sse4.1"))
+        LightingProducts = LightingProducts_SSE41;
+#elif defined(__aarch64__)
+    MatrixProduct = MatrixProduct_NEON;
+    LightingProducts = LightingProducts_NEON;
+#endif
+}
+
+
 void MatrixLoadIdentity(s32* m)
 {
     m[0] = 0x1000; m[1] = 0;      m[2] = 0;       m[3] = 0;
@@ -662,25 +865,7 @@ void MatrixMult4x4(s32* m, s32* s)
     memcpy(tmp, m, 16*4);
 
     // m = s*m
-    m[0] = ((s64)s[0]*tmp[0] + (s64)s[1]*tmp[4] + (s64)s[2]*tmp[8] + (s64)s[3]*tmp[12]) >> 12;
-    m[1] = ((s64)s[0]*tmp[1] + (s64)s[1]*tmp[5] + (s64)s[2]*tmp[9] + (s64)s[3]*tmp[13]) >> 12;
-    m[2] = ((s64)s[0]*tmp[2] + (s64)s[1]*tmp[6] + (s64)s[2]*tmp[10] + (s64)s[3]*tmp[14]) >> 12;
-    m[3] = ((s64)s[0]*tmp[3] + (s64)s[1]*tmp[7] + (s64)s[2]*tmp[11] + (s64)s[3]*tmp[15]) >> 12;
-
-    m[4] = ((s64)s[4]*tmp[0] + (s64)s[5]*tmp[4] + (s64)s[6]*tmp[8] + (s64)s[7]*tmp[12]) >> 12;
-    m[5] = ((s64)s[4]*tmp[1] + (s64)s[5]*tmp[5] + (s64)s[6]*tmp[9] + (s64)s[7]*tmp[13]) >> 12;
-    m[6] = ((s64)s[4]*tmp[2] + (s64)s[5]*tmp[6] + (s64)s[6]*tmp[10] + (s64)s[7]*tmp[14]) >> 12;
-    m[7] = ((s64)s[4]*tmp[3] + (s64)s[5]*tmp[7] + (s64)s[6]*tmp[11] + (s64)s[7]*tmp[15]) >> 12;
-
-    m[8] = ((s64)s[8]*tmp[0] + (s64)s[9]*tmp[4] + (s64)s[10]*tmp[8] + (s64)s[11]*tmp[12]) >> 12;
-    m[9] = ((s64)s[8]*tmp[1] + (s64)s[9]*tmp[5] + (s64)s[10]*tmp[9] + (s64)s[11]*tmp[13]) >> 12;
-    m[10] = ((s64)s[8]*tmp[2] + (s64)s[9]*tmp[6] + (s64)s[10]*tmp[10] + (s64)s[11]*tmp[14]) >> 12;
-    m[11] = ((s64)s[8]*tmp[3] + (s64)s[9]*tmp[7] + (s64)s[10]*tmp[11] + (s64)s[11]*tmp[15]) >> 12;
-
-    m[12] = ((s64)s[12]*tmp[0] + (s64)s[13]*tmp[4] + (s64)s[14]*tmp[8] + (s64)s[15]*tmp[12]) >> 12;
-    m[13] = ((s64)s[12]*tmp[1] + (s64)s[13]*tmp[5] + (s64)s[14]*tmp[9] + (s64)s[15]*tmp[13]) >> 12;
-    m[14] = ((s64)s[12]*tmp[2] + (s64)s[13]*tmp[6] + (s64)s[14]*tmp[10] + (s64)s[15]*tmp[14]) >> 12;
-    m[15] = ((s64)s[12]*tmp[3] + (s64)s[13]*tmp[7] + (s64)s[14]*tmp[11] + (s64)s[15]*tmp[15]) >> 12;
+    MatrixProduct(m, s, 4, tmp);
 }
 
 void MatrixMult4x3(s32* m, s32* s)
@@ -689,47 +874,29 @@ void MatrixMult4x3(s32* m, s32* s)
     memcpy(tmp, m, 16*4);
 
     // m = s*m
-    m[0] = ((s64)s[0]*tmp[0] + (s64)s[1]*tmp[4] + (s64)s[2]*tmp[8]) >> 12;
-    m[1] = ((s64)s[0]*tmp[1] + (s64)s[1]*tmp[5] + (s64)s[2]*tmp[9]) >> 12;
-    m[2] = ((s64)s[0]*tmp[2] + (s64)s[1]*tmp[6] + (s64)s[2]*tmp[10]) >> 12;
-    m[3] = ((s64)s[0]*tmp[3] + (s64)s[1]*tmp[7] + (s64)s[2]*tmp[11]) >> 12;
-
-    m[4] = ((s64)s[3]*tmp[0] + (s64)s[4]*tmp[4] + (s64)s[5]*tmp[8]) >> 12;
-    m[5] = ((s64)s[3]*tmp[1] + (s64)s[4]*tmp[5] + (s64)s[5]*tmp[9]) >> 12;
-    m[6] = ((s64)s[3]*tmp[2] + (s64)s[4]*tmp[6] + (s64)s[5]*tmp[10]) >> 12;
-    m[7] = ((s64)s[3]*tmp[3] + (s64)s[4]*tmp[7] + (s64)s[5]*tmp[11]) >> 12;
-
-    m[8] = ((s64)s[6]*tmp[0] + (s64)s[7]*tmp[4] + (s64)s[8]*tmp[8]) >> 12;
-    m[9] = ((s64)s[6]*tmp[1] + (s64)s[7]*tmp[5] + (s64)s[8]*tmp[9]) >> 12;
-    m[10] = ((s64)s[6]*tmp[2] + (s64)s[7]*tmp[6] + (s64)s[8]*tmp[10]) >> 12;
-    m[11] = ((s64)s[6]*tmp[3] + (s64)s[7]*tmp[7] + (s64)s[8]*tmp[11]) >> 12;
-
-    m[12] = ((s64)s[9]*tmp[0] + (s64)s[10]*tmp[4] + (s64)s[11]*tmp[8] + (s64)0x1000*tmp[12]) >> 12;
-    m[13] = ((s64)s[9]*tmp[1] + (s64)s[10]*tmp[5] + (s64)s[11]*tmp[9] + (s64)0x1000*tmp[13]) >> 12;
-    m[14] = ((s64)s[9]*tmp[2] + (s64)s[10]*tmp[6] + (s64)s[11]*tmp[10] + (s64)0x1000*tmp[14]) >> 12;
-    m[15] = ((s64)s[9]*tmp[3] + (s64)s[10]*tmp[7] + (s64)s[11]*tmp[11] + (s64)0x1000*tmp[15]) >> 12;
+    s32 coefs[16] =
+    {
+        s[0], s[1], s[2], 0,
+        s[3], s[4], s[5], 0,
+        s[6], s[7], s[8], 0,
+        s[9], s[10], s[11], 0x1000
+    };
+    MatrixProduct(m, coefs, 4, tmp);
 }
 
 void MatrixMult3x3(s32* m, s32* s)
 {
-    s32 tmp[12];
-    memcpy(tmp, m, 12*4);
+    s32 tmp[16];
+    memcpy(tmp, m, 16*4);
 
     // m = s*m
-    m[0] = ((s64)s[0]*tmp[0] + (s64)s[1]*tmp[4] + (s64)s[2]*tmp[8]) >> 12;
-    m[1] = ((s64)s[0]*tmp[1] + (s64)s[1]*tmp[5] + (s64)s[2]*tmp[9]) >> 12;
-    m[2] = ((s64)s[0]*tmp[2] + (s64)s[1]*tmp[6] + (s64)s[2]*tmp[10]) >> 12;
-    m[3] = ((s64)s[0]*tmp[3] + (s64)s[1]*tmp[7] + (s64)s[2]*tmp[11]) >> 12;
-
-    m[4] = ((s64)s[3]*tmp[0] + (s64)s[4]*tmp[4] + (s64)s[5]*tmp[8]) >> 12;
-    m[5] = ((s64)s[3]*tmp[1] + (s64)s[4]*tmp[5] + (s64)s[5]*tmp[9]) >> 12;
-    m[6] = ((s64)s[3]*tmp[2] + (s64)s[4]*tmp[6] + (s64)s[5]*tmp[10]) >> 12;
-    m[7] = ((s64)s[3]*tmp[3] + (s64)s[4]*tmp[7] + (s64)s[5]*tmp[11]) >> 12;
-
-    m[8] = ((s64)s[6]*tmp[0] + (s64)s[7]*tmp[4] + (s64)s[8]*tmp[8]) >> 12;
-    m[9] = ((s64)s[6]*tmp[1] + (s64)s[7]*tmp[5] + (s64)s[8]*tmp[9]) >> 12;
-    m[10] = ((s64)s[6]*tmp[2] + (s64)s[7]*tmp[6] + (s64)s[8]*tmp[10]) >> 12;
-    m[11] = ((s64)s[6]*tmp[3] + (s64)s[7]*tmp[7] + (s64)s[8]*tmp[11]) >> 12;
+    s32 coefs[12] =
+    {
+        s[0], s[1], s[2], 0,
+        s[3], s[4], s[5], 0,
+        s[6], s[7], s[8], 0
+    };
+    MatrixProduct(m, coefs, 3, tmp);
 }
 
 void MatrixScale(s32* m, s32* s)
@@ -752,10 +919,14 @@ void MatrixScale(s32* m, s32* s)
 
 void MatrixTranslate(s32* m, s32* s)
 {
-    m[12] += ((s64)s[0]*m[0] + (s64)s[1]*m[4] + (s64)s[2]*m[8]) >> 12;
-    m[13] += ((s64)s[0]*m[1] + (s64)s[1]*m[5] + (s64)s[2]*m[9]) >> 12;
-    m[14] += ((s64)s[0]*m[2] + (s64)s[1]*m[6] + (s64)s[2]*m[10]) >> 12;
-    m[15] += ((s64)s[0]*m[3] + (s64)s[1]*m[7] + (s64)s[2]*m[11]) >> 12;
+    s32 coefs[4] = {s[0], s[1], s[2], 0};
+    s32 res[4];
+    MatrixProduct(res, coefs, 1, m);
+
+    m[12] += res[0];
+    m[13] += res[1];
+    m[14] += res[2];
+    m[15] += res[3];
 }
 
 void UpdateClipMatrix()
@@ -763,8 +934,7 @@ void UpdateClipMatrix()
     if (!ClipMatrixDirty) return;
     ClipMatrixDirty = false;
 
-    memcpy(ClipMatrix, ProjMatrix, 16*4);
-    MatrixMult4x4(ClipMatrix, PosMatrix);
+    MatrixProduct(ClipMatrix, PosMatrix, 4, ProjMatrix);
 }
 
 
@@ -1422,10 +1592,8 @@ void SubmitVertex()
     Vertex* vertextrans = &TempVertexBuffer[VertexNumInPoly];
 
     UpdateClipMatrix();
-    vertextrans->Position[0] = (vertex[0]*ClipMatrix[0] + vertex[1]*ClipMatrix[4] + vertex[2]*ClipMatrix[8] + vertex[3]*ClipMatrix[12]) >> 12;
-    vertextrans->Position[1] = (vertex[0]*ClipMatrix[1] + vertex[1]*ClipMatrix[5] + vertex[2]*ClipMatrix[9] + vertex[3]*ClipMatrix[13]) >> 12;
-    vertextrans->Position[2] = (vertex[0]*ClipMatrix[2] + vertex[1]*ClipMatrix[6] + vertex[2]*ClipMatrix[10] + vertex[3]*ClipMatrix[14]) >> 12;
-    vertextrans->Position[3] = (vertex[0]*ClipMatrix[3] + vertex[1]*ClipMatrix[7] + vertex[2]*ClipMatrix[11] + vertex[3]*ClipMatrix[15]) >> 12;
+    s32 coefs[4] = {CurVertex[0], CurVertex[1], CurVertex[2], 0x1000};
+    MatrixProduct(vertextrans->Position, coefs, 1, ClipMatrix);
 
     // this probably shouldn't be.
     // the way color is handled during clipping needs investigation. TODO
@@ -1523,9 +1691,8 @@ void CalculateLighting()
     }
 
     s32 normaltrans[3];
-    normaltrans[0] = (Normal[0]*VecMatrix[0] + Normal[1]*VecMatrix[4] + Normal[2]*VecMatrix[8]) >> 12;
-    normaltrans[1] = (Normal[0]*VecMatrix[1] + Normal[1]*VecMatrix[5] + Normal[2]*VecMatrix[9]) >> 12;
-    normaltrans[2] = (Normal[0]*VecMatrix[2] + Normal[1]*VecMatrix[6] + Normal[2]*VecMatrix[10]) >> 12;
+    s32 diffdot[4], shinedot[4];
+    LightingProducts(normaltrans, diffdot, shinedot);
 
     VertexColor[0] = MatEmission[0];
     VertexColor[1] = MatEmission[1];
@@ -1543,15 +1710,11 @@ void CalculateLighting()
         // * shininess level mirrors back to 0 and is ANDed with 0xFF, that before being squared
         // TODO: check how it behaves when the computed shininess is >=0x200
 
-        s32 difflevel = (-(LightDirection[i][0]*normaltrans[0] +
-                         LightDirection[i][1]*normaltrans[1] +
-                         LightDirection[i][2]*normaltrans[2])) >> 10;
+        s32 difflevel = (-diffdot[i]) >> 10;
         if (difflevel < 0) difflevel = 0;
         else if (difflevel > 255) difflevel = 255;
 
-        s32 shinelevel = -(((LightDirection[i][0]>>1)*normaltrans[0] +
-                          (LightDirection[i][1]>>1)*normaltrans[1] +
-                          ((LightDirection[i][2]-0x200)>>1)*normaltrans[2]) >> 10);
+        s32 shinelevel = -(shinedot[i] >> 10);
         if (shinelevel < 0) shinelevel = 0;
         else if (shinelevel > 255) shinelevel = (0x100 - shinelevel) & 0xFF;
         shinelevel = ((shinelevel * shinelevel) >> 7) - 0x100; // really (2*shinelevel*shinelevel)-1
@@ -1688,13 +1851,10 @@ void BoxTest(u32* params)
 
 void PosTest()
 {
-    s64 vertex[4] = {(s64)CurVertex[0], (s64)CurVertex[1], (s64)CurVertex[2], 0x1000};
+    s32 coefs[4] = {CurVertex[0], CurVertex[1], CurVertex[2], 0x1000};
 
     UpdateClipMatrix();
-    PosTestResult[0] = (vertex[0]*ClipMatrix[0] + vertex[1]*ClipMatrix[4] + vertex[2]*ClipMatrix[8] + vertex[3]*ClipMatrix[12]) >> 12;
-    PosTestResult[1] = (vertex[0]*ClipMatrix[1] + vertex[1]*ClipMatrix[5] + vertex[2]*ClipMatrix[9] + vertex[3]*ClipMatrix[13]) >> 12;
-    PosTestResult[2] = (vertex[0]*ClipMatrix[2] + vertex[1]*ClipMatrix[6] + vertex[2]*ClipMatrix[10] + vertex[3]*ClipMatrix[14]) >> 12;
-    PosTestResult[3] = (vertex[0]*ClipMatrix[3] + vertex[1]*ClipMatrix[7] + vertex[2]*ClipMatrix[11] + vertex[3]*ClipMatrix[15]) >> 12;
+    MatrixProduct(PosTestResult, coefs, 1, ClipMatrix);
 
     AddCycles(5);
 }
@@ -1771,8 +1931,19 @@ CmdFIFOEntry CmdFIFORead()
 
         // empty stall queue if needed
         // CmdFIFO should not be full at this point.
+        bool refilled = false;
         if (!CmdStallQueue.IsEmpty())
         {
+            // this brings the FIFO level back up, so do the checks
+            // that were held back while it was lower
+            if (FIFOCheckPending)
+            {
+                CheckFIFODMA();
+                CheckFIFOIRQ();
+                FIFOCheckPending = false;
+            }
+
+            refilled = true;
             while (!CmdStallQueue.IsEmpty())
             {
                 if (CmdFIFO.IsFull()) break;
@@ -1784,8 +1955,18 @@ CmdFIFOEntry CmdFIFORead()
                 NDS::GXFIFOUnstall();
         }
 
-        CheckFIFODMA();
-        CheckFIFOIRQ();
+        // when running a batch of commands, the FIFO level only goes down
+        // and nothing can observe the DMA and IRQ state until the batch is over
+        // so checking once at the end gives the same result
+        if (RunningBatch && !refilled)
+        {
+            FIFOCheckPending = true;
+        }
+        else
+        {
+            CheckFIFODMA();
+            CheckFIFOIRQ();
+        }
     }
 
     return ret;
@@ -2456,6 +2637,8 @@ void Run()
 
     if (CycleCount <= 0)
     {
+        RunningBatch = true;
+
         while (CycleCount <= 0 && !CmdPIPE.IsEmpty())
         {
             if (NumPushPopCommands == 0) GXStat &= ~(1<<14);
@@ -2463,6 +2646,14 @@ void Run()
 
             ExecuteCommand();
         }
+
+        RunningBatch = false;
+        if (FIFOCheckPending)
+        {
+            CheckFIFODMA();
+            CheckFIFOIRQ();
+            FIFOCheckPending = false;
+        }
     }
 
     if (CycleCount <= 0 && CmdPIPE.IsEmpty())
@@ -2676,6 +2867,23 @@ void WriteToGXFIFO(u32 val)
     }
 }
 
+u32 WriteToGXFIFO(const u32* vals, u32 count)
+{
+    // bulk version for DMA transfers
+    // stops after the word that stalls the FIFO, returns how many words were taken
+
+    if (!GeometryEnabled) return count;
+
+    for (u32 i = 0; i < count; i++)
+    {
+        WriteToGXFIFO(vals[i]);
+        if (!CmdStallQueue.IsEmpty())
+            return i+1;
+    }
+
+    return count;
+}
+
 
 u8 Read8(u32 addr)
 {
@@ -124,6 +124,7 @@ void SetRenderXPos(u16 xpos);
 u32* GetLine(int line);
 
 void WriteToGXFIFO(u32 val);
+u32 WriteToGXFIFO(const u32* vals, u32 count);
 
 u8 Read8(u32 addr);
 u16 Read16(u32 addr);
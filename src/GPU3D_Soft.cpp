@@ -20,6 +20,9 @@
 
 #include <stdio.h>
 #include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "NDS.h"
 #include "GPU.h"
 #include "Config.h"
@@ -29,6 +32,7 @@ namespace GPU3D
 {
 
 void RenderThreadFunc();
+void SetupSpanFuncs();
 
 
 void SoftRenderer::StopRenderThread()
@@ -39,6 +43,13 @@ void SoftRenderer::StopRenderThread()
         Platform::Semaphore_Post(Sema_RenderStart);
         Platform::Thread_Wait(RenderThread);
         Platform::Thread_Free(RenderThread);
+
+        for (int i = 1; i < NumBands; i++)
+        {
+            Platform::Semaphore_Post(Bands[i].Sema_Start);
+            Platform::Thread_Wait(Bands[i].Thread);
+            Platform::Thread_Free(Bands[i].Thread);
+        }
     }
 }
 
@@ -50,6 +61,9 @@ void SoftRenderer::SetupRenderThread()
         {
             RenderThreadRunning = true;
             RenderThread = Platform::Thread_Create(std::bind(&SoftRenderer::RenderThreadFunc, this));
+
+            for (int i = 1; i < NumBands; i++)
+                Bands[i].Thread = Platform::Thread_Create(std::bind(&SoftRenderer::BandThreadFunc, this, i));
         }
 
         // otherwise more than one frame can be queued up at once
@@ -82,11 +96,26 @@ bool SoftRenderer::Init()
     Sema_RenderStart = Platform::Semaphore_Create();
     Sema_RenderDone = Platform::Semaphore_Create();
     Sema_ScanlineCount = Platform::Semaphore_Create();
+    Sema_BandsDone = Platform::Semaphore_Create();
+    LineFinishedLock = Platform::Mutex_Create();
+
+    TexCacheTexels = 0;
+    TexCacheFrame = 0;
+
+    SetupSpanFuncs();
 
     Threaded = false;
     RenderThreadRunning = false;
     RenderThreadRendering = false;
 
+    // the render thread takes the first band itself. Leave one core
+    // for the emulator thread and one for everything else
+    int cores = std::thread::hardware_concurrency();
+    NumBands = std::max(1, std::min(cores - 2, MaxRenderBands));
+
+    for (int i = 0; i < NumBands; i++)
+        Bands[i].Sema_Start = Platform::Semaphore_Create();
+
     return true;
 }
 
@@ -97,6 +126,11 @@ void SoftRenderer::DeInit()
     Platform::Semaphore_Free(Sema_RenderStart);
     Platform::Semaphore_Free(Sema_RenderDone);
     Platform::Semaphore_Free(Sema_ScanlineCount);
+    Platform::Semaphore_Free(Sema_BandsDone);
+    Platform::Mutex_Free(LineFinishedLock);
+
+    for (int i = 0; i < NumBands; i++)
+        Platform::Semaphore_Free(Bands[i].Sema_Start);
 }
 
 void SoftRenderer::Reset()
@@ -107,6 +141,12 @@ void SoftRenderer::Reset()
 
     PrevIsShadowMask = false;
 
+    TexCache.clear();
+    TexCacheLRU.clear();
+    TexCacheTexels = 0;
+    TexCacheFrame = 0;
+    VolatileTextures.clear();
+
     SetupRenderThread();
 }
 
@@ -116,10 +156,8 @@ void SoftRenderer::SetRenderSettings(GPU::RenderSettings& settings)
     SetupRenderThread();
 }
 
-void SoftRenderer::TextureLookup(u32 texparam, u32 texpal, s16 s, s16 t, u16* color, u8* alpha)
+void SoftRenderer::TextureLookup(u32 texparam, u32 texpal, u32* texture, s16 s, s16 t, u16* color, u8* alpha)
 {
-    u32 vramaddr = (texparam & 0xFFFF) << 3;
-
     s32 width = 8 << ((texparam >> 20) & 0x7);
     s32 height = 8 << ((texparam >> 23) & 0x7);
 
@@ -162,6 +200,22 @@ void SoftRenderer::TextureLookup(u32 texparam, u32 texpal, s16 s, s16 t, u16* co
         else if (t >= height) t = height-1;
     }
 
+    if (texture)
+    {
+        u32 texel = texture[(t * width) + s];
+        *color = texel & 0xFFFF;
+        *alpha = texel >> 24;
+    }
+    else
+        DecodeTexel(texparam, texpal, s, t, color, alpha);
+}
+
+void SoftRenderer::DecodeTexel(u32 texparam, u32 texpal, s32 s, s32 t, u16* color, u8* alpha)
+{
+    u32 vramaddr = (texparam & 0xFFFF) << 3;
+
+    s32 width = 8 << ((texparam >> 20) & 0x7);
+
     u8 alpha0;
     if (texparam & (1<<29)) alpha0 = 0;
     else                    alpha0 = 31;
@@ -342,6 +396,148 @@ void SoftRenderer::TextureLookup(u32 texparam, u32 texpal, s16 s, s16 t, u16* co
     }
 }
 
+u32* SoftRenderer::GetTexture(u32 texparam, u32 texpal)
+{
+    // only the address, size, format and color 0 transparency
+    // matter for decoding, wrapping is done at lookup time
+    u32 format = (texparam >> 26) & 0x7;
+    texparam &= 0x3FF0FFFF;
+    if (format == 7) texpal = 0;
+    else             texpal &= 0x1FFF;
+
+    u64 key = ((u64)texpal << 32) | texparam;
+    auto it = TexCache.find(key);
+    if (it != TexCache.end())
+    {
+        TexCacheEntry& entry = it->second;
+        entry.LastUsed = TexCacheFrame;
+        TexCacheLRU.splice(TexCacheLRU.begin(), TexCacheLRU, entry.LRUPos);
+        return entry.Texels.data();
+    }
+
+    auto vit = VolatileTextures.find(key);
+    if (vit != VolatileTextures.end())
+    {
+        vit->second.LastUsed = TexCacheFrame;
+        return NULL;
+    }
+
+    u32 width = 8 << ((texparam >> 20) & 0x7);
+    u32 height = 8 << ((texparam >> 23) & 0x7);
+    u32 numTexels = width * height;
+
+    // the palette index of a compressed texel can go 8 bytes past 0xFFFC
+    const u32 bitsPerTexel[8] = {0, 8, 2, 4, 8, 2, 8, 16};
+    const u32 palSize[8] = {0, 64, 8, 32, 512, 0x10004, 16, 0};
+
+    TexSource source;
+    source.TexAddr = (texparam & 0xFFFF) << 3;
+    source.TexSize = (numTexels * bitsPerTexel[format]) >> 3;
+    source.PalAddr = (format == 2) ? (texpal << 3) : (texpal << 4);
+    source.PalSize = palSize[format];
+    source.Compressed = format == 5;
+
+    // textures used by the current frame can't be evicted, their texels are about to be read from.
+    // Those of the previous frame are kept as well, if the textures in use don't all fit
+    // evicting them would have the same ones decoded again on every frame
+    while (TexCacheTexels + numTexels > MaxTexCacheTexels)
+    {
+        auto lru = TexCache.find(TexCacheLRU.back());
+        if (lru->second.LastUsed + 1 >= TexCacheFrame)
+            return NULL;
+
+        EvictTexture(lru);
+    }
+
+    TexCacheEntry& entry = TexCache[key];
+    entry.Width = width;
+    entry.Height = height;
+    entry.Source = source;
+    entry.LastUsed = TexCacheFrame;
+    entry.LRUPos = TexCacheLRU.insert(TexCacheLRU.begin(), key);
+
+    entry.Texels.resize(numTexels);
+    u32* texels = entry.Texels.data();
+    for (s32 t = 0; t < (s32)entry.Height; t++)
+    {
+        for (s32 s = 0; s < (s32)entry.Width; s++)
+        {
+            u16 color; u8 alpha;
+            DecodeTexel(texparam, texpal, s, t, &color, &alpha);
+            *texels++ = color | (alpha << 24);
+        }
+    }
+
+    TexCacheTexels += numTexels;
+    return entry.Texels.data();
+}
+
+void SoftRenderer::EvictTexture(std::unordered_map<u64, TexCacheEntry>::iterator it)
+{
+    TexCacheTexels -= it->second.Width * it->second.Height;
+    TexCacheLRU.erase(it->second.LRUPos);
+    TexCache.erase(it);
+}
+
+template <u32 Size>
+bool RangeDirty(NonStupidBitField<Size>& dirty, u32 addr, u32 size)
+{
+    if (size == 0) return false;
+
+    u32 start = addr / GPU::VRAMDirtyGranularity;
+    u32 count = (addr + size - 1) / GPU::VRAMDirtyGranularity - start + 1;
+    if (count >= Size)
+        return dirty.Any();
+
+    // the range can wrap around
+    start &= (Size - 1);
+    if (start + count <= Size)
+        return dirty.AnyInRange(start, count);
+
+    return dirty.AnyInRange(start, Size - start) || dirty.AnyInRange(0, start + count - Size);
+}
+
+bool SoftRenderer::TexSourceDirty(TexSource& source,
+    NonStupidBitField<512*1024/GPU::VRAMDirtyGranularity>& textureDirty,
+    NonStupidBitField<128*1024/GPU::VRAMDirtyGranularity>& texPalDirty)
+{
+    // the palette indices of compressed textures live in slot 1
+    return RangeDirty(textureDirty, source.TexAddr, source.TexSize)
+        || (source.Compressed && RangeDirty(textureDirty, 0x20000, 0x20000))
+        || RangeDirty(texPalDirty, source.PalAddr, source.PalSize);
+}
+
+void SoftRenderer::InvalidateTexCache(NonStupidBitField<512*1024/GPU::VRAMDirtyGranularity>& textureDirty,
+    NonStupidBitField<128*1024/GPU::VRAMDirtyGranularity>& texPalDirty)
+{
+    // textures read straight from VRAM on the previous frame
+    // stay out of the cache for as long as they keep changing
+    for (auto it = VolatileTextures.begin(); it != VolatileTextures.end();)
+    {
+        VolatileTexture& tex = it->second;
+
+        if (tex.LastUsed != TexCacheFrame || !TexSourceDirty(tex.Source, textureDirty, texPalDirty))
+            it = VolatileTextures.erase(it);
+        else
+            it++;
+    }
+
+    for (auto it = TexCache.begin(); it != TexCache.end();)
+    {
+        TexCacheEntry& entry = it->second;
+
+        if (TexSourceDirty(entry.Source, textureDirty, texPalDirty))
+        {
+            if (entry.LastUsed == TexCacheFrame)
+                VolatileTextures[it->first] = {entry.Source, TexCacheFrame};
+
+            EvictTexture(it++);
+        }
+        else
+            it++;
+    }
+}
+
 // depth test is 'less or equal' instead of 'less than' under the following conditions:
 // * when drawing a front-facing pixel over an opaque back-facing pixel
 // * when drawing wireframe edges, under certain conditions (TODO)
@@ -392,6 +588,526 @@ bool DepthTest_LessThan_FrontFacing(s32 dstz, s32 z, u32 dstattr)
     return false;
 }
 
+enum
+{
+    DepthTest_Mode_LessThan = 0,
+    DepthTest_Mode_LessThan_FrontFacing,
+    DepthTest_Mode_Equal_Z,
+    DepthTest_Mode_Equal_W,
+};
+
+template <int depthmode>
+inline bool DepthTest(s32 dstz, s32 z, u32 dstattr)
+{
+    switch (depthmode)
+    {
+    case DepthTest_Mode_LessThan: return DepthTest_LessThan(dstz, z, dstattr);
+    case DepthTest_Mode_LessThan_FrontFacing: return DepthTest_LessThan_FrontFacing(dstz, z, dstattr);
+    case DepthTest_Mode_Equal_Z: return DepthTest_Equal_Z(dstz, z, dstattr);
+    case DepthTest_Mode_Equal_W: return DepthTest_Equal_W(dstz, z, dstattr);
+    }
+    return false;
+}
+
+// does the depth test against the topmost pixels for a whole span,
+// pixels failing it still have to be tested against the pixels underneath
+template <int mode>
+void DepthTestSpan(u32* dstz, u32* dstattr, s32* z, s32 count, u64* pass)
+{
+    memset(pass, 0, ((count + 63) >> 6) * sizeof(u64));
+
+    s32 i = 0;
+#if defined(__SSE2__)
+    const __m128i bias = _mm_set1_epi32(0x80000000);
+    for (; i+4 <= count; i += 4)
+    {
+        __m128i vdstz = _mm_loadu_si128((__m128i*)&dstz[i]);
+        __m128i vz = _mm_loadu_si128((__m128i*)&z[i]);
+        __m128i res;
+
+        switch (mode)
+        {
+        case DepthTest_Mode_LessThan:
+            res = _mm_cmplt_epi32(vz, vdstz);
+            break;
+        case DepthTest_Mode_LessThan_FrontFacing:
+            {
+                __m128i attr = _mm_and_si128(_mm_loadu_si128((__m128i*)&dstattr[i]), _mm_set1_epi32(0x00400010));
+                __m128i lessequal = _mm_cmpeq_epi32(attr, _mm_set1_epi32(0x00000010));
+                res = _mm_or_si128(_mm_cmplt_epi32(vz, vdstz), _mm_and_si128(lessequal, _mm_cmpeq_epi32(vz, vdstz)));
+            }
+            break;
+        case DepthTest_Mode_Equal_Z:
+        case DepthTest_Mode_Equal_W:
+        default:
+            {
+                // unsigned comparison done as signed with the sign bit flipped
+                s32 range = (mode == DepthTest_Mode_Equal_Z) ? 0x200 : 0xFF;
+                __m128i diff = _mm_add_epi32(_mm_sub_epi32(vdstz, vz), _mm_set1_epi32(range));
+                res = _mm_cmpgt_epi32(_mm_xor_si128(diff, bias), _mm_set1_epi32((range*2) ^ 0x80000000));
+                res = _mm_xor_si128(res, _mm_set1_epi32(-1));
+            }
+            break;
+        }
+
+        pass[i >> 6] |= (u64)_mm_movemask_ps(_mm_castsi128_ps(res)) << (i & 0x3F);
+    }
+#elif defined(__aarch64__)
+    const uint32x4_t bits = {1, 2, 4, 8};
+    for (; i+4 <= count; i += 4)
+    {
+        int32x4_t vdstz = vreinterpretq_s32_u32(vld1q_u32(&dstz[i]));
+        int32x4_t vz = vld1q_s32(&z[i]);
+        uint32x4_t res;
+
+        switch (mode)
+        {
+        case DepthTest_Mode_LessThan:
+            res = vcltq_s32(vz, vdstz);
+            break;
+        case DepthTest_Mode_LessThan_FrontFacing:
+            {
+                uint32x4_t attr = vandq_u32(vld1q_u32(&dstattr[i]), vdupq_n_u32(0x00400010));
+                uint32x4_t lessequal = vceqq_u32(attr, vdupq_n_u32(0x00000010));
+                res = vorrq_u32(vcltq_s32(vz, vdstz), vandq_u32(lessequal, vceqq_s32(vz, vdstz)));
+            }
+            break;
+        case DepthTest_Mode_Equal_Z:
+        case DepthTest_Mode_Equal_W:
+        default:
+            {
+                u32 range = (mode == DepthTest_Mode_Equal_Z) ? 0x200 : 0xFF;
+                uint32x4_t diff = vaddq_u32(vreinterpretq_u32_s32(vsubq_s32(vdstz, vz)), vdupq_n_u32(range));
+                res = vcleq_u32(diff, vdupq_n_u32(range*2));
+            }
+            break;
+        }
+
+        pass[i >> 6] |= (u64)vaddvq_u32(vandq_u32(res, bits)) << (i & 0x3F);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        bool res = DepthTest<mode>(dstz[i], z[i], dstattr[i]);
+        pass[i >> 6] |= (u64)res << (i & 0x3F);
+    }
+}
+
+// the interior of textured modulate and decal polygons has its colors calculated a span at a time:
+// the attributes are interpolated, the texels fetched and combined with the vertex colors
+// for several pixels at once. The CPU's vector extensions are picked at runtime
+void (*InterpolateSpan)(s32* out, s32 y0, s32 y1, const u32* factors, s32 count, s32 shift) = NULL;
+void (*FetchTexels)(u32* texels, const u32* texture, u32 texparam, const s32* s, const s32* t, s32 count) = NULL;
+void (*CombineSpan)(u32* colors, const s32* r, const s32* g, const s32* b, const u32* texels, s32 count, u32 polyalpha, bool decal) = NULL;
+
+// same as Interpolator::Interpolate() with the factors from CalculateFactors()
+void InterpolateSpan_Scalar(s32* out, s32 y0, s32 y1, const u32* factors, s32 count, s32 shift)
+{
+    for (s32 i = 0; i < count; i++)
+    {
+        if (y0 < y1) out[i] = y0 + (((y1-y0) * factors[i]) >> shift);
+        else         out[i] = y1 + (((y0-y1) * ((1<<shift)-factors[i])) >> shift);
+    }
+}
+
+// same as RenderPixel() for modulate and decal
+void CombineSpan_Scalar(u32* colors, const s32* r, const s32* g, const s32* b, const u32* texels, s32 count, u32 polyalpha, bool decal)
+{
+    for (s32 i = 0; i < count; i++)
+    {
+        u32 vr = (u8)((u32)r[i] >> 3);
+        u32 vg = (u8)((u32)g[i] >> 3);
+        u32 vb = (u8)((u32)b[i] >> 3);
+
+        u32 tcolor = texels[i] & 0xFFFF;
+        u32 talpha = texels[i] >> 24;
+
+        u32 tr = (tcolor << 1) & 0x3E; if (tr) tr++;
+        u32 tg = (tcolor >> 4) & 0x3E; if (tg) tg++;
+        u32 tb = (tcolor >> 9) & 0x3E; if (tb) tb++;
+
+        u32 cr, cg, cb, ca;
+        if (decal)
+        {
+            if (talpha == 0)
+            {
+                cr = vr; cg = vg; cb = vb;
+            }
+            else if (talpha == 31)
+            {
+                cr = tr; cg = tg; cb = tb;
+            }
+            else
+            {
+                cr = ((tr * talpha) + (vr * (31-talpha))) >> 5;
+                cg = ((tg * talpha) + (vg * (31-talpha))) >> 5;
+                cb = ((tb * talpha) + (vb * (31-talpha))) >> 5;
+            }
+            ca = polyalpha;
+        }
+        else
+        {
+            cr = ((tr+1) * (vr+1) - 1) >> 6;
+            cg = ((tg+1) * (vg+1) - 1) >> 6;
+            cb = ((tb+1) * (vb+1) - 1) >> 6;
+            ca = ((talpha+1) * (polyalpha+1) - 1) >> 5;
+        }
+
+        colors[i] = cr | (cg << 8) | (cb << 16) | (ca << 24);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse4.1")))
+void InterpolateSpan_SSE41(s32* out, s32 y0, s32 y1, const u32* factors, s32 count, s32 shift)
+{
+    // the factors are unsigned, so is the shift
+    bool up = y0 < y1;
+    __m128i base = _mm_set1_epi32(up ? y0 : y1);
+    __m128i diff = _mm_set1_epi32(up ? (y1-y0) : (y0-y1));
+    __m128i one = _mm_set1_epi32(1<<shift);
+    __m128i vshift = _mm_cvtsi32_si128(shift);
+
+    s32 i = 0;
+    for (; i+4 <= count; i += 4)
+    {
+        __m128i factor = _mm_loadu_si128((__m128i*)&factors[i]);
+        if (!up) factor = _mm_sub_epi32(one, factor);
+
+        __m128i res = _mm_add_epi32(base, _mm_srl_epi32(_mm_mullo_epi32(diff, factor), vshift));
+        _mm_storeu_si128((__m128i*)&out[i], res);
+    }
+
+    InterpolateSpan_Scalar(&out[i], y0, y1, &factors[i], count-i, shift);
+}
+
+__attribute__((target("avx2")))
+void InterpolateSpan_AVX2(s32* out, s32 y0, s32 y1, const u32* factors, s32 count, s32 shift)
+{
+    bool up = y0 < y1;
+    __m256i base = _mm256_set1_epi32(up ? y0 : y1);
+    __m256i diff = _mm256_set1_epi32(up ? (y1-y0) : (y0-y1));
+    __m256i one = _mm256_set1_epi32(1<<shift);
+    __m128i vshift = _mm_cvtsi32_si128(shift);
+
+    s32 i = 0;
+    for (; i+8 <= count; i += 8)
+    {
+        __m256i factor = _mm256_loadu_si256((__m256i*)&factors[i]);
+        if (!up) factor = _mm256_sub_epi32(one, factor);
+
+        __m256i res = _mm256_add_epi32(base, _mm256_srl_epi32(_mm256_mullo_epi32(diff, factor), vshift));
+        _mm256_storeu_si256((__m256i*)&out[i], res);
+    }
+
+    InterpolateSpan_Scalar(&out[i], y0, y1, &factors[i], count-i, shift);
+}
+
+// texture coordinates to texel indices, wrapped, clamped or mirrored like in TextureLookup()
+__attribute__((target("sse4.1")))
+inline __m128i WrapTexCoords_SSE41(__m128i coord, u32 size, bool repeat, bool mirror)
+{
+    // the coordinates are 12.4 fixed point and only the low 16 bits count
+    coord = _mm_srai_epi32(_mm_slli_epi32(coord, 16), 20);
+
+    __m128i mask = _mm_set1_epi32(size-1);
+    if (!repeat)
+        return _mm_min_epi32(_mm_max_epi32(coord, _mm_setzero_si128()), mask);
+
+    __m128i res = _mm_and_si128(coord, mask);
+    if (mirror)
+    {
+        __m128i vsize = _mm_set1_epi32(size);
+        __m128i flip = _mm_cmpeq_epi32(_mm_and_si128(coord, vsize), vsize);
+        res = _mm_xor_si128(res, _mm_and_si128(flip, mask));
+    }
+    return res;
+}
+
+__attribute__((target("sse4.1")))
+void FetchTexels_SSE41(u32* texels, const u32* texture, u32 texparam, const s32* s, const s32* t, s32 count)
+{
+    u32 widthshift = 3 + ((texparam >> 20) & 0x7);
+    u32 width = 1 << widthshift;
+    u32 height = 8 << ((texparam >> 23) & 0x7);
+    bool repeats = texparam & (1<<16), mirrors = texparam & (1<<18);
+    bool repeatt = texparam & (1<<17), mirrort = texparam & (1<<19);
+
+    for (s32 i = 0; i < count; i += 4)
+    {
+        __m128i vs = WrapTexCoords_SSE41(_mm_loadu_si128((__m128i*)&s[i]), width, repeats, mirrors);
+        __m128i vt = WrapTexCoords_SSE41(_mm_loadu_si128((__m128i*)&t[i]), height, repeatt, mirrort);
+
+        alignas(16) u32 index[4];
+        _mm_store_si128((__m128i*)index, _mm_add_epi32(_mm_slli_epi32(vt, widthshift), vs));
+
+        // the coordinates are padded to a multiple of four, the texels past the end are never used
+        texels[i+0] = texture[index[0]];
+        texels[i+1] = texture[index[1]];
+        texels[i+2] = texture[index[2]];
+        texels[i+3] = texture[index[3]];
+    }
+}
+
+// turns the 5-bit components of a texel into the same 6-bit range as the vertex colors
+__attribute__((target("sse4.1")))
+inline __m128i TexelComponent_SSE41(__m128i comp)
+{
+    comp = _mm_and_si128(comp, _mm_set1_epi32(0x3E));
+    return _mm_sub_epi32(comp, _mm_xor_si128(_mm_cmpeq_epi32(comp, _mm_setzero_si128()), _mm_set1_epi32(-1)));
+}
+
+__attribute__((target("sse4.1")))
+void CombineSpan_SSE41(u32* colors, const s32* r, const s32* g, const s32* b, const u32* texels, s32 count, u32 polyalpha, bool decal)
+{
+    // all the products fit in 16 bits, so the cheaper 16-bit multiplies are used
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i vpolyalpha = _mm_set1_epi32(polyalpha);
+    const __m128i alpha31 = _mm_set1_epi32(31);
+
+    s32 i = 0;
+    for (; i+4 <= count; i += 4)
+    {
+        __m128i vr = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((__m128i*)&r[i]), 3), _mm_set1_epi32(0xFF));
+        __m128i vg = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((__m128i*)&g[i]), 3), _mm_set1_epi32(0xFF));
+        __m128i vb = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((__m128i*)&b[i]), 3), _mm_set1_epi32(0xFF));
+
+        __m128i texel = _mm_loadu_si128((__m128i*)&texels[i]);
+        __m128i talpha = _mm_srli_epi32(texel, 24);
+        __m128i tr = TexelComponent_SSE41(_mm_slli_epi32(texel, 1));
+        __m128i tg = TexelComponent_SSE41(_mm_srli_epi32(texel, 4));
+        __m128i tb = TexelComponent_SSE41(_mm_srli_epi32(texel, 9));
+
+        __m128i cr, cg, cb, ca;
+        if (decal)
+        {
+            __m128i invalpha = _mm_sub_epi32(alpha31, talpha);
+            cr = _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi16(tr, talpha), _mm_mullo_epi16(vr, invalpha)), 5);
+            cg = _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi16(tg, talpha), _mm_mullo_epi16(vg, invalpha)), 5);
+            cb = _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi16(tb, talpha), _mm_mullo_epi16(vb, invalpha)), 5);
+
+            __m128i transparent = _mm_cmpeq_epi32(talpha, _mm_setzero_si128());
+            __m128i opaque = _mm_cmpeq_epi32(talpha, alpha31);
+            cr = _mm_blendv_epi8(_mm_blendv_epi8(cr, vr, transparent), tr, opaque);
+            cg = _mm_blendv_epi8(_mm_blendv_epi8(cg, vg, transparent), tg, opaque);
+            cb = _mm_blendv_epi8(_mm_blendv_epi8(cb, vb, transparent), tb, opaque);
+            ca = vpolyalpha;
+        }
+        else
+        {
+            cr = _mm_srli_epi32(_mm_sub_epi32(_mm_mullo_epi16(_mm_add_epi32(tr, one), _mm_add_epi32(vr, one)), one), 6);
+            cg = _mm_srli_epi32(_mm_sub_epi32(_mm_mullo_epi16(_mm_add_epi32(tg, one), _mm_add_epi32(vg, one)), one), 6);
+            cb = _mm_srli_epi32(_mm_sub_epi32(_mm_mullo_epi16(_mm_add_epi32(tb, one), _mm_add_epi32(vb, one)), one), 6);
+            ca = _mm_srli_epi32(_mm_sub_epi32(_mm_mullo_epi16(_mm_add_epi32(talpha, one), _mm_add_epi32(vpolyalpha, one)), one), 5);
+        }
+
+        __m128i res = _mm_or_si128(_mm_or_si128(cr, _mm_slli_epi32(cg, 8)), _mm_or_si128(_mm_slli_epi32(cb, 16), _mm_slli_epi32(ca, 24)));
+        _mm_storeu_si128((__m128i*)&colors[i], res);
+    }
+
+    CombineSpan_Scalar(&colors[i], &r[i], &g[i], &b[i], &texels[i], count-i, polyalpha, decal);
+}
+
+__attribute__((target("avx2")))
+inline __m256i TexelComponent_AVX2(__m256i comp)
+{
+    comp = _mm256_and_si256(comp, _mm256_set1_epi32(0x3E));
+    return _mm256_sub_epi32(comp, _mm256_xor_si256(_mm256_cmpeq_epi32(comp, _mm256_setzero_si256()), _mm256_set1_epi32(-1)));
+}
+
+__attribute__((target("avx2")))
+void CombineSpan_AVX2(u32* colors, const s32* r, const s32* g, const s32* b, const u32* texels, s32 count, u32 polyalpha, bool decal)
+{
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i vpolyalpha = _mm256_set1_epi32(polyalpha);
+    const __m256i alpha31 = _mm256_set1_epi32(31);
+
+    s32 i = 0;
+    for (; i+8 <= count; i += 8)
+    {
+        __m256i vr = _mm256_and_si256(_mm256_srli_epi32(_mm256_loadu_si256((__m256i*)&r[i]), 3), _mm256_set1_epi32(0xFF));
+        __m256i vg = _mm256_and_si256(_mm256_srli_epi32(_mm256_loadu_si256((__m256i*)&g[i]), 3), _mm256_set1_epi32(0xFF));
+        __m256i vb = _mm256_and_si256(_mm256_srli_epi32(_mm256_loadu_si256((__m256i*)&b[i]), 3), _mm256_set1_epi32(0xFF));
+
+        __m256i texel = _mm256_loadu_si256((__m256i*)&texels[i]);
+        __m256i talpha = _mm256_srli_epi32(texel, 24);
+        __m256i tr = TexelComponent_AVX2(_mm256_slli_epi32(texel, 1));
+        __m256i tg = TexelComponent_AVX2(_mm256_srli_epi32(texel, 4));
+        __m256i tb = TexelComponent_AVX2(_mm256_srli_epi32(texel, 9));
+
+        __m256i cr, cg, cb, ca;
+        if (decal)
+        {
+            __m256i invalpha = _mm256_sub_epi32(alpha31, talpha);
+            cr = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi16(tr, talpha), _mm256_mullo_epi16(vr, invalpha)), 5);
+            cg = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi16(tg, talpha), _mm256_mullo_epi16(vg, invalpha)), 5);
+            cb = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi16(tb, talpha), _mm256_mullo_epi16(vb, invalpha)), 5);
+
+            __m256i transparent = _mm256_cmpeq_epi32(talpha, _mm256_setzero_si256());
+            __m256i opaque = _mm256_cmpeq_epi32(talpha, alpha31);
+            cr = _mm256_blendv_epi8(_mm256_blendv_epi8(cr, vr, transparent), tr, opaque);
+            cg = _mm256_blendv_epi8(_mm256_blendv_epi8(cg, vg, transparent), tg, opaque);
+            cb = _mm256_blendv_epi8(_mm256_blendv_epi8(cb, vb, transparent), tb, opaque);
+            ca = vpolyalpha;
+        }
+        else
+        {
+            cr = _mm256_srli_epi32(_mm256_sub_epi32(_mm256_mullo_epi16(_mm256_add_epi32(tr, one), _mm256_add_epi32(vr, one)), one), 6);
+            cg = _mm256_srli_epi32(_mm256_sub_epi32(_mm256_mullo_epi16(_mm256_add_epi32(tg, one), _mm256_add_epi32(vg, one)), one), 6);
+            cb = _mm256_srli_epi32(_mm256_sub_epi32(_mm256_mullo_epi16(_mm256_add_epi32(tb, one), _mm256_add_epi32(vb, one)), one), 6);
+            ca = _mm256_srli_epi32(_mm256_sub_epi32(_mm256_mullo_epi16(_mm256_add_epi32(talpha, one), _mm256_add_epi32(vpolyalpha, one)), one), 5);
+        }
+
+        __m256i res = _mm256_or_si256(_mm256_or_si256(cr, _mm256_slli_epi32(cg, 8)), _mm256_or_si256(_mm256_slli_epi32(cb, 16), _mm256_slli_epi32(ca, 24)));
+        _mm256_storeu_si256((__m256i*)&colors[i], res);
+    }
+
+    CombineSpan_Scalar(&colors[i], &r[i], &g[i], &b[i], &texels[i], count-i, polyalpha, decal);
+}
+
+#elif defined(__aarch64__)
+
+void InterpolateSpan_NEON(s32* out, s32 y0, s32 y1, const u32* factors, s32 count, s32 shift)
+{
+    bool up = y0 < y1;
+    uint32x4_t base = vdupq_n_u32(up ? y0 : y1);
+    uint32x4_t diff = vdupq_n_u32(up ? (y1-y0) : (y0-y1));
+    uint32x4_t one = vdupq_n_u32(1<<shift);
+    int32x4_t vshift = vdupq_n_s32(-shift);
+
+    s32 i = 0;
+    for (; i+4 <= count; i += 4)
+    {
+        uint32x4_t factor = vld1q_u32(&factors[i]);
+        if (!up) factor = vsubq_u32(one, factor);
+
+        uint32x4_t res = vaddq_u32(base, vshlq_u32(vmulq_u32(diff, factor), vshift));
+        vst1q_s32(&out[i], vreinterpretq_s32_u32(res));
+    }
+
+    InterpolateSpan_Scalar(&out[i], y0, y1, &factors[i], count-i, shift);
+}
+
+inline uint32x4_t WrapTexCoords_NEON(int32x4_t coord, u32 size, bool repeat, bool mirror)
+{
+    coord = vshrq_n_s32(vshlq_n_s32(coord, 16), 20);
+
+    uint32x4_t mask = vdupq_n_u32(size-1);
+    if (!repeat)
+        return vreinterpretq_u32_s32(vminq_s32(vmaxq_s32(coord, vdupq_n_s32(0)), vreinterpretq_s32_u32(mask)));
+
+    uint32x4_t res = vandq_u32(vreinterpretq_u32_s32(coord), mask);
+    if (mirror)
+        res = veorq_u32(res, vandq_u32(vtstq_u32(vreinterpretq_u32_s32(coord), vdupq_n_u32(size)), mask));
+    return res;
+}
+
+void FetchTexels_NEON(u32* texels, const u32* texture, u32 texparam, const s32* s, const s32* t, s32 count)
+{
+    u32 widthshift = 3 + ((texparam >> 20) & 0x7);
+    u32 width = 1 << widthshift;
+    u32 height = 8 << ((texparam >> 23) & 0x7);
+    bool repeats = texparam & (1<<16), mirrors = texparam & (1<<18);
+    bool repeatt = texparam & (1<<17), mirrort = texparam & (1<<19);
+
+    for (s32 i = 0; i < count; i += 4)
+    {
+        uint32x4_t vs = WrapTexCoords_NEON(vld1q_s32(&s[i]), width, repeats, mirrors);
+        uint32x4_t vt = WrapTexCoords_NEON(vld1q_s32(&t[i]), height, repeatt, mirrort);
+
+        u32 index[4];
+        vst1q_u32(index, vaddq_u32(vshlq_u32(vt, vdupq_n_s32(widthshift)), vs));
+
+        // the coordinates are padded to a multiple of four, the texels past the end are never used
+        texels[i+0] = texture[index[0]];
+        texels[i+1] = texture[index[1]];
+        texels[i+2] = texture[index[2]];
+        texels[i+3] = texture[index[3]];
+    }
+}
+
+inline uint32x4_t TexelComponent_NEON(uint32x4_t comp)
+{
+    comp = vandq_u32(comp, vdupq_n_u32(0x3E));
+    return vsubq_u32(comp, vtstq_u32(comp, comp));
+}
+
+void CombineSpan_NEON(u32* colors, const s32* r, const s32* g, const s32* b, const u32* texels, s32 count, u32 polyalpha, bool decal)
+{
+    const uint32x4_t one = vdupq_n_u32(1);
+    const uint32x4_t vpolyalpha = vdupq_n_u32(polyalpha);
+    const uint32x4_t alpha31 = vdupq_n_u32(31);
+    const uint32x4_t colormask = vdupq_n_u32(0xFF);
+
+    s32 i = 0;
+    for (; i+4 <= count; i += 4)
+    {
+        uint32x4_t vr = vandq_u32(vshrq_n_u32(vld1q_u32((const u32*)&r[i]), 3), colormask);
+        uint32x4_t vg = vandq_u32(vshrq_n_u32(vld1q_u32((const u32*)&g[i]), 3), colormask);
+        uint32x4_t vb = vandq_u32(vshrq_n_u32(vld1q_u32((const u32*)&b[i]), 3), colormask);
+
+        uint32x4_t texel = vld1q_u32(&texels[i]);
+        uint32x4_t talpha = vshrq_n_u32(texel, 24);
+        uint32x4_t tr = TexelComponent_NEON(vshlq_n_u32(texel, 1));
+        uint32x4_t tg = TexelComponent_NEON(vshrq_n_u32(texel, 4));
+        uint32x4_t tb = TexelComponent_NEON(vshrq_n_u32(texel, 9));
+
+        uint32x4_t cr, cg, cb, ca;
+        if (decal)
+        {
+            uint32x4_t invalpha = vsubq_u32(alpha31, talpha);
+            cr = vshrq_n_u32(vmlaq_u32(vmulq_u32(tr, talpha), vr, invalpha), 5);
+            cg = vshrq_n_u32(vmlaq_u32(vmulq_u32(tg, talpha), vg, invalpha), 5);
+            cb = vshrq_n_u32(vmlaq_u32(vmulq_u32(tb, talpha), vb, invalpha), 5);
+
+            uint32x4_t transparent = vceqzq_u32(talpha);
+            uint32x4_t opaque = vceqq_u32(talpha, alpha31);
+            cr = vbslq_u32(opaque, tr, vbslq_u32(transparent, vr, cr));
+            cg = vbslq_u32(opaque, tg, vbslq_u32(transparent, vg, cg));
+            cb = vbslq_u32(opaque, tb, vbslq_u32(transparent, vb, cb));
+            ca = vpolyalpha;
+        }
+        else
+        {
+            cr = vshrq_n_u32(vsubq_u32(vmulq_u32(vaddq_u32(tr, one), vaddq_u32(vr, one)), one), 6);
+            cg = vshrq_n_u32(vsubq_u32(vmulq_u32(vaddq_u32(tg, one), vaddq_u32(vg, one)), one), 6);
+            cb = vshrq_n_u32(vsubq_u32(vmulq_u32(vaddq_u32(tb, one), vaddq_u32(vb, one)), one), 6);
+            ca = vshrq_n_u32(vsubq_u32(vmulq_u32(vaddq_u32(talpha, one), vaddq_u32(vpolyalpha, one)), one), 5);
+        }
+
+        uint32x4_t res = vorrq_u32(vorrq_u32(cr, vshlq_n_u32(cg, 8)), vorrq_u32(vshlq_n_u32(cb, 16), vshlq_n_u32(ca, 24)));
+        vst1q_u32(&colors[i], res);
+    }
+
+    CombineSpan_Scalar(&colors[i], &r[i], &g[i], &b[i], &texels[i], count-i, polyalpha, decal);
+}
+
+#endif
+
+void SetupSpanFuncs()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1"))
+    {
+        InterpolateSpan = InterpolateSpan_SSE41;
+        FetchTexels = FetchTexels_SSE41;
+        CombineSpan = CombineSpan_SSE41;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        InterpolateSpan = InterpolateSpan_AVX2;
+        CombineSpan = CombineSpan_AVX2;
+    }
+#elif defined(__aarch64__)
+    InterpolateSpan = InterpolateSpan_NEON;
+    FetchTexels = FetchTexels_NEON;
+    CombineSpan = CombineSpan_NEON;
+#endif
+}
+
 u32 AlphaBlend(u32 srccolor, u32 dstcolor, u32 alpha)
 {
     u32 dstalpha = dstcolor >> 24;
@@ -422,17 +1138,17 @@ u32 AlphaBlend(u32 srccolor, u32 dstcolor, u32 alpha)
     return srcR | (srcG << 8) | (srcB << 16) | (dstalpha << 24);
 }
 
-u32 SoftRenderer::RenderPixel(Polygon* polygon, u8 vr, u8 vg, u8 vb, s16 s, s16 t)
+template <int blendmode, bool highlight, bool textured, bool wireframe>
+u32 SoftRenderer::RenderPixel(RendererPolygon* rp, u8 vr, u8 vg, u8 vb, s16 s, s16 t)
 {
+    Polygon* polygon = rp->PolyData;
     u8 r, g, b, a;
 
-    u32 blendmode = (polygon->Attr >> 4) & 0x3;
     u32 polyalpha = (polygon->Attr >> 16) & 0x1F;
-    bool wireframe = (polyalpha == 0);
 
     if (blendmode == 2)
     {
-        if (RenderDispCnt & (1<<1))
+        if (highlight)
         {
             // highlight mode: color is calculated normally
             // except all vertex color components are set
@@ -454,12 +1170,12 @@ u32 SoftRenderer::RenderPixel(Polygon* polygon, u8 vr, u8 vg, u8 vb, s16 s, s16
         }
     }
 
-    if ((RenderDispCnt & (1<<0)) && (((polygon->TexParam >> 26) & 0x7) != 0))
+    if (textured)
     {
         u8 tr, tg, tb;
 
         u16 tcolor; u8 talpha;
-        TextureLookup(polygon->TexParam, polygon->TexPalette, s, t, &tcolor, &talpha);
+        TextureLookup(polygon->TexParam, polygon->TexPalette, rp->Texture, s, t, &tcolor, &talpha);
 
         tr = (tcolor << 1) & 0x3E; if (tr) tr++;
         tg = (tcolor >> 4) & 0x3E; if (tg) tg++;
@@ -507,7 +1223,7 @@ u32 SoftRenderer::RenderPixel(Polygon* polygon, u8 vr, u8 vg, u8 vb, s16 s, s16
         a = polyalpha;
     }
 
-    if ((blendmode == 2) && (RenderDispCnt & (1<<1)))
+    if ((blendmode == 2) && highlight)
     {
         u16 tooncolor = RenderToonTable[vr >> 1];
 
@@ -530,6 +1246,53 @@ u32 SoftRenderer::RenderPixel(Polygon* polygon, u8 vr, u8 vg, u8 vb, s16 s, s16
     return r | (g << 8) | (b << 16) | (a << 24);
 }
 
+void SoftRenderer::RenderSpanColors(RendererPolygon* rp, Interpolator<0>& interpX, s32 x, s32 count, u32* factors,
+    s32* attrl, s32* attrr, bool decal, u32* colors)
+{
+    Polygon* polygon = rp->PolyData;
+
+    // color, then texture coordinates
+    alignas(16) s32 attrs[5][256];
+    alignas(16) u32 texels[256];
+
+    if (interpX.UsesFactors())
+    {
+        for (int j = 0; j < 5; j++)
+            InterpolateSpan(attrs[j], attrl[j], attrr[j], factors, count, interpX.FactorShift());
+    }
+    else
+    {
+        for (s32 i = 0; i < count; i++)
+        {
+            interpX.SetX(x + i, factors[i]);
+            for (int j = 0; j < 5; j++)
+                attrs[j][i] = interpX.Interpolate(attrl[j], attrr[j]);
+        }
+    }
+
+    if (rp->Texture)
+    {
+        for (s32 i = count; i < ((count + 3) & ~3); i++)
+        {
+            attrs[3][i] = 0;
+            attrs[4][i] = 0;
+        }
+
+        FetchTexels(texels, rp->Texture, polygon->TexParam, attrs[3], attrs[4], count);
+    }
+    else
+    {
+        for (s32 i = 0; i < count; i++)
+        {
+            u16 color; u8 alpha;
+            TextureLookup(polygon->TexParam, polygon->TexPalette, NULL, attrs[3][i], attrs[4][i], &color, &alpha);
+            texels[i] = color | (alpha << 24);
+        }
+    }
+
+    CombineSpan(colors, attrs[0], attrs[1], attrs[2], texels, count, (polygon->Attr >> 16) & 0x1F, decal);
+}
+
 void SoftRenderer::PlotTranslucentPixel(u32 pixeladdr, u32 color, u32 z, u32 polyattr, u32 shadow)
 {
     u32 dstattr = AttrBuffer[pixeladdr];
@@ -632,6 +1395,29 @@ void SoftRenderer::SetupPolygon(SoftRenderer::RendererPolygon* rp, Polygon* poly
 
     rp->PolyData = polygon;
 
+    // pick the scanline function specialised for this polygon's attributes
+    if (polygon->Attr & (1<<14))
+    {
+        if (polygon->WBuffer)
+            rp->ScanlineFunc = GetScanlineFunc<DepthTest_Mode_Equal_W, true>(rp);
+        else
+            rp->ScanlineFunc = GetScanlineFunc<DepthTest_Mode_Equal_Z, false>(rp);
+    }
+    else if (polygon->FacingView)
+    {
+        if (polygon->WBuffer)
+            rp->ScanlineFunc = GetScanlineFunc<DepthTest_Mode_LessThan_FrontFacing, true>(rp);
+        else
+            rp->ScanlineFunc = GetScanlineFunc<DepthTest_Mode_LessThan_FrontFacing, false>(rp);
+    }
+    else
+    {
+        if (polygon->WBuffer)
+            rp->ScanlineFunc = GetScanlineFunc<DepthTest_Mode_LessThan, true>(rp);
+        else
+            rp->ScanlineFunc = GetScanlineFunc<DepthTest_Mode_LessThan, false>(rp);
+    }
+
     rp->CurVL = vtop;
     rp->CurVR = vtop;
 
@@ -676,6 +1462,7 @@ void SoftRenderer::SetupPolygon(SoftRenderer::RendererPolygon* rp, Polygon* poly
     }
 }
 
+template <int depthmode, bool wbuffer>
 void SoftRenderer::RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
 {
     Polygon* polygon = rp->PolyData;
@@ -686,14 +1473,6 @@ void SoftRenderer::RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
     u32 polyalpha = (polygon->Attr >> 16) & 0x1F;
     bool wireframe = (polyalpha == 0);
 
-    bool (*fnDepthTest)(s32 dstz, s32 z, u32 dstattr);
-    if (polygon->Attr & (1<<14))
-        fnDepthTest = polygon->WBuffer ? DepthTest_Equal_W : DepthTest_Equal_Z;
-    else if (polygon->FacingView)
-        fnDepthTest = DepthTest_LessThan_FrontFacing;
-    else
-        fnDepthTest = DepthTest_LessThan;
-
     if (!PrevIsShadowMask)
         memset(&StencilBuffer[256 * (y&0x1)], 0, 256);
 
@@ -739,8 +1518,8 @@ void SoftRenderer::RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
     s32 wl = rp->SlopeL.Interp.Interpolate(polygon->FinalW[rp->CurVL], polygon->FinalW[rp->NextVL]);
     s32 wr = rp->SlopeR.Interp.Interpolate(polygon->FinalW[rp->CurVR], polygon->FinalW[rp->NextVR]);
 
-    s32 zl = rp->SlopeL.Interp.InterpolateZ(polygon->FinalZ[rp->CurVL], polygon->FinalZ[rp->NextVL], polygon->WBuffer);
-    s32 zr = rp->SlopeR.Interp.InterpolateZ(polygon->FinalZ[rp->CurVR], polygon->FinalZ[rp->NextVR], polygon->WBuffer);
+    s32 zl = rp->SlopeL.Interp.InterpolateZ(polygon->FinalZ[rp->CurVL], polygon->FinalZ[rp->NextVL], wbuffer);
+    s32 zr = rp->SlopeR.Interp.InterpolateZ(polygon->FinalZ[rp->CurVR], polygon->FinalZ[rp->NextVR], wbuffer);
 
     // if the left and right edges are swapped, render backwards.
     if (xstart > xend)
@@ -812,20 +1591,20 @@ void SoftRenderer::RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
 
         interpX.SetX(x);
 
-        s32 z = interpX.InterpolateZ(zl, zr, polygon->WBuffer);
+        s32 z = interpX.InterpolateZ(zl, zr, wbuffer);
         u32 dstattr = AttrBuffer[pixeladdr];
 
         // checkme
         if (!l_filledge)
             continue;
 
-        if (!fnDepthTest(DepthBuffer[pixeladdr], z, dstattr))
+        if (!DepthTest<depthmode>(DepthBuffer[pixeladdr], z, dstattr))
             StencilBuffer[256*(y&0x1) + x] = 1;
 
         if (dstattr & 0x3)
         {
             pixeladdr += BufferSize;
-            if (!fnDepthTest(DepthBuffer[pixeladdr], z, AttrBuffer[pixeladdr]))
+            if (!DepthTest<depthmode>(DepthBuffer[pixeladdr], z, AttrBuffer[pixeladdr]))
                 StencilBuffer[256*(y&0x1) + x] |= 0x2;
         }
     }
@@ -842,16 +1621,16 @@ void SoftRenderer::RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
 
         interpX.SetX(x);
 
-        s32 z = interpX.InterpolateZ(zl, zr, polygon->WBuffer);
+        s32 z = interpX.InterpolateZ(zl, zr, wbuffer);
         u32 dstattr = AttrBuffer[pixeladdr];
 
-        if (!fnDepthTest(DepthBuffer[pixeladdr], z, dstattr))
+        if (!DepthTest<depthmode>(DepthBuffer[pixeladdr], z, dstattr))
             StencilBuffer[256*(y&0x1) + x] = 1;
 
         if (dstattr & 0x3)
         {
             pixeladdr += BufferSize;
-            if (!fnDepthTest(DepthBuffer[pixeladdr], z, AttrBuffer[pixeladdr]))
+            if (!DepthTest<depthmode>(DepthBuffer[pixeladdr], z, AttrBuffer[pixeladdr]))
                 StencilBuffer[256*(y&0x1) + x] |= 0x2;
         }
     }
@@ -867,20 +1646,20 @@ void SoftRenderer::RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
 
         interpX.SetX(x);
 
-        s32 z = interpX.InterpolateZ(zl, zr, polygon->WBuffer);
+        s32 z = interpX.InterpolateZ(zl, zr, wbuffer);
         u32 dstattr = AttrBuffer[pixeladdr];
 
         // checkme
         if (!r_filledge)
             continue;
 
-        if (!fnDepthTest(DepthBuffer[pixeladdr], z, dstattr))
+        if (!DepthTest<depthmode>(DepthBuffer[pixeladdr], z, dstattr))
             StencilBuffer[256*(y&0x1) + x] = 1;
 
         if (dstattr & 0x3)
         {
             pixeladdr += BufferSize;
-            if (!fnDepthTest(DepthBuffer[pixeladdr], z, AttrBuffer[pixeladdr]))
+            if (!DepthTest<depthmode>(DepthBuffer[pixeladdr], z, AttrBuffer[pixeladdr]))
                 StencilBuffer[256*(y&0x1) + x] |= 0x2;
         }
     }
@@ -889,25 +1668,20 @@ void SoftRenderer::RenderShadowMaskScanline(RendererPolygon* rp, s32 y)
     rp->XR = rp->SlopeR.Step();
 }
 
+template <int depthmode, bool wbuffer, int blendmode, bool highlight, bool textured, bool wireframe>
 void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
 {
     Polygon* polygon = rp->PolyData;
 
+    // shadow masks have their own scanline function, so these are all shadows
+    const bool shadow = (blendmode == 3);
+
     u32 polyattr = (polygon->Attr & 0x3F008000);
     if (!polygon->FacingView) polyattr |= (1<<4);
 
-    u32 polyalpha = (polygon->Attr >> 16) & 0x1F;
-    bool wireframe = (polyalpha == 0);
-
-    bool (*fnDepthTest)(s32 dstz, s32 z, u32 dstattr);
-    if (polygon->Attr & (1<<14))
-        fnDepthTest = polygon->WBuffer ? DepthTest_Equal_W : DepthTest_Equal_Z;
-    else if (polygon->FacingView)
-        fnDepthTest = DepthTest_LessThan_FrontFacing;
-    else
-        fnDepthTest = DepthTest_LessThan;
-
-    PrevIsShadowMask = false;
+    // only written when it changes, bands rendering in parallel never have shadow masks
+    if (PrevIsShadowMask)
+        PrevIsShadowMask = false;
 
     if (polygon->YTop != polygon->YBottom)
     {
@@ -954,8 +1728,8 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
     s32 wl = rp->SlopeL.Interp.Interpolate(polygon->FinalW[rp->CurVL], polygon->FinalW[rp->NextVL]);
     s32 wr = rp->SlopeR.Interp.Interpolate(polygon->FinalW[rp->CurVR], polygon->FinalW[rp->NextVR]);
 
-    s32 zl = rp->SlopeL.Interp.InterpolateZ(polygon->FinalZ[rp->CurVL], polygon->FinalZ[rp->NextVL], polygon->WBuffer);
-    s32 zr = rp->SlopeR.Interp.InterpolateZ(polygon->FinalZ[rp->CurVR], polygon->FinalZ[rp->NextVR], polygon->WBuffer);
+    s32 zl = rp->SlopeL.Interp.InterpolateZ(polygon->FinalZ[rp->CurVL], polygon->FinalZ[rp->NextVL], wbuffer);
+    s32 zr = rp->SlopeR.Interp.InterpolateZ(polygon->FinalZ[rp->CurVR], polygon->FinalZ[rp->NextVR], wbuffer);
 
     // if the left and right edges are swapped, render backwards.
     // on hardware, swapped edges seem to break edge length calculation,
@@ -1047,7 +1821,7 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
         u32 dstattr = AttrBuffer[pixeladdr];
 
         // check stencil buffer for shadows
-        if (polygon->IsShadow)
+        if (shadow)
         {
             u8 stencil = StencilBuffer[256*(y&0x1) + x];
             if (!stencil)
@@ -1060,17 +1834,17 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
 
         interpX.SetX(x);
 
-        s32 z = interpX.InterpolateZ(zl, zr, polygon->WBuffer);
+        s32 z = interpX.InterpolateZ(zl, zr, wbuffer);
 
         // if depth test against the topmost pixel fails, test
         // against the pixel underneath
-        if (!fnDepthTest(DepthBuffer[pixeladdr], z, dstattr))
+        if (!DepthTest<depthmode>(DepthBuffer[pixeladdr], z, dstattr))
         {
             if (!(dstattr & 0x3) || pixeladdr >= BufferSize) continue;
 
             pixeladdr += BufferSize;
             dstattr = AttrBuffer[pixeladdr];
-            if (!fnDepthTest(DepthBuffer[pixeladdr], z, dstattr))
+            if (!DepthTest<depthmode>(DepthBuffer[pixeladdr], z, dstattr))
                 continue;
         }
 
@@ -1081,7 +1855,7 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
         s16 s = interpX.Interpolate(sl, sr);
         s16 t = interpX.Interpolate(tl, tr);
 
-        u32 color = RenderPixel(polygon, vr>>3, vg>>3, vb>>3, s, t);
+        u32 color = RenderPixel<blendmode, highlight, textured, wireframe>(rp, vr>>3, vg>>3, vb>>3, s, t);
         u8 alpha = color >> 24;
 
         // alpha test
@@ -1121,11 +1895,11 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
         else
         {
             if (!(polygon->Attr & (1<<11))) z = -1;
-            PlotTranslucentPixel(pixeladdr, color, z, polyattr, polygon->IsShadow);
+            PlotTranslucentPixel(pixeladdr, color, z, polyattr, shadow);
 
             // blend with bottom pixel too, if needed
             if ((dstattr & 0x3) && (pixeladdr < BufferSize))
-                PlotTranslucentPixel(pixeladdr+BufferSize, color, z, polyattr, polygon->IsShadow);
+                PlotTranslucentPixel(pixeladdr+BufferSize, color, z, polyattr, shadow);
         }
     }
 
@@ -1136,6 +1910,96 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
     if (xlimit > 256) xlimit = 256;
 
     if (wireframe && !edge) x = xlimit;
+    else if (!shadow && x < xlimit)
+    {
+        // the polygon interior is done in two passes:
+        // first the perspective factors, depths and depth tests for the whole span,
+        // then the pixels passing the depth test are drawn. Pixels can only
+        // modify themselves, so doing the depth tests beforehand is fine
+        s32 xspan = x;
+        s32 count = xlimit - x;
+
+        u32 factors[256];
+        s32 depths[256];
+        u64 depthpass[4];
+
+        interpX.CalculateFactors(xspan, count, factors);
+        for (s32 i = 0; i < count; i++)
+        {
+            interpX.SetX(xspan + i, factors[i]);
+            depths[i] = interpX.InterpolateZ(zl, zr, wbuffer);
+        }
+
+        u32 spanaddr = FirstPixelOffset + (y*ScanlineWidth) + xspan;
+        DepthTestSpan<depthmode>(&DepthBuffer[spanaddr], &AttrBuffer[spanaddr], depths, count, depthpass);
+
+        // the colors of textured modulate and decal pixels are calculated for the whole span too
+        bool spancolors = textured && !wireframe && (blendmode == 0 || blendmode == 1) && CombineSpan;
+        u32 colors[256];
+        if (spancolors)
+        {
+            s32 attrl[5] = {rl, gl, bl, sl, tl};
+            s32 attrr[5] = {rr, gr, br, sr, tr};
+            RenderSpanColors(rp, interpX, xspan, count, factors, attrl, attrr, blendmode == 1, colors);
+        }
+
+        for (; x < xlimit; x++)
+        {
+            s32 i = x - xspan;
+            u32 pixeladdr = spanaddr + i;
+            u32 dstattr = AttrBuffer[pixeladdr];
+
+            s32 z = depths[i];
+
+            if (!(depthpass[i >> 6] & (1ULL << (i & 0x3F))))
+            {
+                if (!(dstattr & 0x3) || pixeladdr >= BufferSize) continue;
+
+                pixeladdr += BufferSize;
+                dstattr = AttrBuffer[pixeladdr];
+                if (!DepthTest<depthmode>(DepthBuffer[pixeladdr], z, dstattr))
+                    continue;
+            }
+
+            u32 color;
+            if (spancolors)
+                color = colors[i];
+            else
+            {
+                interpX.SetX(x, factors[i]);
+
+                u32 vr = interpX.Interpolate(rl, rr);
+                u32 vg = interpX.Interpolate(gl, gr);
+                u32 vb = interpX.Interpolate(bl, br);
+
+                s16 s = interpX.Interpolate(sl, sr);
+                s16 t = interpX.Interpolate(tl, tr);
+
+                color = RenderPixel<blendmode, highlight, textured, wireframe>(rp, vr>>3, vg>>3, vb>>3, s, t);
+            }
+            u8 alpha = color >> 24;
+
+            // alpha test
+            if (alpha <= RenderAlphaRef) continue;
+
+            if (alpha == 31)
+            {
+                u32 attr = polyattr | edge;
+                DepthBuffer[pixeladdr] = z;
+                ColorBuffer[pixeladdr] = color;
+                AttrBuffer[pixeladdr] = attr;
+            }
+            else
+            {
+                if (!(polygon->Attr & (1<<11))) z = -1;
+                PlotTranslucentPixel(pixeladdr, color, z, polyattr, shadow);
+
+                // blend with bottom pixel too, if needed
+                if ((dstattr & 0x3) && (pixeladdr < BufferSize))
+                    PlotTranslucentPixel(pixeladdr+BufferSize, color, z, polyattr, shadow);
+            }
+        }
+    }
     else
     for (; x < xlimit; x++)
     {
@@ -1143,7 +2007,7 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
         u32 dstattr = AttrBuffer[pixeladdr];
 
         // check stencil buffer for shadows
-        if (polygon->IsShadow)
+        if (shadow)
         {
             u8 stencil = StencilBuffer[256*(y&0x1) + x];
             if (!stencil)
@@ -1156,17 +2020,17 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
 
         interpX.SetX(x);
 
-        s32 z = interpX.InterpolateZ(zl, zr, polygon->WBuffer);
+        s32 z = interpX.InterpolateZ(zl, zr, wbuffer);
 
         // if depth test against the topmost pixel fails, test
         // against the pixel underneath
-        if (!fnDepthTest(DepthBuffer[pixeladdr], z, dstattr))
+        if (!DepthTest<depthmode>(DepthBuffer[pixeladdr], z, dstattr))
         {
             if (!(dstattr & 0x3) || pixeladdr >= BufferSize) continue;
 
             pixeladdr += BufferSize;
             dstattr = AttrBuffer[pixeladdr];
-            if (!fnDepthTest(DepthBuffer[pixeladdr], z, dstattr))
+            if (!DepthTest<depthmode>(DepthBuffer[pixeladdr], z, dstattr))
                 continue;
         }
 
@@ -1177,7 +2041,7 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
         s16 s = interpX.Interpolate(sl, sr);
         s16 t = interpX.Interpolate(tl, tr);
 
-        u32 color = RenderPixel(polygon, vr>>3, vg>>3, vb>>3, s, t);
+        u32 color = RenderPixel<blendmode, highlight, textured, wireframe>(rp, vr>>3, vg>>3, vb>>3, s, t);
         u8 alpha = color >> 24;
 
         // alpha test
@@ -1193,11 +2057,11 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
         else
         {
             if (!(polygon->Attr & (1<<11))) z = -1;
-            PlotTranslucentPixel(pixeladdr, color, z, polyattr, polygon->IsShadow);
+            PlotTranslucentPixel(pixeladdr, color, z, polyattr, shadow);
 
             // blend with bottom pixel too, if needed
             if ((dstattr & 0x3) && (pixeladdr < BufferSize))
-                PlotTranslucentPixel(pixeladdr+BufferSize, color, z, polyattr, polygon->IsShadow);
+                PlotTranslucentPixel(pixeladdr+BufferSize, color, z, polyattr, shadow);
         }
     }
 
@@ -1218,7 +2082,7 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
         u32 dstattr = AttrBuffer[pixeladdr];
 
         // check stencil buffer for shadows
-        if (polygon->IsShadow)
+        if (shadow)
         {
             u8 stencil = StencilBuffer[256*(y&0x1) + x];
             if (!stencil)
@@ -1231,17 +2095,17 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
 
         interpX.SetX(x);
 
-        s32 z = interpX.InterpolateZ(zl, zr, polygon->WBuffer);
+        s32 z = interpX.InterpolateZ(zl, zr, wbuffer);
 
         // if depth test against the topmost pixel fails, test
         // against the pixel underneath
-        if (!fnDepthTest(DepthBuffer[pixeladdr], z, dstattr))
+        if (!DepthTest<depthmode>(DepthBuffer[pixeladdr], z, dstattr))
         {
             if (!(dstattr & 0x3) || pixeladdr >= BufferSize) continue;
 
             pixeladdr += BufferSize;
             dstattr = AttrBuffer[pixeladdr];
-            if (!fnDepthTest(DepthBuffer[pixeladdr], z, dstattr))
+            if (!DepthTest<depthmode>(DepthBuffer[pixeladdr], z, dstattr))
                 continue;
         }
 
@@ -1252,7 +2116,7 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
         s16 s = interpX.Interpolate(sl, sr);
         s16 t = interpX.Interpolate(tl, tr);
 
-        u32 color = RenderPixel(polygon, vr>>3, vg>>3, vb>>3, s, t);
+        u32 color = RenderPixel<blendmode, highlight, textured, wireframe>(rp, vr>>3, vg>>3, vb>>3, s, t);
         u8 alpha = color >> 24;
 
         // alpha test
@@ -1292,11 +2156,11 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
         else
         {
             if (!(polygon->Attr & (1<<11))) z = -1;
-            PlotTranslucentPixel(pixeladdr, color, z, polyattr, polygon->IsShadow);
+            PlotTranslucentPixel(pixeladdr, color, z, polyattr, shadow);
 
             // blend with bottom pixel too, if needed
             if ((dstattr & 0x3) && (pixeladdr < BufferSize))
-                PlotTranslucentPixel(pixeladdr+BufferSize, color, z, polyattr, polygon->IsShadow);
+                PlotTranslucentPixel(pixeladdr+BufferSize, color, z, polyattr, shadow);
         }
     }
 
@@ -1304,22 +2168,164 @@ void SoftRenderer::RenderPolygonScanline(RendererPolygon* rp, s32 y)
     rp->XR = rp->SlopeR.Step();
 }
 
-void SoftRenderer::RenderScanline(s32 y, int npolys)
+template <int depthmode, bool wbuffer, int blendmode, bool highlight>
+SoftRenderer::ScanlineFuncType SoftRenderer::GetScanlineFunc(bool textured, bool wireframe)
 {
+    if (textured)
+        return wireframe ? &SoftRenderer::RenderPolygonScanline<depthmode, wbuffer, blendmode, highlight, true, true>
+                         : &SoftRenderer::RenderPolygonScanline<depthmode, wbuffer, blendmode, highlight, true, false>;
+    else
+        return wireframe ? &SoftRenderer::RenderPolygonScanline<depthmode, wbuffer, blendmode, highlight, false, true>
+                         : &SoftRenderer::RenderPolygonScanline<depthmode, wbuffer, blendmode, highlight, false, false>;
+}
+
+template <int depthmode, bool wbuffer>
+SoftRenderer::ScanlineFuncType SoftRenderer::GetScanlineFunc(RendererPolygon* rp)
+{
+    Polygon* polygon = rp->PolyData;
+
+    if (polygon->IsShadowMask)
+        return &SoftRenderer::RenderShadowMaskScanline<depthmode, wbuffer>;
+
+    bool textured = (RenderDispCnt & (1<<0)) && (((polygon->TexParam >> 26) & 0x7) != 0);
+    bool wireframe = ((polygon->Attr >> 16) & 0x1F) == 0;
+    switch ((polygon->Attr >> 4) & 0x3)
+    {
+    case 0: return GetScanlineFunc<depthmode, wbuffer, 0, false>(textured, wireframe);
+    case 1: return GetScanlineFunc<depthmode, wbuffer, 1, false>(textured, wireframe);
+    case 2:
+        if (RenderDispCnt & (1<<1))
+            return GetScanlineFunc<depthmode, wbuffer, 2, true>(textured, wireframe);
+        else
+            return GetScanlineFunc<depthmode, wbuffer, 2, false>(textured, wireframe);
+    default: return GetScanlineFunc<depthmode, wbuffer, 3, false>(textured, wireframe);
+    }
+}
+
+void SoftRenderer::SetupBand(RenderBand& band, s32 ystart, s32 yend, Polygon** polygons, int npolys)
+{
+    band.YStart = ystart;
+    band.YEnd = yend;
+
+    u16 lineCount[192 + 1] = {0};
+
+    int j = 0;
     for (int i = 0; i < npolys; i++)
     {
-        RendererPolygon* rp = &PolygonList[i];
-        Polygon* polygon = rp->PolyData;
+        Polygon* polygon = polygons[i];
+        if (polygon->Degenerate) continue;
+
+        // same coverage as checked in RenderScanline
+        s32 ybottom = std::max(polygon->YBottom, polygon->YTop + 1);
+        if (polygon->YTop >= yend || ybottom <= ystart)
+            continue;
+
+        RendererPolygon* rp = &band.PolygonList[j++];
+        rp->Texture = PolygonTextures[i];
+        SetupPolygon(rp, polygon);
 
-        if (y >= polygon->YTop && (y < polygon->YBottom || (y == polygon->YTop && polygon->YBottom == polygon->YTop)))
+        // the slopes only depend on y, so instead of stepping them
+        // they can be set up for the first line of the band directly
+        if (polygon->YTop < ystart && polygon->YTop != polygon->YBottom)
         {
-            if (polygon->IsShadowMask)
-                RenderShadowMaskScanline(rp, y);
-            else
-                RenderPolygonScanline(rp, y);
+            SetupPolygonLeftEdge(rp, ystart);
+            SetupPolygonRightEdge(rp, ystart);
         }
+
+        lineCount[std::max(polygon->YTop, ystart) - ystart]++;
+    }
+    band.NumPolygons = j;
+
+    // counting sort, this keeps the drawing order within each line
+    u32 offset = 0;
+    for (int y = 0; y <= yend - ystart; y++)
+    {
+        band.LineStart[y] = offset;
+        offset += lineCount[y];
+        lineCount[y] = band.LineStart[y];
+    }
+    for (int i = 0; i < j; i++)
+    {
+        s32 start = std::max(band.PolygonList[i].PolyData->YTop, ystart) - ystart;
+        band.PolygonsByLine[lineCount[start]++] = i;
     }
+
+    band.NumActivePolygons = 0;
+}
+
+void SoftRenderer::RenderScanline(RenderBand& band, s32 y)
+{
+    // drop the polygons which ended on the previous line
+    int numActive = 0;
+    for (int i = 0; i < band.NumActivePolygons; i++)
+    {
+        Polygon* polygon = band.PolygonList[band.ActivePolygons[i]].PolyData;
+        if (y < std::max(polygon->YBottom, polygon->YTop + 1))
+            band.ActivePolygons[numActive++] = band.ActivePolygons[i];
+    }
+
+    // merge in the ones starting on this line, from the back so it can be done in place
+    u16* newPolygons = &band.PolygonsByLine[band.LineStart[y - band.YStart]];
+    int numNew = band.LineStart[y - band.YStart + 1] - band.LineStart[y - band.YStart];
+
+    int i = numActive - 1, j = numNew - 1;
+    int k = numActive + numNew - 1;
+    while (j >= 0)
+    {
+        if (i >= 0 && band.ActivePolygons[i] > newPolygons[j])
+            band.ActivePolygons[k--] = band.ActivePolygons[i--];
+        else
+            band.ActivePolygons[k--] = newPolygons[j--];
+    }
+    band.NumActivePolygons = numActive + numNew;
+
+    for (int i = 0; i < band.NumActivePolygons; i++)
+    {
+        RendererPolygon* rp = &band.PolygonList[band.ActivePolygons[i]];
+        (this->*rp->ScanlineFunc)(rp, y);
+    }
+}
+
+// blends the color and alpha channels of four pixels,
+// (a * aweight + b * bweight) >> shift, with separate weights for the alpha channel
+#if defined(__SSE2__)
+template <int shift>
+inline __m128i BlendColors(__m128i a, __m128i b, __m128i argb, __m128i brgb, __m128i aalpha, __m128i balpha)
+{
+    // all the products fit within 16 bits
+    const __m128i mask = _mm_set1_epi32(0x3F);
+    __m128i red = _mm_add_epi32(_mm_mullo_epi16(_mm_and_si128(a, mask), argb),
+                                _mm_mullo_epi16(_mm_and_si128(b, mask), brgb));
+    __m128i green = _mm_add_epi32(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(a, 8), mask), argb),
+                                  _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(b, 8), mask), brgb));
+    __m128i blue = _mm_add_epi32(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(a, 16), mask), argb),
+                                 _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(b, 16), mask), brgb));
+    __m128i alpha = _mm_add_epi32(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(a, 24), _mm_set1_epi32(0x1F)), aalpha),
+                                  _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(b, 24), _mm_set1_epi32(0x1F)), balpha));
+
+    return _mm_or_si128(_mm_or_si128(_mm_srli_epi32(red, shift), _mm_slli_epi32(_mm_srli_epi32(green, shift), 8)),
+                        _mm_or_si128(_mm_slli_epi32(_mm_srli_epi32(blue, shift), 16), _mm_slli_epi32(_mm_srli_epi32(alpha, shift), 24)));
+}
+
+inline __m128i Select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
 }
+#elif defined(__aarch64__)
+template <int shift>
+inline uint32x4_t BlendColors(uint32x4_t a, uint32x4_t b, uint32x4_t argb, uint32x4_t brgb, uint32x4_t aalpha, uint32x4_t balpha)
+{
+    const uint32x4_t mask = vdupq_n_u32(0x3F);
+    uint32x4_t red = vmlaq_u32(vmulq_u32(vandq_u32(a, mask), argb), vandq_u32(b, mask), brgb);
+    uint32x4_t green = vmlaq_u32(vmulq_u32(vandq_u32(vshrq_n_u32(a, 8), mask), argb), vandq_u32(vshrq_n_u32(b, 8), mask), brgb);
+    uint32x4_t blue = vmlaq_u32(vmulq_u32(vandq_u32(vshrq_n_u32(a, 16), mask), argb), vandq_u32(vshrq_n_u32(b, 16), mask), brgb);
+    uint32x4_t alpha = vmlaq_u32(vmulq_u32(vandq_u32(vshrq_n_u32(a, 24), vdupq_n_u32(0x1F)), aalpha),
+                                 vandq_u32(vshrq_n_u32(b, 24), vdupq_n_u32(0x1F)), balpha);
+
+    return vorrq_u32(vorrq_u32(vshrq_n_u32(red, shift), vshlq_n_u32(vshrq_n_u32(green, shift), 8)),
+                     vorrq_u32(vshlq_n_u32(vshrq_n_u32(blue, shift), 16), vshlq_n_u32(vshrq_n_u32(alpha, shift), 24)));
+}
+#endif
 
 u32 SoftRenderer::CalculateFogDensity(u32 pixeladdr)
 {
@@ -1371,9 +2377,60 @@ void SoftRenderer::ScanlineFinalPass(s32 y)
         // edge marking
         // only applied to topmost pixels
 
-        for (int x = 0; x < 256; x++)
+        // the pixels to mark are all determined first, marking doesn't
+        // change the polygon IDs or depths the tests are done on
+        u64 edgemask[4] = {0};
+        u32 lineaddr = FirstPixelOffset + (y*ScanlineWidth);
+        const s32 neighbours[4] = {-1, 1, -ScanlineWidth, ScanlineWidth};
+
+        int x = 0;
+#if defined(__SSE2__)
+        const __m128i bias = _mm_set1_epi32(0x80000000);
+        for (; x < 256; x += 4)
         {
-            u32 pixeladdr = FirstPixelOffset + (y*ScanlineWidth) + x;
+            u32 pixeladdr = lineaddr + x;
+
+            __m128i attr = _mm_loadu_si128((__m128i*)&AttrBuffer[pixeladdr]);
+            __m128i polyid = _mm_srli_epi32(attr, 24);
+            __m128i z = _mm_xor_si128(_mm_loadu_si128((__m128i*)&DepthBuffer[pixeladdr]), bias);
+
+            __m128i edge = _mm_setzero_si128();
+            for (int i = 0; i < 4; i++)
+            {
+                // depths are unsigned, compare them as signed with the sign bit flipped
+                __m128i otherid = _mm_srli_epi32(_mm_loadu_si128((__m128i*)&AttrBuffer[pixeladdr + neighbours[i]]), 24);
+                __m128i otherz = _mm_xor_si128(_mm_loadu_si128((__m128i*)&DepthBuffer[pixeladdr + neighbours[i]]), bias);
+                edge = _mm_or_si128(edge, _mm_andnot_si128(_mm_cmpeq_epi32(polyid, otherid), _mm_cmplt_epi32(z, otherz)));
+            }
+            edge = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(attr, _mm_set1_epi32(0xF)), _mm_setzero_si128()), edge);
+
+            edgemask[x >> 6] |= (u64)_mm_movemask_ps(_mm_castsi128_ps(edge)) << (x & 0x3F);
+        }
+#elif defined(__aarch64__)
+        const uint32x4_t bits = {1, 2, 4, 8};
+        for (; x < 256; x += 4)
+        {
+            u32 pixeladdr = lineaddr + x;
+
+            uint32x4_t attr = vld1q_u32(&AttrBuffer[pixeladdr]);
+            uint32x4_t polyid = vshrq_n_u32(attr, 24);
+            uint32x4_t z = vld1q_u32(&DepthBuffer[pixeladdr]);
+
+            uint32x4_t edge = vdupq_n_u32(0);
+            for (int i = 0; i < 4; i++)
+            {
+                uint32x4_t otherid = vshrq_n_u32(vld1q_u32(&AttrBuffer[pixeladdr + neighbours[i]]), 24);
+                uint32x4_t otherz = vld1q_u32(&DepthBuffer[pixeladdr + neighbours[i]]);
+                edge = vorrq_u32(edge, vbicq_u32(vcltq_u32(z, otherz), vceqq_u32(polyid, otherid)));
+            }
+            edge = vandq_u32(edge, vtstq_u32(attr, vdupq_n_u32(0xF)));
+
+            edgemask[x >> 6] |= (u64)vaddvq_u32(vandq_u32(edge, bits)) << (x & 0x3F);
+        }
+#endif
+        for (; x < 256; x++)
+        {
+            u32 pixeladdr = lineaddr + x;
 
             u32 attr = AttrBuffer[pixeladdr];
             if (!(attr & 0xF)) continue;
@@ -1381,11 +2438,26 @@ void SoftRenderer::ScanlineFinalPass(s32 y)
             u32 polyid = attr >> 24; // opaque polygon IDs are used for edgemarking
             u32 z = DepthBuffer[pixeladdr];
 
-            if (((polyid != (AttrBuffer[pixeladdr-1] >> 24)) && (z < DepthBuffer[pixeladdr-1])) ||
-                ((polyid != (AttrBuffer[pixeladdr+1] >> 24)) && (z < DepthBuffer[pixeladdr+1])) ||
-                ((polyid != (AttrBuffer[pixeladdr-ScanlineWidth] >> 24)) && (z < DepthBuffer[pixeladdr-ScanlineWidth])) ||
-                ((polyid != (AttrBuffer[pixeladdr+ScanlineWidth] >> 24)) && (z < DepthBuffer[pixeladdr+ScanlineWidth])))
+            for (int i = 0; i < 4; i++)
             {
+                if ((polyid != (AttrBuffer[pixeladdr + neighbours[i]] >> 24)) && (z < DepthBuffer[pixeladdr + neighbours[i]]))
+                {
+                    edgemask[x >> 6] |= 1ULL << (x & 0x3F);
+                    break;
+                }
+            }
+        }
+
+        for (int i = 0; i < 4; i++)
+        {
+            u64 mask = edgemask[i];
+            while (mask)
+            {
+                u32 pixeladdr = lineaddr + (i << 6) + __builtin_ctzll(mask);
+                mask &= mask - 1;
+
+                u32 polyid = AttrBuffer[pixeladdr] >> 24;
+
                 u16 edgecolor = RenderEdgeTable[polyid >> 3];
                 u32 edgeR = (edgecolor << 1) & 0x3E; if (edgeR) edgeR++;
                 u32 edgeG = (edgecolor >> 4) & 0x3E; if (edgeG) edgeG++;
@@ -1419,7 +2491,60 @@ void SoftRenderer::ScanlineFinalPass(s32 y)
         u32 fogB = (RenderFogColor >> 9) & 0x3E; if (fogB) fogB++;
         u32 fogA = (RenderFogColor >> 16) & 0x1F;
 
-        for (int x = 0; x < 256; x++)
+        // the densities come from a table lookup per pixel,
+        // the blending is then done four pixels at a time
+        int x = 0;
+#if defined(__SSE2__) || defined(__aarch64__)
+        u32 fogcolorRGBA = fogR | (fogG << 8) | (fogB << 16) | (fogA << 24);
+        for (; x < 256; x += 4)
+        {
+            u32 pixeladdr = FirstPixelOffset + (y*ScanlineWidth) + x;
+
+            for (int layer = 0; layer < 2; layer++)
+            {
+                alignas(16) u32 density[4];
+                alignas(16) u32 apply[4];
+                bool anyfog = false;
+
+                for (int i = 0; i < 4; i++)
+                {
+                    // fog for the lower pixel only applies under fogged edges
+                    u32 attr = AttrBuffer[pixeladdr + i];
+                    bool fog = attr & (1<<15);
+                    if (layer == 1)
+                        fog = fog && (attr & 0x3) && (AttrBuffer[pixeladdr + BufferSize + i] & (1<<15));
+
+                    density[i] = fog ? CalculateFogDensity(pixeladdr + layer*BufferSize + i) : 0;
+                    apply[i] = fog ? 0xFFFFFFFF : 0;
+                    anyfog |= fog;
+                }
+
+                if (!anyfog) continue;
+
+                u32* dst = &ColorBuffer[pixeladdr + layer*BufferSize];
+#if defined(__SSE2__)
+                __m128i vdensity = _mm_load_si128((__m128i*)density);
+                __m128i vdensityrgb = fogcolor ? vdensity : _mm_setzero_si128();
+                __m128i src = _mm_loadu_si128((__m128i*)dst);
+
+                __m128i res = BlendColors<7>(_mm_set1_epi32(fogcolorRGBA), src,
+                    vdensityrgb, _mm_sub_epi32(_mm_set1_epi32(128), vdensityrgb),
+                    vdensity, _mm_sub_epi32(_mm_set1_epi32(128), vdensity));
+                _mm_storeu_si128((__m128i*)dst, Select(_mm_load_si128((__m128i*)apply), res, src));
+#else
+                uint32x4_t vdensity = vld1q_u32(density);
+                uint32x4_t vdensityrgb = fogcolor ? vdensity : vdupq_n_u32(0);
+                uint32x4_t src = vld1q_u32(dst);
+
+                uint32x4_t res = BlendColors<7>(vdupq_n_u32(fogcolorRGBA), src,
+                    vdensityrgb, vsubq_u32(vdupq_n_u32(128), vdensityrgb),
+                    vdensity, vsubq_u32(vdupq_n_u32(128), vdensity));
+                vst1q_u32(dst, vbslq_u32(vld1q_u32(apply), res, src));
+#endif
+            }
+        }
+#endif
+        for (; x < 256; x++)
         {
             u32 pixeladdr = FirstPixelOffset + (y*ScanlineWidth) + x;
             u32 density, srccolor, srcR, srcG, srcB, srcA;
@@ -1483,7 +2608,64 @@ void SoftRenderer::ScanlineFinalPass(s32 y)
         // edges were flagged and their coverages calculated during rendering
         // this is where such edge pixels are blended with the pixels underneath
 
-        for (int x = 0; x < 256; x++)
+        int x = 0;
+#if defined(__SSE2__)
+        for (; x < 256; x += 4)
+        {
+            u32 pixeladdr = FirstPixelOffset + (y*ScanlineWidth) + x;
+
+            __m128i attr = _mm_loadu_si128((__m128i*)&AttrBuffer[pixeladdr]);
+            __m128i coverage = _mm_and_si128(_mm_srli_epi32(attr, 8), _mm_set1_epi32(0x1F));
+
+            __m128i edge = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(attr, _mm_set1_epi32(0x3)), _mm_setzero_si128()),
+                                            _mm_xor_si128(_mm_cmpeq_epi32(coverage, _mm_set1_epi32(0x1F)), _mm_set1_epi32(-1)));
+            if (_mm_movemask_epi8(edge) == 0) continue;
+
+            __m128i topcolor = _mm_loadu_si128((__m128i*)&ColorBuffer[pixeladdr]);
+            __m128i botcolor = _mm_loadu_si128((__m128i*)&ColorBuffer[pixeladdr+BufferSize]);
+
+            // only blend color if the bottom pixel isn't fully transparent
+            __m128i weight = _mm_add_epi32(coverage, _mm_set1_epi32(1));
+            __m128i bottransparent = _mm_cmpeq_epi32(_mm_and_si128(botcolor, _mm_set1_epi32(0x1F000000)), _mm_setzero_si128());
+            __m128i weightrgb = Select(bottransparent, _mm_set1_epi32(32), weight);
+
+            __m128i res = BlendColors<5>(topcolor, botcolor,
+                weightrgb, _mm_sub_epi32(_mm_set1_epi32(32), weightrgb),
+                weight, _mm_sub_epi32(_mm_set1_epi32(32), weight));
+
+            // zero coverage just takes the pixel underneath
+            res = Select(_mm_cmpeq_epi32(coverage, _mm_setzero_si128()), botcolor, res);
+            _mm_storeu_si128((__m128i*)&ColorBuffer[pixeladdr], Select(edge, res, topcolor));
+        }
+#elif defined(__aarch64__)
+        for (; x < 256; x += 4)
+        {
+            u32 pixeladdr = FirstPixelOffset + (y*ScanlineWidth) + x;
+
+            uint32x4_t attr = vld1q_u32(&AttrBuffer[pixeladdr]);
+            uint32x4_t coverage = vandq_u32(vshrq_n_u32(attr, 8), vdupq_n_u32(0x1F));
+
+            uint32x4_t edge = vbicq_u32(vtstq_u32(attr, vdupq_n_u32(0x3)), vceqq_u32(coverage, vdupq_n_u32(0x1F)));
+            if (vmaxvq_u32(edge) == 0) continue;
+
+            uint32x4_t topcolor = vld1q_u32(&ColorBuffer[pixeladdr]);
+            uint32x4_t botcolor = vld1q_u32(&ColorBuffer[pixeladdr+BufferSize]);
+
+            // only blend color if the bottom pixel isn't fully transparent
+            uint32x4_t weight = vaddq_u32(coverage, vdupq_n_u32(1));
+            uint32x4_t botopaque = vtstq_u32(botcolor, vdupq_n_u32(0x1F000000));
+            uint32x4_t weightrgb = vbslq_u32(botopaque, weight, vdupq_n_u32(32));
+
+            uint32x4_t res = BlendColors<5>(topcolor, botcolor,
+                weightrgb, vsubq_u32(vdupq_n_u32(32), weightrgb),
+                weight, vsubq_u32(vdupq_n_u32(32), weight));
+
+            // zero coverage just takes the pixel underneath
+            res = vbslq_u32(vceqq_u32(coverage, vdupq_n_u32(0)), botcolor, res);
+            vst1q_u32(&ColorBuffer[pixeladdr], vbslq_u32(edge, res, topcolor));
+        }
+#endif
+        for (; x < 256; x++)
         {
             u32 pixeladdr = FirstPixelOffset + (y*ScanlineWidth) + x;
 
@@ -1569,7 +2751,59 @@ void SoftRenderer::ClearBuffers()
 
         for (int y = 0; y < ScanlineWidth*192; y+=ScanlineWidth)
         {
-            for (int x = 0; x < 256; x++)
+            int x = 0;
+#if defined(__SSE2__) || defined(__aarch64__)
+            // the bitmap lines wrap around, unwrap them first
+            // so they can be converted four pixels at a time
+            u16 line2[256], line3[256];
+            u16* src2 = (u16*)&GPU::VRAMFlat_Texture[0x40000 + (yoff << 9)];
+            u16* src3 = (u16*)&GPU::VRAMFlat_Texture[0x60000 + (yoff << 9)];
+            memcpy(&line2[0], &src2[xoff], (256 - xoff) * 2);
+            memcpy(&line2[256 - xoff], &src2[0], xoff * 2);
+            memcpy(&line3[0], &src3[xoff], (256 - xoff) * 2);
+            memcpy(&line3[256 - xoff], &src3[0], xoff * 2);
+
+            for (; x < 256; x += 4)
+            {
+                u32 pixeladdr = FirstPixelOffset + y + x;
+#if defined(__SSE2__)
+                __m128i val2 = _mm_unpacklo_epi16(_mm_loadl_epi64((__m128i*)&line2[x]), _mm_setzero_si128());
+                __m128i val3 = _mm_unpacklo_epi16(_mm_loadl_epi64((__m128i*)&line3[x]), _mm_setzero_si128());
+
+                // all three color channels at once, each nonzero one gets incremented
+                __m128i color = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(val2, 1), _mm_set1_epi32(0x3E)),
+                                _mm_or_si128(_mm_and_si128(_mm_slli_epi32(val2, 4), _mm_set1_epi32(0x3E00)),
+                                             _mm_and_si128(_mm_slli_epi32(val2, 7), _mm_set1_epi32(0x3E0000))));
+                color = _mm_add_epi32(color, _mm_andnot_si128(_mm_cmpeq_epi8(color, _mm_setzero_si128()), _mm_set1_epi32(0x010101)));
+                color = _mm_or_si128(color, _mm_and_si128(_mm_srai_epi32(_mm_slli_epi32(val2, 16), 31), _mm_set1_epi32(0x1F000000)));
+
+                __m128i z = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(val3, _mm_set1_epi32(0x7FFF)), 9), _mm_set1_epi32(0x1FF));
+                __m128i attr = _mm_or_si128(_mm_set1_epi32(polyid), _mm_and_si128(val3, _mm_set1_epi32(0x8000)));
+
+                _mm_storeu_si128((__m128i*)&ColorBuffer[pixeladdr], color);
+                _mm_storeu_si128((__m128i*)&DepthBuffer[pixeladdr], z);
+                _mm_storeu_si128((__m128i*)&AttrBuffer[pixeladdr], attr);
+#else
+                uint32x4_t val2 = vmovl_u16(vld1_u16(&line2[x]));
+                uint32x4_t val3 = vmovl_u16(vld1_u16(&line3[x]));
+
+                uint32x4_t color = vorrq_u32(vandq_u32(vshlq_n_u32(val2, 1), vdupq_n_u32(0x3E)),
+                                   vorrq_u32(vandq_u32(vshlq_n_u32(val2, 4), vdupq_n_u32(0x3E00)),
+                                             vandq_u32(vshlq_n_u32(val2, 7), vdupq_n_u32(0x3E0000))));
+                uint8x16_t nonzero = vtstq_u8(vreinterpretq_u8_u32(color), vreinterpretq_u8_u32(color));
+                color = vaddq_u32(color, vandq_u32(vreinterpretq_u32_u8(nonzero), vdupq_n_u32(0x010101)));
+                color = vorrq_u32(color, vandq_u32(vtstq_u32(val2, vdupq_n_u32(0x8000)), vdupq_n_u32(0x1F000000)));
+
+                uint32x4_t z = vorrq_u32(vshlq_n_u32(vandq_u32(val3, vdupq_n_u32(0x7FFF)), 9), vdupq_n_u32(0x1FF));
+                uint32x4_t attr = vorrq_u32(vdupq_n_u32(polyid), vandq_u32(val3, vdupq_n_u32(0x8000)));
+
+                vst1q_u32(&ColorBuffer[pixeladdr], color);
+                vst1q_u32(&DepthBuffer[pixeladdr], z);
+                vst1q_u32(&AttrBuffer[pixeladdr], attr);
+#endif
+            }
+#endif
+            for (; x < 256; x++)
             {
                 u16 val2 = ReadVRAM_Texture<u16>(0x40000 + (yoff << 9) + (xoff << 1));
                 u16 val3 = ReadVRAM_Texture<u16>(0x60000 + (yoff << 9) + (xoff << 1));
@@ -1607,7 +2841,25 @@ void SoftRenderer::ClearBuffers()
 
         for (int y = 0; y < ScanlineWidth*192; y+=ScanlineWidth)
         {
-            for (int x = 0; x < 256; x++)
+            int x = 0;
+#if defined(__SSE2__)
+            for (; x < 256; x += 4)
+            {
+                u32 pixeladdr = FirstPixelOffset + y + x;
+                _mm_storeu_si128((__m128i*)&ColorBuffer[pixeladdr], _mm_set1_epi32(color));
+                _mm_storeu_si128((__m128i*)&DepthBuffer[pixeladdr], _mm_set1_epi32(clearz));
+                _mm_storeu_si128((__m128i*)&AttrBuffer[pixeladdr], _mm_set1_epi32(polyid));
+            }
+#elif defined(__aarch64__)
+            for (; x < 256; x += 4)
+            {
+                u32 pixeladdr = FirstPixelOffset + y + x;
+                vst1q_u32(&ColorBuffer[pixeladdr], vdupq_n_u32(color));
+                vst1q_u32(&DepthBuffer[pixeladdr], vdupq_n_u32(clearz));
+                vst1q_u32(&AttrBuffer[pixeladdr], vdupq_n_u32(polyid));
+            }
+#endif
+            for (; x < 256; x++)
             {
                 u32 pixeladdr = FirstPixelOffset + y + x;
                 ColorBuffer[pixeladdr] = color;
@@ -1618,20 +2870,87 @@ void SoftRenderer::ClearBuffers()
     }
 }
 
+void SoftRenderer::FinishScanline(s32 y)
+{
+    ScanlineFinalPass(y);
+
+    Platform::Mutex_Lock(LineFinishedLock);
+    LineFinished[y] = true;
+    while (LinesPublished < 192 && LineFinished[LinesPublished])
+    {
+        LinesPublished++;
+        Platform::Semaphore_Post(Sema_ScanlineCount);
+    }
+    Platform::Mutex_Unlock(LineFinishedLock);
+}
+
 void SoftRenderer::RenderPolygons(bool threaded, Polygon** polygons, int npolys)
 {
-    int j = 0;
+    // decode all the textures beforehand, so that the cache
+    // is only read from while the scanlines are rendered
+    TexCacheFrame++;
+
     for (int i = 0; i < npolys; i++)
     {
-        if (polygons[i]->Degenerate) continue;
-        SetupPolygon(&PolygonList[j++], polygons[i]);
+        Polygon* polygon = polygons[i];
+
+        if ((RenderDispCnt & (1<<0)) && (((polygon->TexParam >> 26) & 0x7) != 0) && !polygon->Degenerate)
+            PolygonTextures[i] = GetTexture(polygon->TexParam, polygon->TexPalette);
+        else
+            PolygonTextures[i] = NULL;
+    }
+
+    // shadows depend on the stencil buffer contents of the previous scanlines,
+    // so those frames are always rendered in one go
+    bool shadows = false;
+    for (int i = 0; i < npolys; i++)
+    {
+        if (polygons[i]->IsShadowMask || polygons[i]->IsShadow)
+        {
+            shadows = true;
+            break;
+        }
+    }
+
+    if (threaded && NumBands > 1 && !shadows)
+    {
+        BandPolygons = polygons;
+        BandNumPolygons = npolys;
+
+        // this is what it would end up as after rendering everything in order
+        for (int i = 0; i < npolys; i++)
+        {
+            if (!polygons[i]->Degenerate && polygons[i]->YTop < 192)
+            {
+                PrevIsShadowMask = false;
+                break;
+            }
+        }
+
+        for (int i = 0; i < NumBands; i++)
+            BandBorders[i] = 0;
+        memset(LineFinished, 0, sizeof(LineFinished));
+        LinesPublished = 0;
+
+        for (int i = 1; i < NumBands; i++)
+            Platform::Semaphore_Post(Bands[i].Sema_Start);
+
+        RenderBandScanlines(0);
+
+        for (int i = 1; i < NumBands; i++)
+            Platform::Semaphore_Wait(Sema_BandsDone);
+
+        return;
     }
 
-    RenderScanline(0, j);
+    RenderBand& band = Bands[0];
+    SetupBand(band, 0, 192, polygons, npolys);
+
+    RenderScanline(band, 0);
 
     for (s32 y = 1; y < 192; y++)
     {
-        RenderScanline(y, j);
+        RenderScanline(band, y);
         ScanlineFinalPass(y-1);
 
         if (threaded)
@@ -1644,6 +2963,37 @@ void SoftRenderer::RenderPolygons(bool threaded, Polygon** polygons, int npolys)
         Platform::Semaphore_Post(Sema_ScanlineCount);
 }
 
+void SoftRenderer::RenderBandScanlines(int b)
+{
+    RenderBand& band = Bands[b];
+    SetupBand(band, (192 * b) / NumBands, (192 * (b + 1)) / NumBands, BandPolygons, BandNumPolygons);
+
+    for (s32 y = band.YStart; y < band.YEnd; y++)
+    {
+        RenderScanline(band, y);
+
+        // the first line of a band needs the line above it for edge marking
+        if (y-1 > band.YStart || (y-1 == band.YStart && b == 0))
+            FinishScanline(y-1);
+    }
+
+    if (b == NumBands - 1)
+    {
+        FinishScanline(band.YEnd - 1);
+    }
+    else if (BandBorders[b + 1]++ == 1)
+    {
+        FinishScanline(band.YEnd - 1);
+        FinishScanline(band.YEnd);
+    }
+
+    if (b > 0 && BandBorders[b]++ == 1)
+    {
+        FinishScanline(band.YStart - 1);
+        FinishScanline(band.YStart);
+    }
+}
+
 void SoftRenderer::VCount144()
 {
     if (RenderThreadRunning.load(std::memory_order_relaxed))
@@ -1658,6 +3008,11 @@ void SoftRenderer::RenderFrame()
     bool textureChanged = GPU::MakeVRAMFlat_TextureCoherent(textureDirty);
     bool texPalChanged = GPU::MakeVRAMFlat_TexPalCoherent(texPalDirty);
 
+    if (textureChanged || texPalChanged)
+        InvalidateTexCache(textureDirty, texPalDirty);
+    else
+        VolatileTextures.clear();
+
     FrameIdentical = !(textureChanged || texPalChanged) && RenderFrameIdentical;
 
     if (RenderThreadRunning.load(std::memory_order_relaxed))
@@ -1699,6 +3054,19 @@ void SoftRenderer::RenderThreadFunc()
     }
 }
 
+void SoftRenderer::BandThreadFunc(int band)
+{
+    for (;;)
+    {
+        Platform::Semaphore_Wait(Bands[band].Sema_Start);
+        if (!RenderThreadRunning) return;
+
+        RenderBandScanlines(band);
+
+        Platform::Semaphore_Post(Sema_BandsDone);
+    }
+}
+
 u32* SoftRenderer::GetLine(int line)
 {
     if (RenderThreadRunning.load(std::memory_order_relaxed))
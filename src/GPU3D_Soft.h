@@ -22,9 +22,45 @@
 #include "Platform.h"
 #include <thread>
 #include <atomic>
+#include <unordered_map>
+#include <list>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 namespace GPU3D
 {
+
+// (1<<30) / x for the divisors which occur when setting up slopes and
+// interpolators, anything outside of it falls back to a proper division
+struct ReciprocalTable
+{
+    static constexpr int Size = 1024;
+    s32 Values[Size];
+
+    constexpr ReciprocalTable() : Values()
+    {
+        for (int i = 1; i < Size; i++)
+            Values[i] = (1<<30) / i;
+    }
+
+    // the division truncates towards zero, so negative divisors
+    // simply negate the result
+    s32 Reciprocal(s32 x) const
+    {
+        if (x > -Size && x < Size)
+            return (x < 0) ? -Values[-x] : Values[x];
+
+        return (1<<30) / x;
+    }
+};
+
+inline constexpr ReciprocalTable Reciprocals;
+
 class SoftRenderer : public Renderer3D
 {
 public:
@@ -79,9 +115,8 @@ private:
             this->xdiff = x1 - x0;
 
             // calculate reciprocals for linear mode and Z interpolation
-            // TODO eventually: use a faster reciprocal function?
             if (this->xdiff != 0)
-                this->xrecip = (1<<30) / this->xdiff;
+                this->xrecip = Reciprocals.Reciprocal(this->xdiff);
             else
                 this->xrecip = 0;
             this->xrecip_z = this->xrecip >> 8;
@@ -123,6 +158,11 @@ private:
 
                 this->shift = 8;
             }
+
+            // see SetX(), W values are normalized to 16 bits
+            // which also keeps the integer calculation free of overflows
+            this->fastdiv = (w0n >= 0 && w0n < 0x10000) && (w0d >= 0 && w0d < 0x10000) && (w1d >= 0 && w1d < 0x10000)
+                && (xdiff > 0 && xdiff < 0x1000);
         }
 
         void SetX(s32 x)
@@ -136,8 +176,79 @@ private:
 
                 // this seems to be a proper division on hardware :/
                 // I haven't been able to find cases that produce imperfect output
-                if (den == 0) yfactor = 0;
-                else          yfactor = (s32)(num / den);
+                // within the edge all terms are small enough to be exact as doubles,
+                // then the truncated double division gives the same result and is a lot faster
+                if (den == 0)
+                    yfactor = 0;
+                else if (fastdiv && x >= 0 && x <= xdiff)
+                    yfactor = (s32)((double)num / den);
+                else
+                    yfactor = (s32)(num / den);
+            }
+        }
+
+        // same as SetX(), with a factor calculated beforehand by CalculateFactors()
+        void SetX(s32 x, u32 factor)
+        {
+            x -= x0;
+            this->x = x;
+            if (xdiff != 0 && !linear)
+                yfactor = factor;
+        }
+
+        // calculates the factors for count pixels starting at x at once,
+        // two at a time with SIMD when available.
+        // as long as all the terms are below 2^53 doing the division on doubles
+        // and truncating gives the same result as the integer division
+        void CalculateFactors(s32 x, s32 count, u32* factors)
+        {
+            if (xdiff == 0 || linear) return;
+
+            x -= x0;
+            s32 i = 0;
+
+#if defined(__SSE2__) || defined(__aarch64__)
+            if (fastdiv && x >= 0 && x + count <= xdiff)
+            {
+                double numscale = (double)w0n * (1<<shift);
+#if defined(__SSE2__)
+                __m128d vnumscale = _mm_set1_pd(numscale);
+                __m128d vw0d = _mm_set1_pd(w0d);
+                __m128d vw1d = _mm_set1_pd(w1d);
+                __m128d vxdiff = _mm_set1_pd(xdiff);
+                for (; i+2 <= count; i += 2)
+                {
+                    __m128d vx = _mm_set_pd(x+i+1, x+i);
+                    __m128d num = _mm_mul_pd(vx, vnumscale);
+                    __m128d den = _mm_add_pd(_mm_mul_pd(vx, vw0d), _mm_mul_pd(_mm_sub_pd(vxdiff, vx), vw1d));
+                    __m128d quot = _mm_and_pd(_mm_div_pd(num, den), _mm_cmpneq_pd(den, _mm_setzero_pd()));
+                    _mm_storel_epi64((__m128i*)&factors[i], _mm_cvttpd_epi32(quot));
+                }
+#else
+                float64x2_t vnumscale = vdupq_n_f64(numscale);
+                float64x2_t vw0d = vdupq_n_f64(w0d);
+                float64x2_t vw1d = vdupq_n_f64(w1d);
+                float64x2_t vxdiff = vdupq_n_f64(xdiff);
+                for (; i+2 <= count; i += 2)
+                {
+                    float64x2_t vx = {(double)(x+i), (double)(x+i+1)};
+                    float64x2_t num = vmulq_f64(vx, vnumscale);
+                    float64x2_t den = vaddq_f64(vmulq_f64(vx, vw0d), vmulq_f64(vsubq_f64(vxdiff, vx), vw1d));
+                    int64x2_t quot = vcvtq_s64_f64(vdivq_f64(num, den));
+                    quot = vandq_s64(quot, vreinterpretq_s64_u64(vmvnq_u64(vceqzq_f64(den))));
+                    vst1_u32(&factors[i], vmovn_u64(vreinterpretq_u64_s64(quot)));
+                }
+#endif
+            }
+#endif
+
+            for (; i < count; i++)
+            {
+                s64 num = ((s64)(x+i) * w0n) << shift;
+                s32 den = ((x+i) * w0d) + ((xdiff-(x+i)) * w1d);
+
+                if (den == 0) factors[i] = 0;
+                else          factors[i] = (s32)(num / den);
             }
         }
 
@@ -214,11 +325,16 @@ private:
             }
         }
 
+        // whether Interpolate() uses the factor from SetX(), the shift it's applied with
+        bool UsesFactors() { return xdiff != 0 && !linear; }
+        int FactorShift() { return shift; }
+
     private:
         s32 x0, x1, xdiff, x;
 
         int shift;
         bool linear;
+        bool fastdiv;
 
         s32 xrecip, xrecip_z;
         s32 w0n, w0d, w1d;
@@ -298,7 +414,9 @@ private:
                 Increment = 0x40000;
             else
             {
-                s32 yrecip = (1<<18) / ylen;
+                // (1<<18) / ylen, which is the same as (1<<30) / ylen shifted down
+                s32 yrecip = Reciprocals.Reciprocal(ylen);
+                yrecip = (yrecip < 0) ? -((-yrecip) >> 12) : (yrecip >> 12);
                 Increment = (x1-x0) * yrecip;
                 if (Increment < 0) Increment = -Increment;
             }
@@ -443,6 +561,10 @@ private:
         return *(T*)&GPU::VRAMFlat_TexPal[addr & 0x1FFFF];
     }
 
+    struct RendererPolygon;
+
+    typedef void (SoftRenderer::*ScanlineFuncType)(RendererPolygon* rp, s32 y);
+
     struct RendererPolygon
     {
         Polygon* PolyData;
@@ -453,24 +575,118 @@ private:
         u32 CurVL, CurVR;
         u32 NextVL, NextVR;
 
+        // decoded texture from the cache, NULL if untextured
+        // or if the texture is read straight from VRAM
+        u32* Texture;
+
+        // specialised for the polygon's attributes in SetupPolygon()
+        ScanlineFuncType ScanlineFunc;
+    };
+
+    // a horizontal slice of the screen, each rendered by its own thread.
+    // the first band is rendered by the render thread itself and is also
+    // used when rendering sequentially
+    struct RenderBand
+    {
+        s32 YStart, YEnd;
+
+        RendererPolygon PolygonList[2048];
+        int NumPolygons;
+
+        // polygons bucketed by the first line of the band they appear on,
+        // the ones starting at line y begin at PolygonsByLine[LineStart[y - YStart]]
+        u16 PolygonsByLine[2048];
+        u16 LineStart[192 + 1];
+
+        // polygons covering the current line, in drawing order
+        u16 ActivePolygons[2048];
+        int NumActivePolygons;
+
+        Platform::Thread* Thread;
+        Platform::Semaphore* Sema_Start;
+    };
+
+    static constexpr int MaxRenderBands = 8;
+
+    RenderBand Bands[MaxRenderBands];
+    // VRAM ranges a texture is decoded from, to know when it has to be thrown away
+    struct TexSource
+    {
+        u32 TexAddr, TexSize;
+        u32 PalAddr, PalSize;
+        bool Compressed;
+    };
+
+    // textures are decoded once into a cache, with one texel per word
+    // bit0-15: color, bit24-28: alpha
+    struct TexCacheEntry
+    {
+        u32 Width, Height;
+        TexSource Source;
+
+        u32 LastUsed;
+        std::list<u64>::iterator LRUPos;
+
+        std::vector<u32> Texels;
     };
 
-    RendererPolygon PolygonList[2048];
-    void TextureLookup(u32 texparam, u32 texpal, s16 s, s16 t, u16* color, u8* alpha);
-    u32 RenderPixel(Polygon* polygon, u8 vr, u8 vg, u8 vb, s16 s, s16 t);
+    std::unordered_map<u64, TexCacheEntry> TexCache;
+    std::list<u64> TexCacheLRU; // most recently used first
+    u32 TexCacheTexels;
+    u32 TexCacheFrame;
+
+    // the cache can't grow past 16MB, the least recently used textures are evicted to make room.
+    // Textures which don't fit even then are read straight from VRAM
+    static constexpr u32 MaxTexCacheTexels = 4 * 1024 * 1024;
+
+    // textures which changed on the previous frame are likely to change again,
+    // they're also read straight from VRAM for as long as they keep changing
+    struct VolatileTexture
+    {
+        TexSource Source;
+        u32 LastUsed;
+    };
+    std::unordered_map<u64, VolatileTexture> VolatileTextures;
+
+    // the textures of the polygons of the current frame
+    u32* PolygonTextures[2048];
+
+    void DecodeTexel(u32 texparam, u32 texpal, s32 s, s32 t, u16* color, u8* alpha);
+    u32* GetTexture(u32 texparam, u32 texpal);
+    void EvictTexture(std::unordered_map<u64, TexCacheEntry>::iterator it);
+    bool TexSourceDirty(TexSource& source,
+        NonStupidBitField<512*1024/GPU::VRAMDirtyGranularity>& textureDirty,
+        NonStupidBitField<128*1024/GPU::VRAMDirtyGranularity>& texPalDirty);
+    void InvalidateTexCache(NonStupidBitField<512*1024/GPU::VRAMDirtyGranularity>& textureDirty,
+        NonStupidBitField<128*1024/GPU::VRAMDirtyGranularity>& texPalDirty);
+    void TextureLookup(u32 texparam, u32 texpal, u32* texture, s16 s, s16 t, u16* color, u8* alpha);
+    template <int blendmode, bool highlight, bool textured, bool wireframe>
+    u32 RenderPixel(RendererPolygon* rp, u8 vr, u8 vg, u8 vb, s16 s, s16 t);
+    void RenderSpanColors(RendererPolygon* rp, Interpolator<0>& interpX, s32 x, s32 count, u32* factors,
+        s32* attrl, s32* attrr, bool decal, u32* colors);
     void PlotTranslucentPixel(u32 pixeladdr, u32 color, u32 z, u32 polyattr, u32 shadow);
     void SetupPolygonLeftEdge(RendererPolygon* rp, s32 y);
     void SetupPolygonRightEdge(RendererPolygon* rp, s32 y);
     void SetupPolygon(RendererPolygon* rp, Polygon* polygon);
+    template <int depthmode, bool wbuffer>
     void RenderShadowMaskScanline(RendererPolygon* rp, s32 y);
+    template <int depthmode, bool wbuffer, int blendmode, bool highlight, bool textured, bool wireframe>
     void RenderPolygonScanline(RendererPolygon* rp, s32 y);
-    void RenderScanline(s32 y, int npolys);
+    template <int depthmode, bool wbuffer, int blendmode, bool highlight>
+    ScanlineFuncType GetScanlineFunc(bool textured, bool wireframe);
+    template <int depthmode, bool wbuffer>
+    ScanlineFuncType GetScanlineFunc(RendererPolygon* rp);
+    void SetupBand(RenderBand& band, s32 ystart, s32 yend, Polygon** polygons, int npolys);
+    void RenderScanline(RenderBand& band, s32 y);
     u32 CalculateFogDensity(u32 pixeladdr);
     void ScanlineFinalPass(s32 y);
+    void FinishScanline(s32 y);
     void ClearBuffers();
     void RenderPolygons(bool threaded, Polygon** polygons, int npolys);
+    void RenderBandScanlines(int band);
 
     void RenderThreadFunc();
+    void BandThreadFunc(int band);
 
     // buffer dimensions are 258x194 to add a offscreen 1px border
     // which simplifies edge marking tests
@@ -512,5 +728,21 @@ private:
     Platform::Semaphore* Sema_RenderStart;
     Platform::Semaphore* Sema_RenderDone;
     Platform::Semaphore* Sema_ScanlineCount;
+
+    int NumBands;
+    Platform::Semaphore* Sema_BandsDone;
+
+    // the polygons of the frame which is currently rendered by the bands
+    Polygon** BandPolygons;
+    int BandNumPolygons;
+
+    // the scanlines at the border of two bands are finished
+    // by whichever of them is done last
+    std::atomic_int BandBorders[MaxRenderBands];
+
+    // bands finish their lines out of order, but GetLine() needs them in order
+    Platform::Mutex* LineFinishedLock;
+    bool LineFinished[192];
+    int LinesPublished;
 };
 }
\ No newline at end of file
@@ -26,6 +26,12 @@
 #include <initializer_list>
 #include <algorithm>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 // like std::bitset but less stupid and optimised for 
 // our use case (keeping track of memory invalidations)
 
@@ -110,6 +116,85 @@ struct NonStupidBitField
         }
     };
 
+    // iterates over runs of consecutive set bits, for callers which can handle whole ranges at once
+    struct Run
+    {
+        u32 Start;
+        u32 Length;
+    };
+
+    struct RunIterator
+    {
+        NonStupidBitField<Size>& BitField;
+        Run Current;
+
+        Run operator*() { return Current; }
+
+        bool operator==(const RunIterator& other)
+        {
+            return other.Current.Start == Current.Start;
+        }
+        bool operator!=(const RunIterator& other)
+        {
+            return other.Current.Start != Current.Start;
+        }
+
+        void Next()
+        {
+            u32 pos = Current.Start + Current.Length;
+            u32 idx = pos >> 6;
+            if (idx >= DataLength)
+            {
+                Current = {Size, 0};
+                return;
+            }
+
+            // find the start of the next run
+            u64 bits = BitField.Data[idx] & (0xFFFFFFFFFFFFFFFF << (pos & 0x3F));
+            while (!bits)
+            {
+                if (++idx == DataLength)
+                {
+                    Current = {Size, 0};
+                    return;
+                }
+                bits = BitField.Data[idx];
+            }
+
+            u32 start = idx * 64 + __builtin_ctzll(bits);
+            if (start >= Size)
+            {
+                Current = {Size, 0};
+                return;
+            }
+
+            // and then its end
+            bits = ~BitField.Data[idx] & (0xFFFFFFFFFFFFFFFF << (start & 0x3F));
+            while (!bits)
+            {
+                if (++idx == DataLength)
+                    break;
+                bits = ~BitField.Data[idx];
+            }
+
+            u32 end = (idx == DataLength) ? Size : std::min(idx * 64 + __builtin_ctzll(bits), Size);
+            Current = {start, end - start};
+        }
+
+        RunIterator operator++(int)
+        {
+            RunIterator prev(*this);
+            ++*this;
+            return prev;
+        }
+
+        RunIterator& operator++()
+        {
+            Next();
+            return *this;
+        }
+    };
+
     NonStupidBitField(u32 startBit, u32 bitsCount)
     {
         Clear();
@@ -153,6 +238,17 @@ struct NonStupidBitField
         return End();
     }
 
+    RunIterator RunsEnd()
+    {
+        return RunIterator{*this, {Size, 0}};
+    }
+    RunIterator RunsBegin()
+    {
+        RunIterator it{*this, {0, 0}};
+        it.Next();
+        return it;
+    }
+
     void Clear()
     {
         memset(Data, 0, sizeof(Data));
@@ -184,9 +280,68 @@ struct NonStupidBitField
         }
     }
 
+    bool AnyInRange(u32 startBit, u32 bitsCount)
+    {
+        if (bitsCount == 0)
+            return false;
+
+        u32 endBit = startBit + bitsCount;
+        u32 startEntry = startBit >> 6;
+        u32 endEntry = (endBit - 1) >> 6;
+
+        for (u32 i = startEntry; i <= endEntry; i++)
+        {
+            u64 mask = 0xFFFFFFFFFFFFFFFF;
+            if (i == startEntry)
+                mask &= 0xFFFFFFFFFFFFFFFF << (startBit & 0x3F);
+            if (i == endEntry && (endBit & 0x3F))
+                mask &= ~(0xFFFFFFFFFFFFFFFF << (endBit & 0x3F));
+
+            if (Data[i] & mask)
+                return true;
+        }
+        return false;
+    }
+
+    // the whole field operations below go two words at a time where possible
+    bool Any()
+    {
+        u32 i = 0;
+#if defined(__SSE2__)
+        __m128i any = _mm_setzero_si128();
+        for (; i + 2 <= DataLength; i += 2)
+            any = _mm_or_si128(any, _mm_loadu_si128((__m128i*)&Data[i]));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xFFFF)
+            return true;
+#elif defined(__aarch64__)
+        uint64x2_t any = vdupq_n_u64(0);
+        for (; i + 2 <= DataLength; i += 2)
+            any = vorrq_u64(any, vld1q_u64(&Data[i]));
+        if (vmaxvq_u32(vreinterpretq_u32_u64(any)))
+            return true;
+#endif
+        for (; i < DataLength; i++)
+        {
+            if (Data[i])
+                return true;
+        }
+        return false;
+    }
+
     NonStupidBitField& operator|=(const NonStupidBitField<Size>& other)
     {
-        for (u32 i = 0; i < DataLength; i++)
+        u32 i = 0;
+#if defined(__SSE2__)
+        for (; i + 2 <= DataLength; i += 2)
+        {
+            __m128i val = _mm_or_si128(_mm_loadu_si128((__m128i*)&Data[i]), _mm_loadu_si128((__m128i*)&other.Data[i]));
+            _mm_storeu_si128((__m128i*)&Data[i], val);
+        }
+#elif defined(__aarch64__)
+        for (; i + 2 <= DataLength; i += 2)
+            vst1q_u64(&Data[i], vorrq_u64(vld1q_u64(&Data[i]), vld1q_u64(&other.Data[i])));
+#endif
+        for (; i < DataLength; i++)
         {
             Data[i] |= other.Data[i];
         }
@@ -194,7 +349,18 @@ struct NonStupidBitField
     }
     NonStupidBitField& operator&=(const NonStupidBitField<Size>& other)
     {
-        for (u32 i = 0; i < DataLength; i++)
+        u32 i = 0;
+#if defined(__SSE2__)
+        for (; i + 2 <= DataLength; i += 2)
+        {
+            __m128i val = _mm_and_si128(_mm_loadu_si128((__m128i*)&Data[i]), _mm_loadu_si128((__m128i*)&other.Data[i]));
+            _mm_storeu_si128((__m128i*)&Data[i], val);
+        }
+#elif defined(__aarch64__)
+        for (; i + 2 <= DataLength; i += 2)
+            vst1q_u64(&Data[i], vandq_u64(vld1q_u64(&Data[i]), vld1q_u64(&other.Data[i])));
+#endif
+        for (; i < DataLength; i++)
         {
             Data[i] &= other.Data[i];
         }